@@ -40,6 +40,9 @@ fi
 if [ -n "$TELEGRAM_HTTP_IP_ADDRESS" ]; then
   CUSTOM_ARGS="${CUSTOM_ARGS} --http-ip-address=$TELEGRAM_HTTP_IP_ADDRESS"
 fi
+if [ -n "$TELEGRAM_CLIENT_THREADS" ]; then
+  CUSTOM_ARGS="${CUSTOM_ARGS} --client-threads=$TELEGRAM_CLIENT_THREADS"
+fi
 
 COMMAND="telegram-bot-api ${DEFAULT_ARGS}${CUSTOM_ARGS}"
 
@@ -0,0 +1,134 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/utils/benchmark.h"
+#include "td/utils/common.h"
+#include "td/utils/JsonBuilder.h"
+#include "td/utils/logging.h"
+#include "td/utils/Slice.h"
+#include "td/utils/StringBuilder.h"
+
+// JSON string escaping, which checks each byte separately, used before the vectorized escaping
+static void store_json_string_bytewise(td::StringBuilder &sb, td::Slice str) {
+  sb << '"';
+  auto *s = str.begin();
+  auto len = str.size();
+  for (size_t pos = 0; pos < len; pos++) {
+    auto ch = static_cast<unsigned char>(s[pos]);
+    switch (ch) {
+      case '"':
+        sb << '\\' << '"';
+        break;
+      case '\\':
+        sb << '\\' << '\\';
+        break;
+      case '\b':
+        sb << '\\' << 'b';
+        break;
+      case '\f':
+        sb << '\\' << 'f';
+        break;
+      case '\n':
+        sb << '\\' << 'n';
+        break;
+      case '\r':
+        sb << '\\' << 'r';
+        break;
+      case '\t':
+        sb << '\\' << 't';
+        break;
+      default:
+        if (ch <= 31) {
+          sb << td::JsonOneChar(ch);
+          break;
+        }
+        if (128 <= ch) {
+          td::uint32 a = ch;
+          CHECK((a & 0x40) != 0);
+
+          CHECK(pos + 1 < len);
+          td::uint32 b = static_cast<unsigned char>(s[++pos]);
+          CHECK((b & 0xc0) == 0x80);
+          if ((a & 0x20) == 0) {
+            CHECK((a & 0x1e) > 0);
+            sb << td::JsonChar(((a & 0x1f) << 6) | (b & 0x3f));
+            break;
+          }
+
+          CHECK(pos + 1 < len);
+          td::uint32 c = static_cast<unsigned char>(s[++pos]);
+          CHECK((c & 0xc0) == 0x80);
+          if ((a & 0x10) == 0) {
+            CHECK(((a & 0x0f) | (b & 0x20)) > 0);
+            sb << td::JsonChar(((a & 0x0f) << 12) | ((b & 0x3f) << 6) | (c & 0x3f));
+            break;
+          }
+
+          CHECK(pos + 1 < len);
+          td::uint32 d = static_cast<unsigned char>(s[++pos]);
+          CHECK((d & 0xc0) == 0x80);
+          CHECK((a & 0x08) == 0);
+          CHECK(((a & 0x07) | (b & 0x30)) > 0);
+          sb << td::JsonChar(((a & 0x07) << 18) | ((b & 0x3f) << 12) | ((c & 0x3f) << 6) | (d & 0x3f));
+          break;
+        }
+        sb << s[pos];
+        break;
+    }
+  }
+  sb << '"';
+}
+
+enum class EscapeMode : td::int32 { Bytewise, Escaped, RawUtf8 };
+
+class JsonStringBench final : public td::Benchmark {
+  td::string description_;
+  td::string str_;
+  EscapeMode mode_;
+  char buffer_[1 << 16];
+
+ public:
+  JsonStringBench(td::string description, td::string str, EscapeMode mode)
+      : description_(std::move(description)), str_(std::move(str)), mode_(mode) {
+  }
+
+  td::string get_description() const final {
+    return description_;
+  }
+
+  void run(int n) final {
+    size_t result = 0;
+    for (int i = 0; i < n; i++) {
+      td::StringBuilder sb(td::MutableSlice(buffer_, sizeof(buffer_)));
+      if (mode_ == EscapeMode::Bytewise) {
+        store_json_string_bytewise(sb, str_);
+      } else {
+        sb << td::JsonString(str_, mode_ != EscapeMode::RawUtf8);
+      }
+      CHECK(!sb.is_error());
+      result += sb.as_cslice().size();
+    }
+    td::do_not_optimize_away(result);
+  }
+};
+
+static void bench_json_string(const td::string &name, const td::string &part) {
+  td::string str;
+  while (str.size() < 4000) {
+    str += part;
+  }
+  td::bench(JsonStringBench(name + ", bytewise", str, EscapeMode::Bytewise));
+  td::bench(JsonStringBench(name + ", escaped", str, EscapeMode::Escaped));
+  td::bench(JsonStringBench(name + ", raw UTF-8", str, EscapeMode::RawUtf8));
+}
+
+int main() {
+  SET_VERBOSITY_LEVEL(VERBOSITY_NAME(WARNING));
+  bench_json_string("ASCII text", "The quick brown fox jumps over the lazy dog. ");
+  bench_json_string("ASCII text with line breaks and quotes", "He said: \"Hello, world!\"\n");
+  bench_json_string("Cyrillic text", "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82, \xd0\xbc\xd0\xb8\xd1\x80! ");
+  bench_json_string("Emoji", "\xf0\x9f\x98\x80\xf0\x9f\x91\x8d ");
+}
@@ -0,0 +1,581 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/db/TQueue.h"
+
+#include "td/utils/benchmark.h"
+#include "td/utils/buffer.h"
+#include "td/utils/common.h"
+#include "td/utils/FlatHashMap.h"
+#include "td/utils/logging.h"
+#include "td/utils/misc.h"
+#include "td/utils/Promise.h"
+#include "td/utils/Random.h"
+#include "td/utils/Slice.h"
+#include "td/utils/SliceBuilder.h"
+#include "td/utils/Span.h"
+#include "td/utils/Status.h"
+#include "td/utils/Time.h"
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define TD_BENCH_HAVE_MALLINFO2 1
+#endif
+
+#include <map>
+#include <set>
+#include <utility>
+
+namespace td {
+
+// TQueueImpl as it was before the contiguous event store, with std::map<EventId, RawEvent> in each queue and
+// std::string payloads; only the TQueue interface types are nested into the class
+class MapTQueue {
+  static constexpr size_t MAX_EVENT_LENGTH = 65536 * 8;
+  static constexpr size_t MAX_QUEUE_EVENTS = 100000;
+  static constexpr size_t MAX_TOTAL_EVENT_LENGTH = 1 << 27;
+
+ public:
+  using EventId = TQueue::EventId;
+  using QueueId = TQueue::QueueId;
+
+  struct Event {
+    EventId id;
+    int32 expires_at{0};
+    Slice data;
+    int64 extra{0};
+  };
+
+  struct RawEvent {
+    uint64 log_event_id{0};
+    EventId event_id;
+    int32 expires_at{0};
+    string data;
+    int64 extra{0};
+  };
+
+  class StorageCallback {
+   public:
+    StorageCallback() = default;
+    StorageCallback(const StorageCallback &) = delete;
+    StorageCallback &operator=(const StorageCallback &) = delete;
+    StorageCallback(StorageCallback &&) = delete;
+    StorageCallback &operator=(StorageCallback &&) = delete;
+    virtual ~StorageCallback() = default;
+
+    virtual uint64 push(QueueId queue_id, const RawEvent &event) = 0;
+    virtual void pop(uint64 log_event_id) = 0;
+    virtual void close(Promise<> promise) = 0;
+  };
+
+  static unique_ptr<MapTQueue> create() {
+    return make_unique<MapTQueue>();
+  }
+
+  void set_callback(unique_ptr<StorageCallback> callback) {
+    callback_ = std::move(callback);
+  }
+  unique_ptr<StorageCallback> extract_callback() {
+    return std::move(callback_);
+  }
+
+  bool do_push(QueueId queue_id, RawEvent &&raw_event) {
+    CHECK(raw_event.event_id.is_valid());
+    // raw_event.data can be empty when replaying binlog
+    if (raw_event.data.size() > MAX_EVENT_LENGTH || queue_id == 0) {
+      return false;
+    }
+    auto &q = queues_[queue_id];
+    if (q.events.size() >= MAX_QUEUE_EVENTS || q.total_event_length > MAX_TOTAL_EVENT_LENGTH - raw_event.data.size() ||
+        raw_event.expires_at <= 0) {
+      return false;
+    }
+    auto event_id = raw_event.event_id;
+    if (event_id < q.tail_id) {
+      return false;
+    }
+
+    if (!q.events.empty()) {
+      auto it = q.events.end();
+      --it;
+      if (it->second.data.empty()) {
+        if (callback_ != nullptr && it->second.log_event_id != 0) {
+          callback_->pop(it->second.log_event_id);
+        }
+        q.events.erase(it);
+      }
+    }
+    if (q.events.empty() && !raw_event.data.empty()) {
+      schedule_queue_gc(queue_id, q, raw_event.expires_at);
+    }
+
+    if (raw_event.log_event_id == 0 && callback_ != nullptr) {
+      raw_event.log_event_id = callback_->push(queue_id, raw_event);
+    }
+    q.tail_id = event_id.next().move_as_ok();
+    q.total_event_length += raw_event.data.size();
+    q.events.emplace(event_id, std::move(raw_event));
+    return true;
+  }
+
+  Result<EventId> push(QueueId queue_id, string data, int32 expires_at, int64 extra, EventId hint_new_id) {
+    if (data.empty()) {
+      return Status::Error("Data is empty");
+    }
+    if (data.size() > MAX_EVENT_LENGTH) {
+      return Status::Error("Data is too big");
+    }
+    if (queue_id == 0) {
+      return Status::Error("Queue identifier is invalid");
+    }
+
+    auto &q = queues_[queue_id];
+    if (q.events.size() >= MAX_QUEUE_EVENTS) {
+      return Status::Error("Queue is full");
+    }
+    if (q.total_event_length > MAX_TOTAL_EVENT_LENGTH - data.size()) {
+      return Status::Error("Queue size is too big");
+    }
+    if (expires_at <= 0) {
+      return Status::Error("Failed to add already expired event");
+    }
+    EventId event_id;
+    while (true) {
+      if (q.tail_id.empty()) {
+        if (hint_new_id.empty()) {
+          q.tail_id = EventId::from_int32(
+                          Random::fast(2 * max(static_cast<int>(MAX_QUEUE_EVENTS), 1000000) + 1, EventId::MAX_ID / 2))
+                          .move_as_ok();
+        } else {
+          q.tail_id = hint_new_id;
+        }
+      }
+      event_id = q.tail_id;
+      CHECK(event_id.is_valid());
+      if (event_id.next().is_ok()) {
+        break;
+      }
+      for (auto it = q.events.begin(); it != q.events.end();) {
+        pop(q, queue_id, it, {});
+      }
+      q.tail_id = EventId();
+      CHECK(hint_new_id.next().is_ok());
+    }
+
+    RawEvent raw_event;
+    raw_event.event_id = event_id;
+    raw_event.data = std::move(data);
+    raw_event.expires_at = expires_at;
+    raw_event.extra = extra;
+    bool is_added = do_push(queue_id, std::move(raw_event));
+    CHECK(is_added);
+    return event_id;
+  }
+
+  EventId get_head(QueueId queue_id) const {
+    auto it = queues_.find(queue_id);
+    if (it == queues_.end()) {
+      return EventId();
+    }
+    return get_queue_head(it->second);
+  }
+
+  EventId get_tail(QueueId queue_id) const {
+    auto it = queues_.find(queue_id);
+    if (it == queues_.end()) {
+      return EventId();
+    }
+    auto &q = it->second;
+    return q.tail_id;
+  }
+
+  void forget(QueueId queue_id, EventId event_id) {
+    auto q_it = queues_.find(queue_id);
+    if (q_it == queues_.end()) {
+      return;
+    }
+    auto &q = q_it->second;
+    auto it = q.events.find(event_id);
+    if (it == q.events.end()) {
+      return;
+    }
+    pop(q, queue_id, it, q.tail_id);
+  }
+
+  std::map<EventId, RawEvent> clear(QueueId queue_id, size_t keep_count) {
+    auto queue_it = queues_.find(queue_id);
+    if (queue_it == queues_.end()) {
+      return {};
+    }
+    auto &q = queue_it->second;
+    auto size = get_size(q);
+    if (size <= keep_count) {
+      return {};
+    }
+
+    auto start_time = Time::now();
+    auto total_event_length = q.total_event_length;
+
+    auto end_it = q.events.end();
+    for (size_t i = 0; i < keep_count; i++) {
+      --end_it;
+    }
+    if (keep_count == 0) {
+      --end_it;
+      auto &event = end_it->second;
+      if (callback_ == nullptr || event.log_event_id == 0) {
+        ++end_it;
+      } else if (!event.data.empty()) {
+        clear_event_data(q, event);
+        callback_->push(queue_id, event);
+      }
+    }
+
+    auto collect_deleted_event_ids_time = 0.0;
+    if (callback_ != nullptr) {
+      vector<uint64> deleted_log_event_ids;
+      deleted_log_event_ids.reserve(size - keep_count);
+      for (auto it = q.events.begin(); it != end_it; ++it) {
+        auto &event = it->second;
+        if (event.log_event_id != 0) {
+          deleted_log_event_ids.push_back(event.log_event_id);
+        }
+      }
+      collect_deleted_event_ids_time = Time::now() - start_time;
+      for (auto log_event_id : deleted_log_event_ids) {
+        callback_->pop(log_event_id);
+      }
+    }
+    auto callback_clear_time = Time::now() - start_time;
+
+    std::map<EventId, RawEvent> deleted_events;
+    if (keep_count > size / 2) {
+      for (auto it = q.events.begin(); it != end_it;) {
+        q.total_event_length -= it->second.data.size();
+        bool is_inserted = deleted_events.emplace(it->first, std::move(it->second)).second;
+        CHECK(is_inserted);
+        it = q.events.erase(it);
+      }
+    } else {
+      q.total_event_length = 0;
+      for (auto it = end_it; it != q.events.end();) {
+        q.total_event_length += it->second.data.size();
+        bool is_inserted = deleted_events.emplace(it->first, std::move(it->second)).second;
+        CHECK(is_inserted);
+        it = q.events.erase(it);
+      }
+      std::swap(deleted_events, q.events);
+    }
+
+    auto clear_time = Time::now() - start_time;
+    if (clear_time > 0.01) {
+      LOG(WARNING) << "Cleared " << (size - keep_count) << " TQueue events with total size "
+                   << (total_event_length - q.total_event_length) << " in " << clear_time - callback_clear_time
+                   << " seconds, collected their identifiers in " << collect_deleted_event_ids_time
+                   << " seconds, and deleted them from callback in "
+                   << callback_clear_time - collect_deleted_event_ids_time << " seconds";
+    }
+    return deleted_events;
+  }
+
+  Result<size_t> get(QueueId queue_id, EventId from_id, bool forget_previous, int32 unix_time_now,
+                     MutableSpan<Event> &result_events) {
+    auto it = queues_.find(queue_id);
+    if (it == queues_.end()) {
+      result_events.truncate(0);
+      return 0;
+    }
+    auto &q = it->second;
+    // Some sanity checks
+    if (from_id.value() > q.tail_id.value() + 10) {
+      return Status::Error("Specified from_id is in the future");
+    }
+    if (from_id.value() < get_queue_head(q).value() - static_cast<int32>(MAX_QUEUE_EVENTS)) {
+      return Status::Error("Specified from_id is in the past");
+    }
+
+    do_get(queue_id, q, from_id, forget_previous, unix_time_now, result_events);
+    return get_size(q);
+  }
+
+  std::pair<int64, bool> run_gc(int32 unix_time_now) {
+    int64 deleted_events = 0;
+    auto max_finish_time = Time::now() + 0.05;
+    int64 counter = 0;
+    while (!queue_gc_at_.empty()) {
+      auto it = queue_gc_at_.begin();
+      if (it->first >= unix_time_now) {
+        break;
+      }
+      auto queue_id = it->second;
+      auto &q = queues_[queue_id];
+      CHECK(q.gc_at == it->first);
+      int32 new_gc_at = 0;
+
+      if (!q.events.empty()) {
+        size_t size_before = get_size(q);
+        for (auto event_it = q.events.begin(); event_it != q.events.end();) {
+          auto &event = event_it->second;
+          if ((++counter & 128) == 0 && Time::now() >= max_finish_time) {
+            if (new_gc_at == 0) {
+              new_gc_at = event.expires_at;
+            }
+            break;
+          }
+          if (event.expires_at < unix_time_now || event.data.empty()) {
+            pop(q, queue_id, event_it, q.tail_id);
+          } else {
+            if (new_gc_at != 0) {
+              break;
+            }
+            new_gc_at = event.expires_at;
+            ++event_it;
+          }
+        }
+        size_t size_after = get_size(q);
+        CHECK(size_after <= size_before);
+        deleted_events += size_before - size_after;
+      }
+      schedule_queue_gc(queue_id, q, new_gc_at);
+      if (Time::now() >= max_finish_time) {
+        return {deleted_events, false};
+      }
+    }
+    return {deleted_events, true};
+  }
+
+  size_t get_size(QueueId queue_id) const {
+    auto it = queues_.find(queue_id);
+    if (it == queues_.end()) {
+      return 0;
+    }
+    return get_size(it->second);
+  }
+
+  void close(Promise<> promise) {
+    if (callback_ != nullptr) {
+      callback_->close(std::move(promise));
+      callback_ = nullptr;
+    }
+  }
+
+ private:
+  struct Queue {
+    EventId tail_id;
+    std::map<EventId, RawEvent> events;
+    size_t total_event_length = 0;
+    int32 gc_at = 0;
+  };
+
+  FlatHashMap<QueueId, Queue> queues_;
+  std::set<std::pair<int32, QueueId>> queue_gc_at_;
+  unique_ptr<StorageCallback> callback_;
+
+  static EventId get_queue_head(const Queue &q) {
+    if (q.events.empty()) {
+      return q.tail_id;
+    }
+    return q.events.begin()->first;
+  }
+
+  static size_t get_size(const Queue &q) {
+    if (q.events.empty()) {
+      return 0;
+    }
+
+    return q.events.size() - (q.events.rbegin()->second.data.empty() ? 1 : 0);
+  }
+
+  void pop(Queue &q, QueueId queue_id, std::map<EventId, RawEvent>::iterator &it, EventId tail_id) {
+    auto &event = it->second;
+    if (callback_ == nullptr || event.log_event_id == 0) {
+      remove_event(q, it);
+      return;
+    }
+
+    if (event.event_id.next().ok() == tail_id) {
+      if (!event.data.empty()) {
+        clear_event_data(q, event);
+        callback_->push(queue_id, event);
+      }
+      ++it;
+    } else {
+      callback_->pop(event.log_event_id);
+      remove_event(q, it);
+    }
+  }
+
+  static void remove_event(Queue &q, std::map<EventId, RawEvent>::iterator &it) {
+    q.total_event_length -= it->second.data.size();
+    it = q.events.erase(it);
+  }
+
+  static void clear_event_data(Queue &q, RawEvent &event) {
+    q.total_event_length -= event.data.size();
+    event.data = {};
+  }
+
+  void do_get(QueueId queue_id, Queue &q, EventId from_id, bool forget_previous, int32 unix_time_now,
+              MutableSpan<Event> &result_events) {
+    if (forget_previous) {
+      for (auto it = q.events.begin(); it != q.events.end() && it->first < from_id;) {
+        pop(q, queue_id, it, q.tail_id);
+      }
+    }
+
+    size_t ready_n = 0;
+    for (auto it = q.events.lower_bound(from_id); it != q.events.end();) {
+      auto &event = it->second;
+      if (event.expires_at < unix_time_now || event.data.empty()) {
+        pop(q, queue_id, it, q.tail_id);
+      } else {
+        CHECK(!(event.event_id < from_id));
+        if (ready_n == result_events.size()) {
+          break;
+        }
+
+        auto &to = result_events[ready_n];
+        to.data = event.data;
+        to.id = event.event_id;
+        to.expires_at = event.expires_at;
+        to.extra = event.extra;
+        ready_n++;
+        ++it;
+      }
+    }
+
+    result_events.truncate(ready_n);
+  }
+
+  void schedule_queue_gc(QueueId queue_id, Queue &q, int32 gc_at) {
+    if (q.gc_at != 0) {
+      bool is_deleted = queue_gc_at_.erase({q.gc_at, queue_id}) > 0;
+      CHECK(is_deleted);
+    }
+    q.gc_at = gc_at;
+    if (q.gc_at != 0) {
+      bool is_inserted = queue_gc_at_.emplace(gc_at, queue_id).second;
+      CHECK(is_inserted);
+    }
+  }
+};
+
+}  // namespace td
+
+// both stores receive a payload copied into storage of their own, like an update received over HTTP
+static td::Result<td::TQueue::EventId> push_event(td::MapTQueue &tqueue, td::int64 queue_id, td::Slice data,
+                                                  td::int32 expires_at) {
+  return tqueue.push(queue_id, data.str(), expires_at, 0, td::TQueue::EventId());
+}
+
+static td::Result<td::TQueue::EventId> push_event(td::TQueue &tqueue, td::int64 queue_id, td::Slice data,
+                                                  td::int32 expires_at) {
+  return tqueue.push(queue_id, td::BufferSlice(data), expires_at, 0, td::TQueue::EventId());
+}
+
+// 1000000 events in 10000 queues; each iteration adds an event to a queue and
+// acknowledges the oldest event either by forget or by get with forget_previous
+template <class TQueueT>
+class TQueueBench final : public td::Benchmark {
+  static constexpr int QUEUE_COUNT = 10000;
+  static constexpr int EVENT_COUNT = 1000000;
+  static constexpr td::int32 EXPIRES_AT = 1000000000;
+
+  td::string description_;
+  td::unique_ptr<TQueueT> tqueue_;
+  td::string data_;
+  typename TQueueT::Event events_[10];
+
+ public:
+  explicit TQueueBench(td::string description) : description_(std::move(description)) {
+  }
+
+  td::string get_description() const final {
+    return description_;
+  }
+
+  void start_up() final {
+    tqueue_ = TQueueT::create();
+    data_ = td::string(200, 'a');
+    for (int i = 0; i < EVENT_COUNT; i++) {
+      push_event(*tqueue_, i % QUEUE_COUNT + 1, data_, EXPIRES_AT).ensure();
+    }
+  }
+
+  void run(int n) final {
+    td::uint64 result = 0;
+    for (int i = 0; i < n; i++) {
+      auto queue_id = td::Random::fast(1, QUEUE_COUNT);
+      push_event(*tqueue_, queue_id, data_, EXPIRES_AT).ensure();
+      auto head_id = tqueue_->get_head(queue_id);
+      td::MutableSpan<typename TQueueT::Event> events(events_, 10);
+      if (i % 2 == 0) {
+        result += tqueue_->get(queue_id, head_id, false, 0, events).move_as_ok();
+        tqueue_->forget(queue_id, head_id);
+      } else {
+        result += tqueue_->get(queue_id, head_id.next().move_as_ok(), true, 0, events).move_as_ok();
+      }
+      result += events.size();
+    }
+    td::do_not_optimize_away(result);
+  }
+
+  void tear_down() final {
+    tqueue_ = nullptr;
+  }
+};
+
+// returns the number of bytes allocated from the heap and not freed yet, or 0 if it is unknown; unlike resident
+// memory size, it doesn't depend on reuse of memory freed by a previous measurement
+static td::uint64 get_heap_size() {
+#if TD_BENCH_HAVE_MALLINFO2
+  auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// pushes events of 100-400 bytes and forgets all of them except every 32nd one, so most events expire soon
+// and the rest live long; returns memory used by the surviving events
+template <class TQueueT>
+static td::string measure_tqueue_memory(td::Slice description) {
+  static constexpr int QUEUE_COUNT = 1000;
+  static constexpr int EVENT_COUNT = 320000;
+  static constexpr td::int32 EXPIRES_AT = 1000000000;
+
+  auto begin_heap_size = get_heap_size();
+  auto begin_buffer_mem = td::BufferAllocator::get_buffer_mem();
+
+  auto tqueue = TQueueT::create();
+  td::string data(400, 'a');
+  td::uint64 data_size = 0;
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    auto queue_id = i % QUEUE_COUNT + 1;
+    auto size = td::Random::fast(100, 400);
+    auto event_id = push_event(*tqueue, queue_id, td::Slice(data).substr(0, size), EXPIRES_AT).move_as_ok();
+    if (i % 32 != 0) {
+      tqueue->forget(queue_id, event_id);
+    } else {
+      data_size += size;
+    }
+  }
+
+  auto buffer_mem = td::BufferAllocator::get_buffer_mem() - begin_buffer_mem;
+  auto heap_size = get_heap_size() - begin_heap_size;
+  tqueue = nullptr;
+  return PSTRING() << description << " with " << EVENT_COUNT / 32 << " surviving events of " << EVENT_COUNT
+                   << " and " << (data_size >> 10) << " KB of payload: heap memory " << (heap_size >> 10)
+                   << " KB, including buffer memory " << (buffer_mem >> 10) << " KB";
+}
+
+int main() {
+  SET_VERBOSITY_LEVEL(VERBOSITY_NAME(WARNING));
+  LOG(WARNING) << measure_tqueue_memory<td::TQueue>("TQueue with contiguous event store");
+  LOG(WARNING) << measure_tqueue_memory<td::MapTQueue>("TQueue with std::map event store");
+  td::bench(TQueueBench<td::MapTQueue>("TQueue with std::map event store"));
+  td::bench(TQueueBench<td::TQueue>("TQueue with contiguous event store"));
+}
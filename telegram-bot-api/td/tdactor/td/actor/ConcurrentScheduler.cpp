@@ -6,6 +6,7 @@
 //
 #include "td/actor/ConcurrentScheduler.h"
 
+#include "td/utils/algorithm.h"
 #include "td/utils/ExitGuard.h"
 #include "td/utils/MpscPollableQueue.h"
 #include "td/utils/port/thread_local.h"
@@ -62,6 +63,10 @@ ConcurrentScheduler::ConcurrentScheduler(int32 additional_thread_count, uint64 t
   state_ = State::Start;
 }
 
+vector<size_t> ConcurrentScheduler::get_scheduler_queue_sizes() const {
+  return transform(schedulers_, [](const auto &sched) { return sched->get_inbound_queue_size(); });
+}
+
 void ConcurrentScheduler::test_one_thread_run() {
   do {
     for (auto &sched : schedulers_) {
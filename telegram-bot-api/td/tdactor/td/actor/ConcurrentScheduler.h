@@ -58,6 +58,9 @@ class ConcurrentScheduler final : private Scheduler::Callback {
   thread::id get_scheduler_thread_id(int32 sched_id);
 #endif
 
+  // returns sizes of inbound queues of all schedulers; can be called from any thread after the schedulers are created
+  vector<size_t> get_scheduler_queue_sizes() const;
+
   void start();
 
   bool run_main(double timeout) {
@@ -85,6 +85,9 @@ class Scheduler {
   int32 sched_id() const;
   int32 sched_count() const;
 
+  // returns the number of events sent from other schedulers and not received yet; can be called from any thread
+  size_t get_inbound_queue_size() const;
+
   template <class ActorT, class... Args>
   TD_WARN_UNUSED_RESULT ActorOwn<ActorT> create_actor(Slice name, Args &&...args);
   template <class ActorT, class... Args>
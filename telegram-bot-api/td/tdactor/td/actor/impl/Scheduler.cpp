@@ -231,6 +231,13 @@ void Scheduler::init(int32 id, std::vector<std::shared_ptr<MpscPollableQueue<Eve
   register_actor("ServiceActor", &service_actor_).release();
 }
 
+size_t Scheduler::get_inbound_queue_size() const {
+  if (inbound_queue_ == nullptr) {
+    return 0;
+  }
+  return inbound_queue_->get_unread_count();
+}
+
 void Scheduler::clear() {
   if (service_actor_.empty()) {
     return;
@@ -11,6 +11,7 @@
 #include "td/db/binlog/BinlogHelper.h"
 #include "td/db/binlog/BinlogInterface.h"
 
+#include "td/utils/buffer.h"
 #include "td/utils/FlatHashMap.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
@@ -20,7 +21,9 @@
 #include "td/utils/tl_helpers.h"
 #include "td/utils/tl_parsers.h"
 #include "td/utils/tl_storers.h"
+#include "td/utils/VectorQueue.h"
 
+#include <algorithm>
 #include <set>
 
 namespace td {
@@ -82,10 +85,21 @@ bool EventId::is_valid_id(int32 id) {
   return 0 <= id && id < MAX_ID;
 }
 
+TQueue::RawEvent TQueue::RawEvent::clone() const {
+  RawEvent result;
+  result.log_event_id = log_event_id;
+  result.event_id = event_id;
+  result.expires_at = expires_at;
+  result.data = data.clone();
+  result.extra = extra;
+  return result;
+}
+
 class TQueueImpl final : public TQueue {
   static constexpr size_t MAX_EVENT_LENGTH = 65536 * 8;
   static constexpr size_t MAX_QUEUE_EVENTS = 100000;
   static constexpr size_t MAX_TOTAL_EVENT_LENGTH = 1 << 27;
+  static constexpr size_t MAX_UNUSED_EVENT_BUFFER_SIZE = 64;
 
  public:
   void set_callback(unique_ptr<StorageCallback> callback) final {
@@ -102,7 +116,7 @@ class TQueueImpl final : public TQueue {
       return false;
     }
     auto &q = queues_[queue_id];
-    if (q.events.size() >= MAX_QUEUE_EVENTS || q.total_event_length > MAX_TOTAL_EVENT_LENGTH - raw_event.data.size() ||
+    if (q.event_count >= MAX_QUEUE_EVENTS || q.total_event_length > MAX_TOTAL_EVENT_LENGTH - raw_event.data.size() ||
         raw_event.expires_at <= 0) {
       return false;
     }
@@ -112,13 +126,13 @@ class TQueueImpl final : public TQueue {
     }
 
     if (!q.events.empty()) {
-      auto it = q.events.end();
-      --it;
-      if (it->second.data.empty()) {
-        if (callback_ != nullptr && it->second.log_event_id != 0) {
-          callback_->pop(it->second.log_event_id);
+      auto &last_event = q.events.back();
+      if (last_event.data.empty()) {
+        if (callback_ != nullptr && last_event.log_event_id != 0) {
+          callback_->pop(last_event.log_event_id);
         }
-        q.events.erase(it);
+        remove_event(q, last_event);
+        compact_events(q);
       }
     }
     if (q.events.empty() && !raw_event.data.empty()) {
@@ -130,11 +144,32 @@ class TQueueImpl final : public TQueue {
     }
     q.tail_id = event_id.next().move_as_ok();
     q.total_event_length += raw_event.data.size();
-    q.events.emplace(event_id, std::move(raw_event));
+    q.event_count++;
+
+    QueueEvent event;
+    event.event_id = event_id;
+    event.expires_at = raw_event.expires_at;
+    event.extra = raw_event.extra;
+    event.log_event_id = raw_event.log_event_id;
+    event.data = std::move(raw_event.data);
+    // events live for very different time, so they must not share buffers with other data
+    event.data.shrink_to_fit(MAX_UNUSED_EVENT_BUFFER_SIZE);
+    q.events.push(std::move(event));
     return true;
   }
 
-  Result<EventId> push(QueueId queue_id, string data, int32 expires_at, int64 extra, EventId hint_new_id) final {
+  void merge(unique_ptr<TQueue> other) final {
+    auto &other_impl = static_cast<TQueueImpl &>(*other);
+    CHECK(other_impl.callback_ == nullptr);
+    for (auto &it : other_impl.queues_) {
+      auto &q = queues_[it.first];
+      CHECK(q.tail_id.empty());
+      q = std::move(it.second);
+    }
+    queue_gc_at_.insert(other_impl.queue_gc_at_.begin(), other_impl.queue_gc_at_.end());
+  }
+
+  Result<EventId> push(QueueId queue_id, BufferSlice data, int32 expires_at, int64 extra, EventId hint_new_id) final {
     if (data.empty()) {
       return Status::Error("Data is empty");
     }
@@ -146,7 +181,7 @@ class TQueueImpl final : public TQueue {
     }
 
     auto &q = queues_[queue_id];
-    if (q.events.size() >= MAX_QUEUE_EVENTS) {
+    if (q.event_count >= MAX_QUEUE_EVENTS) {
       return Status::Error("Queue is full");
     }
     if (q.total_event_length > MAX_TOTAL_EVENT_LENGTH - data.size()) {
@@ -171,9 +206,12 @@ class TQueueImpl final : public TQueue {
       if (event_id.next().is_ok()) {
         break;
       }
-      for (auto it = q.events.begin(); it != q.events.end();) {
-        pop(q, queue_id, it, {});
+      for (auto &event : q.events.as_mutable_span()) {
+        if (!event.is_removed) {
+          pop(q, queue_id, event, {});
+        }
       }
+      compact_events(q);
       q.tail_id = EventId();
       CHECK(hint_new_id.next().is_ok());
     }
@@ -211,11 +249,16 @@ class TQueueImpl final : public TQueue {
       return;
     }
     auto &q = q_it->second;
-    auto it = q.events.find(event_id);
-    if (it == q.events.end()) {
+    auto pos = find_event(q, event_id);
+    if (pos == q.events.size()) {
       return;
     }
-    pop(q, queue_id, it, q.tail_id);
+    auto &event = q.events.as_mutable_span()[pos];
+    if (event.event_id != event_id || event.is_removed) {
+      return;
+    }
+    pop(q, queue_id, event, q.tail_id);
+    compact_events(q);
   }
 
   std::map<EventId, RawEvent> clear(QueueId queue_id, size_t keep_count) final {
@@ -232,18 +275,22 @@ class TQueueImpl final : public TQueue {
     auto start_time = Time::now();
     auto total_event_length = q.total_event_length;
 
-    auto end_it = q.events.end();
+    auto events = q.events.as_mutable_span();
+    size_t end_pos = events.size();
     for (size_t i = 0; i < keep_count; i++) {
-      --end_it;
+      do {
+        --end_pos;
+      } while (events[end_pos].is_removed);
     }
     if (keep_count == 0) {
-      --end_it;
-      auto &event = end_it->second;
+      --end_pos;
+      auto &event = events[end_pos];
+      CHECK(!event.is_removed);
       if (callback_ == nullptr || event.log_event_id == 0) {
-        ++end_it;
+        ++end_pos;
       } else if (!event.data.empty()) {
         clear_event_data(q, event);
-        callback_->push(queue_id, event);
+        callback_->push(queue_id, get_raw_event(event));
       }
     }
 
@@ -251,9 +298,9 @@ class TQueueImpl final : public TQueue {
     if (callback_ != nullptr) {
       vector<uint64> deleted_log_event_ids;
       deleted_log_event_ids.reserve(size - keep_count);
-      for (auto it = q.events.begin(); it != end_it; ++it) {
-        auto &event = it->second;
-        if (event.log_event_id != 0) {
+      for (size_t i = 0; i < end_pos; i++) {
+        auto &event = events[i];
+        if (!event.is_removed && event.log_event_id != 0) {
           deleted_log_event_ids.push_back(event.log_event_id);
         }
       }
@@ -265,23 +312,16 @@ class TQueueImpl final : public TQueue {
     auto callback_clear_time = Time::now() - start_time;
 
     std::map<EventId, RawEvent> deleted_events;
-    if (keep_count > size / 2) {
-      for (auto it = q.events.begin(); it != end_it;) {
-        q.total_event_length -= it->second.data.size();
-        bool is_inserted = deleted_events.emplace(it->first, std::move(it->second)).second;
-        CHECK(is_inserted);
-        it = q.events.erase(it);
+    for (size_t i = 0; i < end_pos; i++) {
+      auto &event = events[i];
+      if (event.is_removed) {
+        continue;
       }
-    } else {
-      q.total_event_length = 0;
-      for (auto it = end_it; it != q.events.end();) {
-        q.total_event_length += it->second.data.size();
-        bool is_inserted = deleted_events.emplace(it->first, std::move(it->second)).second;
-        CHECK(is_inserted);
-        it = q.events.erase(it);
-      }
-      std::swap(deleted_events, q.events);
+      bool is_inserted = deleted_events.emplace(event.event_id, get_raw_event(event)).second;
+      CHECK(is_inserted);
+      remove_event(q, event);
     }
+    compact_events(q);
 
     auto clear_time = Time::now() - start_time;
     if (clear_time > 0.01) {
@@ -330,8 +370,10 @@ class TQueueImpl final : public TQueue {
 
       if (!q.events.empty()) {
         size_t size_before = get_size(q);
-        for (auto event_it = q.events.begin(); event_it != q.events.end();) {
-          auto &event = event_it->second;
+        for (auto &event : q.events.as_mutable_span()) {
+          if (event.is_removed) {
+            continue;
+          }
           if ((++counter & 128) == 0 && Time::now() >= max_finish_time) {
             if (new_gc_at == 0) {
               new_gc_at = event.expires_at;
@@ -339,15 +381,15 @@ class TQueueImpl final : public TQueue {
             break;
           }
           if (event.expires_at < unix_time_now || event.data.empty()) {
-            pop(q, queue_id, event_it, q.tail_id);
+            pop(q, queue_id, event, q.tail_id);
           } else {
             if (new_gc_at != 0) {
               break;
             }
             new_gc_at = event.expires_at;
-            ++event_it;
           }
         }
+        compact_events(q);
         size_t size_after = get_size(q);
         CHECK(size_after <= size_before);
         deleted_events += size_before - size_after;
@@ -376,9 +418,20 @@ class TQueueImpl final : public TQueue {
   }
 
  private:
+  struct QueueEvent {
+    EventId event_id;
+    int32 expires_at = 0;
+    bool is_removed = false;
+    int64 extra = 0;
+    uint64 log_event_id = 0;
+    BufferSlice data;
+  };
+
   struct Queue {
     EventId tail_id;
-    std::map<EventId, RawEvent> events;
+    // contiguous event store sorted by event_id; removed events are kept only between the ends of the store
+    VectorQueue<QueueEvent> events;
+    size_t event_count = 0;
     size_t total_event_length = 0;
     int32 gc_at = 0;
   };
@@ -391,7 +444,7 @@ class TQueueImpl final : public TQueue {
     if (q.events.empty()) {
       return q.tail_id;
     }
-    return q.events.begin()->first;
+    return q.events.front().event_id;
   }
 
   static size_t get_size(const Queue &q) {
@@ -399,51 +452,116 @@ class TQueueImpl final : public TQueue {
       return 0;
     }
 
-    return q.events.size() - (q.events.rbegin()->second.data.empty() ? 1 : 0);
+    return q.event_count - (q.events.back().data.empty() ? 1 : 0);
+  }
+
+  static RawEvent get_raw_event(const QueueEvent &event) {
+    RawEvent raw_event;
+    raw_event.log_event_id = event.log_event_id;
+    raw_event.event_id = event.event_id;
+    raw_event.expires_at = event.expires_at;
+    raw_event.data = event.data.clone();
+    raw_event.extra = event.extra;
+    return raw_event;
+  }
+
+  // returns position of the first event with identifier not less than event_id
+  static size_t find_event(const Queue &q, EventId event_id) {
+    auto events = q.events.as_span();
+    if (events.empty() || !(events[0].event_id < event_id)) {
+      return 0;
+    }
+
+    // event identifiers are strictly increasing, so the event can't be further than at the offset
+    auto offset = static_cast<size_t>(event_id.value() - events[0].event_id.value());
+    if (offset < events.size() && events[offset].event_id == event_id) {
+      return offset;
+    }
+    auto end = events.begin() + min(offset, events.size());
+    return static_cast<size_t>(std::lower_bound(events.begin(), end, event_id,
+                                                [](const QueueEvent &event, EventId event_id) {
+                                                  return event.event_id < event_id;
+                                                }) -
+                               events.begin());
   }
 
-  void pop(Queue &q, QueueId queue_id, std::map<EventId, RawEvent>::iterator &it, EventId tail_id) {
-    auto &event = it->second;
+  void pop(Queue &q, QueueId queue_id, QueueEvent &event, EventId tail_id) {
     if (callback_ == nullptr || event.log_event_id == 0) {
-      remove_event(q, it);
+      remove_event(q, event);
       return;
     }
 
     if (event.event_id.next().ok() == tail_id) {
       if (!event.data.empty()) {
         clear_event_data(q, event);
-        callback_->push(queue_id, event);
+        callback_->push(queue_id, get_raw_event(event));
       }
-      ++it;
     } else {
       callback_->pop(event.log_event_id);
-      remove_event(q, it);
+      remove_event(q, event);
     }
   }
 
-  static void remove_event(Queue &q, std::map<EventId, RawEvent>::iterator &it) {
-    q.total_event_length -= it->second.data.size();
-    it = q.events.erase(it);
+  // the event is only marked as removed; compact_events must be called after the current operation
+  static void remove_event(Queue &q, QueueEvent &event) {
+    CHECK(!event.is_removed);
+    clear_event_data(q, event);
+    event.is_removed = true;
+    q.event_count--;
   }
 
-  static void clear_event_data(Queue &q, RawEvent &event) {
+  static void clear_event_data(Queue &q, QueueEvent &event) {
     q.total_event_length -= event.data.size();
     event.data = {};
   }
 
+  static void compact_events(Queue &q) {
+    auto events = q.events.as_span();
+    size_t removed_prefix = 0;
+    while (removed_prefix < events.size() && events[removed_prefix].is_removed) {
+      removed_prefix++;
+    }
+    q.events.pop_n(removed_prefix);
+    while (!q.events.empty() && q.events.back().is_removed) {
+      q.events.pop_back();
+    }
+
+    // keep the event store dense to make event lookup by identifier offset successful
+    if (q.events.size() > 2 * q.event_count + 16) {
+      VectorQueue<QueueEvent> new_events;
+      for (auto &event : q.events.as_mutable_span()) {
+        if (!event.is_removed) {
+          new_events.push(std::move(event));
+        }
+      }
+      q.events = std::move(new_events);
+    }
+    // release memory left after removal of most events, including all of them
+    if (q.events.capacity() > 4 * q.events.size() + 16) {
+      q.events.shrink_to_fit();
+    }
+    CHECK(q.events.size() >= q.event_count);
+  }
+
   void do_get(QueueId queue_id, Queue &q, EventId from_id, bool forget_previous, int32 unix_time_now,
               MutableSpan<Event> &result_events) {
+    auto events = q.events.as_mutable_span();
     if (forget_previous) {
-      for (auto it = q.events.begin(); it != q.events.end() && it->first < from_id;) {
-        pop(q, queue_id, it, q.tail_id);
+      for (size_t i = 0; i < events.size() && events[i].event_id < from_id; i++) {
+        if (!events[i].is_removed) {
+          pop(q, queue_id, events[i], q.tail_id);
+        }
       }
     }
 
     size_t ready_n = 0;
-    for (auto it = q.events.lower_bound(from_id); it != q.events.end();) {
-      auto &event = it->second;
+    for (size_t i = find_event(q, from_id); i < events.size(); i++) {
+      auto &event = events[i];
+      if (event.is_removed) {
+        continue;
+      }
       if (event.expires_at < unix_time_now || event.data.empty()) {
-        pop(q, queue_id, it, q.tail_id);
+        pop(q, queue_id, event, q.tail_id);
       } else {
         CHECK(!(event.event_id < from_id));
         if (ready_n == result_events.size()) {
@@ -451,14 +569,14 @@ class TQueueImpl final : public TQueue {
         }
 
         auto &to = result_events[ready_n];
-        to.data = event.data;
+        to.data = event.data.clone();
         to.id = event.event_id;
         to.expires_at = event.expires_at;
         to.extra = event.extra;
         ready_n++;
-        ++it;
       }
     }
+    compact_events(q);
 
     result_events.truncate(ready_n);
   }
@@ -532,7 +650,7 @@ uint64 TQueueBinlog<BinlogT>::push(QueueId queue_id, const RawEvent &event) {
   log_event.queue_id = queue_id;
   log_event.event_id = event.event_id.value();
   log_event.expires_at = event.expires_at;
-  log_event.data = event.data;
+  log_event.data = event.data.as_slice();
   log_event.extra = event.extra;
   auto magic = BINLOG_EVENT_TYPE + (log_event.extra != 0);
   if (event.log_event_id == 0) {
@@ -563,7 +681,7 @@ Status TQueueBinlog<BinlogT>::replay(const BinlogEvent &binlog_event, TQueue &q)
   raw_event.log_event_id = binlog_event.id_;
   raw_event.event_id = event_id;
   raw_event.expires_at = event.expires_at;
-  raw_event.data = event.data.str();
+  raw_event.data = BufferSlice(event.data);
   raw_event.extra = event.extra;
   if (!q.do_push(event.queue_id, std::move(raw_event))) {
     return Status::Error("Failed to add event");
@@ -571,6 +689,18 @@ Status TQueueBinlog<BinlogT>::replay(const BinlogEvent &binlog_event, TQueue &q)
   return Status::OK();
 }
 
+template <class BinlogT>
+Result<TQueue::QueueId> TQueueBinlog<BinlogT>::get_queue_id(const BinlogEvent &binlog_event) {
+  int32 has_extra = binlog_event.type_ - BINLOG_EVENT_TYPE;
+  if (has_extra != 0 && has_extra != 1) {
+    return Status::Error("Wrong magic");
+  }
+  TlParser parser(binlog_event.get_data());
+  auto queue_id = parser.fetch_long();
+  TRY_STATUS(parser.get_status());
+  return queue_id;
+}
+
 template <class BinlogT>
 void TQueueBinlog<BinlogT>::close(Promise<> promise) {
   binlog_->close(std::move(promise));
@@ -581,7 +711,7 @@ template class TQueueBinlog<Binlog>;
 
 uint64 TQueueMemoryStorage::push(QueueId queue_id, const RawEvent &event) {
   auto log_event_id = event.log_event_id == 0 ? next_log_event_id_++ : event.log_event_id;
-  events_[log_event_id] = std::make_pair(queue_id, event);
+  events_[log_event_id] = std::make_pair(queue_id, event.clone());
   return log_event_id;
 }
 
@@ -591,9 +721,9 @@ void TQueueMemoryStorage::pop(uint64 log_event_id) {
 
 void TQueueMemoryStorage::replay(TQueue &q) const {
   for (auto &e : events_) {
-    auto x = e.second;
-    x.second.log_event_id = e.first;
-    bool is_added = q.do_push(x.first, std::move(x.second));
+    auto raw_event = e.second.second.clone();
+    raw_event.log_event_id = e.first;
+    bool is_added = q.do_push(e.second.first, std::move(raw_event));
     CHECK(is_added);
   }
 }
@@ -6,6 +6,7 @@
 //
 #pragma once
 
+#include "td/utils/buffer.h"
 #include "td/utils/common.h"
 #include "td/utils/Promise.h"
 #include "td/utils/Slice.h"
@@ -51,10 +52,11 @@ class TQueue {
     static bool is_valid_id(int32 id);
   };
 
+  // data shares the buffer with the stored event
   struct Event {
     EventId id;
     int32 expires_at{0};
-    Slice data;
+    BufferSlice data;
     int64 extra{0};
   };
 
@@ -62,8 +64,10 @@ class TQueue {
     uint64 log_event_id{0};
     EventId event_id;
     int32 expires_at{0};
-    string data;
+    BufferSlice data;
     int64 extra{0};
+
+    RawEvent clone() const;
   };
 
   using QueueId = int64;
@@ -100,7 +104,11 @@ class TQueue {
 
   virtual bool do_push(QueueId queue_id, RawEvent &&raw_event) = 0;
 
-  virtual Result<EventId> push(QueueId queue_id, string data, int32 expires_at, int64 extra, EventId hint_new_id) = 0;
+  // moves all queues from other TQueue without a callback, which must not contain queues from this TQueue
+  virtual void merge(unique_ptr<TQueue> other) = 0;
+
+  virtual Result<EventId> push(QueueId queue_id, BufferSlice data, int32 expires_at, int64 extra,
+                               EventId hint_new_id) = 0;
 
   virtual void forget(QueueId queue_id, EventId event_id) = 0;
 
@@ -130,6 +138,8 @@ class TQueueBinlog final : public TQueue::StorageCallback {
   void pop(uint64 log_event_id) final;
   Status replay(const BinlogEvent &binlog_event, TQueue &q) const TD_WARN_UNUSED_RESULT;
 
+  static Result<QueueId> get_queue_id(const BinlogEvent &binlog_event);
+
   void set_binlog(std::shared_ptr<BinlogT> binlog) {
     binlog_ = std::move(binlog);
   }
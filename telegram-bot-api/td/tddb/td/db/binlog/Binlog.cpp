@@ -309,6 +309,26 @@ void Binlog::change_key(DbKey new_db_key) {
   do_reindex();
 }
 
+void Binlog::force_reindex() {
+  do_reindex();
+}
+
+void Binlog::reindex_if_needed(int64 min_size, int64 max_overhead_percent) {
+  if (state_ != State::Run) {
+    return;
+  }
+  auto fd_size = fd_size_;
+  if (events_buffer_) {
+    fd_size += events_buffer_->size();
+  }
+  auto total_events_size = processor_->total_raw_events_size();
+  if (fd_size > min_size && (fd_size - total_events_size) * 100 > total_events_size * max_overhead_percent) {
+    LOG(INFO) << tag("fd_size", format::as_size(fd_size))
+              << tag("total events size", format::as_size(total_events_size));
+    do_reindex();
+  }
+}
+
 Status Binlog::close_and_destroy() {
   auto path = path_;
   auto close_status = close(false);
@@ -412,6 +432,10 @@ void Binlog::do_event(BinlogEvent &&event) {
 
 void Binlog::sync() {
   flush();
+  sync_file();
+}
+
+void Binlog::sync_file() {
   if (need_sync_) {
     auto status = fd_.sync();
     LOG_IF(FATAL, status.is_error()) << "Failed to sync binlog: " << status;
@@ -99,6 +99,8 @@ class Binlog {
 
   void add_event(BinlogEvent &&event);
   void sync();
+  // syncs already flushed events; can be called from another thread while the binlog isn't used otherwise
+  void sync_file();
   void flush();
   void lazy_flush();
   double need_flush_since() const {
@@ -106,6 +108,13 @@ class Binlog {
   }
   void change_key(DbKey new_db_key);
 
+  // rewrites the binlog, keeping only alive events
+  void force_reindex();
+
+  // rewrites the binlog, keeping only alive events, if its size exceeds min_size and exceeds size of the alive events
+  // by more than max_overhead_percent percent
+  void reindex_if_needed(int64 min_size, int64 max_overhead_percent);
+
   Status close(bool need_sync = true) TD_WARN_UNUSED_RESULT;
   void close(Promise<> promise);
   Status close_and_destroy() TD_WARN_UNUSED_RESULT;
@@ -6,34 +6,236 @@
 //
 #include "td/db/binlog/ConcurrentBinlog.h"
 
+#include "td/utils/algorithm.h"
 #include "td/utils/logging.h"
 #include "td/utils/OrderedEventsProcessor.h"
+#include "td/utils/port/thread.h"
+#include "td/utils/port/thread_local.h"
 #include "td/utils/SliceBuilder.h"
 #include "td/utils/Time.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <mutex>
 
 namespace td {
 namespace detail {
+
+static std::atomic<uint64> sync_batch_size_counts[ConcurrentBinlog::SYNC_STATISTICS_BUCKET_COUNT];
+static std::atomic<uint64> sync_latency_counts[ConcurrentBinlog::SYNC_STATISTICS_BUCKET_COUNT];
+static std::atomic<uint64> sync_batch_size_sum;
+static std::atomic<uint64> sync_latency_sum;
+
+static void add_sync_statistics(std::atomic<uint64> *counts, std::atomic<uint64> &sum, uint64 value) {
+  sum.fetch_add(value, std::memory_order_relaxed);
+  size_t bucket = 0;
+  while (value > 1 && bucket + 1 < ConcurrentBinlog::SYNC_STATISTICS_BUCKET_COUNT) {
+    value >>= 1;
+    bucket++;
+  }
+  counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// process-wide threads, which call the same function for different arguments together with the calling thread;
+// the threads are started on demand, but there are at most MAX_THREAD_COUNT of them for all schedulers
+class BinlogSyncThreads {
+ public:
+  static BinlogSyncThreads &get() {
+    static BinlogSyncThreads threads;
+    return threads;
+  }
+
+  BinlogSyncThreads(const BinlogSyncThreads &) = delete;
+  BinlogSyncThreads &operator=(const BinlogSyncThreads &) = delete;
+  BinlogSyncThreads(BinlogSyncThreads &&) = delete;
+  BinlogSyncThreads &operator=(BinlogSyncThreads &&) = delete;
+  ~BinlogSyncThreads() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_stopped_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // calls func(i) for all i from 0 to size - 1 and waits for all the calls to finish;
+  // can be called from different threads simultaneously
+  void run(size_t size, std::function<void(size_t)> func) {
+    Task task;
+    task.func = std::move(func);
+    task.size = size;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push_back(&task);
+    while (threads_.size() < MAX_THREAD_COUNT && threads_.size() + 1 < size) {
+      threads_.emplace_back([this] { run_worker(); });
+    }
+    task_cv_.notify_all();
+
+    while (task.next_index < task.size) {
+      run_next_call(task, lock);
+    }
+    done_cv_.wait(lock, [&] { return task.finished_count == task.size; });
+  }
+
+ private:
+  static constexpr size_t MAX_THREAD_COUNT = 7;
+
+  struct Task {
+    std::function<void(size_t)> func;
+    size_t size = 0;
+    size_t next_index = 0;
+    size_t finished_count = 0;
+  };
+
+  vector<td::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable task_cv_;
+  std::condition_variable done_cv_;
+  vector<Task *> tasks_;  // tasks with calls, which haven't been started yet
+  bool is_stopped_ = false;
+
+  BinlogSyncThreads() = default;
+
+  // must be called with the locked mutex_
+  void run_next_call(Task &task, std::unique_lock<std::mutex> &lock) {
+    auto index = task.next_index++;
+    if (task.next_index == task.size) {
+      td::remove(tasks_, &task);
+    }
+    lock.unlock();
+    task.func(index);
+    lock.lock();
+    if (++task.finished_count == task.size) {
+      done_cv_.notify_all();
+    }
+  }
+
+  void run_worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      task_cv_.wait(lock, [&] { return is_stopped_ || !tasks_.empty(); });
+      if (is_stopped_) {
+        return;
+      }
+      run_next_call(*tasks_[0], lock);
+    }
+  }
+};
+
+class BinlogActor;
+
+// binlogs of all BinlogActors of a scheduler, which need to be synced in the same scheduler loop iteration;
+// the first added actor runs the batch, syncing all the files in parallel
+class BinlogSyncBatch {
+ public:
+  static BinlogSyncBatch &get() {
+    static TD_THREAD_LOCAL BinlogSyncBatch *batch;
+    init_thread_local<BinlogSyncBatch>(batch);
+    return *batch;
+  }
+
+  // returns true, if the actor must run the batch
+  bool add(ActorId<BinlogActor> actor_id, Binlog *binlog) {
+    binlogs_.emplace_back(std::move(actor_id), binlog);
+    return binlogs_.size() == 1;
+  }
+
+  // returns the actor, which must run the batch instead of the removed one, if any
+  ActorId<BinlogActor> remove(Binlog *binlog) {
+    if (binlogs_.empty()) {
+      return ActorId<BinlogActor>();
+    }
+    bool was_first = binlogs_[0].second == binlog;
+    td::remove_if(binlogs_, [binlog](const std::pair<ActorId<BinlogActor>, Binlog *> &it) {
+      return it.second == binlog;
+    });
+    if (!was_first || binlogs_.empty()) {
+      return ActorId<BinlogActor>();
+    }
+    return binlogs_[0].first;
+  }
+
+  vector<ActorId<BinlogActor>> sync() {
+    auto binlogs = std::move(binlogs_);
+    binlogs_.clear();
+    if (binlogs.empty()) {
+      return {};
+    }
+
+    auto start_time = Time::now();
+    if (binlogs.size() == 1) {
+      binlogs[0].second->sync_file();
+    } else {
+      BinlogSyncThreads::get().run(binlogs.size(), [&binlogs](size_t i) { binlogs[i].second->sync_file(); });
+    }
+    auto latency = static_cast<uint64>((Time::now() - start_time) * 1e6);
+    add_sync_statistics(sync_batch_size_counts, sync_batch_size_sum, binlogs.size());
+    add_sync_statistics(sync_latency_counts, sync_latency_sum, latency);
+
+    vector<ActorId<BinlogActor>> actor_ids;
+    actor_ids.reserve(binlogs.size());
+    for (auto &it : binlogs) {
+      actor_ids.push_back(std::move(it.first));
+    }
+    return actor_ids;
+  }
+
+ private:
+  vector<std::pair<ActorId<BinlogActor>, Binlog *>> binlogs_;
+};
+
 class BinlogActor final : public Actor {
  public:
   BinlogActor(unique_ptr<Binlog> binlog, uint64 seq_no) : binlog_(std::move(binlog)), processor_(seq_no) {
   }
+  ~BinlogActor() final {
+    cancel_pending_sync();
+  }
+
   void close(Promise<> promise) {
+    cancel_pending_sync();
     binlog_->close().ensure();
     LOG(INFO) << "Finished to close binlog";
+    set_promises(pending_sync_promises_);
     stop();
 
     promise.set_value(Unit());  // setting promise can complete closing and destroy the current actor context
   }
   void close_and_destroy(Promise<> promise) {
+    cancel_pending_sync();
     binlog_->close_and_destroy().ensure();
     LOG(INFO) << "Finished to destroy binlog";
+    fail_promises(pending_sync_promises_, Status::Error("Binlog was destroyed"));
     stop();
 
     promise.set_value(Unit());  // setting promise can complete closing and destroy the current actor context
   }
 
+  void sync_batch() {
+    auto actor_ids = BinlogSyncBatch::get().sync();
+    for (auto &actor_id : actor_ids) {
+      send_closure(actor_id, &BinlogActor::on_synced);
+    }
+  }
+
+  void on_synced() {
+    if (!is_sync_pending_) {
+      return;
+    }
+    is_sync_pending_ = false;
+    set_promises(pending_sync_promises_);
+    if (need_sync_again_) {
+      need_sync_again_ = false;
+      force_sync_flag_ = true;
+      wakeup_after(0);
+    }
+  }
+
   struct Event {
     BufferSlice raw_event;
     Promise<> sync_promise;
@@ -70,6 +272,14 @@ class BinlogActor final : public Actor {
     promise.set_value(Unit());
   }
 
+  void force_reindex() {
+    binlog_->force_reindex();
+  }
+
+  void reindex_if_needed(int64 min_size, int64 max_overhead_percent) {
+    binlog_->reindex_if_needed(min_size, max_overhead_percent);
+  }
+
  private:
   unique_ptr<Binlog> binlog_;
 
@@ -77,6 +287,9 @@ class BinlogActor final : public Actor {
 
   std::multimap<uint64, Promise<>> immediate_sync_promises_;
   std::vector<Promise<>> sync_promises_;
+  std::vector<Promise<>> pending_sync_promises_;  // promises of the sync in the current BinlogSyncBatch
+  bool is_sync_pending_ = false;
+  bool need_sync_again_ = false;
   bool force_sync_flag_ = false;
   bool lazy_sync_flag_ = false;
   bool flush_flag_ = false;
@@ -96,6 +309,17 @@ class BinlogActor final : public Actor {
     }
   }
 
+  void cancel_pending_sync() {
+    if (!is_sync_pending_) {
+      return;
+    }
+    is_sync_pending_ = false;
+    auto actor_id = BinlogSyncBatch::get().remove(binlog_.get());
+    if (!actor_id.empty()) {
+      send_closure_later(actor_id, &BinlogActor::sync_batch);
+    }
+  }
+
   void do_add_raw_event(BufferSlice &&raw_event, BinlogDebugInfo info) {
     binlog_->add_raw_event(std::move(raw_event), info);
   }
@@ -150,9 +374,19 @@ class BinlogActor final : public Actor {
     flush_flag_ = false;
     wakeup_at_ = 0;
     if (need_sync) {
-      binlog_->sync();
+      if (is_sync_pending_) {
+        need_sync_again_ = true;
+        return;
+      }
+      // the file is synced together with files of other binlogs, which need sync at the same time
+      binlog_->flush();
       // LOG(ERROR) << "BINLOG SYNC";
-      set_promises(sync_promises_);
+      pending_sync_promises_ = std::move(sync_promises_);
+      sync_promises_.clear();
+      is_sync_pending_ = true;
+      if (BinlogSyncBatch::get().add(actor_id(this), binlog_.get())) {
+        send_closure_later(actor_id(this), &BinlogActor::sync_batch);
+      }
     } else if (need_flush) {
       try_flush();
       // LOG(ERROR) << "BINLOG FLUSH";
@@ -161,6 +395,17 @@ class BinlogActor final : public Actor {
 };
 }  // namespace detail
 
+ConcurrentBinlog::SyncStatistics ConcurrentBinlog::get_sync_statistics() {
+  SyncStatistics result;
+  for (size_t i = 0; i < SYNC_STATISTICS_BUCKET_COUNT; i++) {
+    result.batch_size_counts[i] = detail::sync_batch_size_counts[i].load(std::memory_order_relaxed);
+    result.latency_counts[i] = detail::sync_latency_counts[i].load(std::memory_order_relaxed);
+  }
+  result.batch_size_sum = detail::sync_batch_size_sum.load(std::memory_order_relaxed);
+  result.latency_sum = detail::sync_latency_sum.load(std::memory_order_relaxed);
+  return result;
+}
+
 ConcurrentBinlog::ConcurrentBinlog() = default;
 ConcurrentBinlog::~ConcurrentBinlog() = default;
 ConcurrentBinlog::ConcurrentBinlog(unique_ptr<Binlog> binlog, int scheduler_id) {
@@ -203,4 +448,10 @@ void ConcurrentBinlog::force_flush() {
 void ConcurrentBinlog::change_key(DbKey db_key, Promise<> promise) {
   send_closure(binlog_actor_, &detail::BinlogActor::change_key, std::move(db_key), std::move(promise));
 }
+void ConcurrentBinlog::force_reindex() {
+  send_closure(binlog_actor_, &detail::BinlogActor::force_reindex);
+}
+void ConcurrentBinlog::reindex_if_needed(int64 min_size, int64 max_overhead_percent) {
+  send_closure(binlog_actor_, &detail::BinlogActor::reindex_if_needed, min_size, max_overhead_percent);
+}
 }  // namespace td
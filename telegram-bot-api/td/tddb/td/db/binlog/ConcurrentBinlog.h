@@ -44,6 +44,9 @@ class ConcurrentBinlog final : public BinlogInterface {
   void force_sync(Promise<> promise) final;
   void force_flush() final;
   void change_key(DbKey db_key, Promise<> promise) final;
+  void force_reindex();
+
+  void reindex_if_needed(int64 min_size, int64 max_overhead_percent);
 
   uint64 next_event_id() final {
     return last_event_id_.fetch_add(1, std::memory_order_relaxed);
@@ -56,6 +59,18 @@ class ConcurrentBinlog final : public BinlogInterface {
     return path_;
   }
 
+  static constexpr size_t SYNC_STATISTICS_BUCKET_COUNT = 32;
+
+  // files of all binlogs of a scheduler, which need to be synced at the same time, are synced together in parallel;
+  // counts[i] is the number of such sync batches with value in [2^i, 2^(i + 1)), or in [0, 2) for i == 0
+  struct SyncStatistics {
+    uint64 batch_size_counts[SYNC_STATISTICS_BUCKET_COUNT] = {};
+    uint64 latency_counts[SYNC_STATISTICS_BUCKET_COUNT] = {};  // in microseconds
+    uint64 batch_size_sum = 0;
+    uint64 latency_sum = 0;
+  };
+  static SyncStatistics get_sync_statistics();
+
  private:
   void init_impl(unique_ptr<Binlog> binlog, int scheduler_id);
   void close_impl(Promise<> promise) final;
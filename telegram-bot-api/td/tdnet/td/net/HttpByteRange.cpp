@@ -0,0 +1,67 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/net/HttpByteRange.h"
+
+#include "td/utils/misc.h"
+#include "td/utils/Status.h"
+
+namespace td {
+
+HttpByteRange HttpByteRange::parse(Slice range, int64 size) {
+  HttpByteRange result;
+  result.end = size;
+  if (!begins_with(range, "bytes=") || range.find(',') != Slice::npos) {
+    return result;
+  }
+  auto range_spec = trim(range.substr(6));
+  auto dash_pos = range_spec.find('-');
+  if (dash_pos == Slice::npos) {
+    return result;
+  }
+  auto first = trim(range_spec.substr(0, dash_pos));
+  auto last = trim(range_spec.substr(dash_pos + 1));
+  if (first.empty()) {
+    // suffix range with the last bytes of the resource
+    auto r_length = to_integer_safe<int64>(last);
+    if (r_length.is_error() || r_length.ok() < 0 || !is_digit(last[0])) {
+      return result;
+    }
+    result.is_partial = true;
+    if (r_length.ok() == 0 || size == 0) {
+      result.is_satisfiable = false;
+    } else {
+      result.begin = max(static_cast<int64>(0), size - r_length.ok());
+    }
+    return result;
+  }
+
+  auto r_first = to_integer_safe<int64>(first);
+  if (r_first.is_error() || !is_digit(first[0])) {
+    return result;
+  }
+  auto begin = r_first.ok();
+  auto end = size;
+  if (!last.empty()) {
+    auto r_last = to_integer_safe<int64>(last);
+    if (r_last.is_error() || !is_digit(last[0]) || r_last.ok() < begin) {
+      return result;
+    }
+    if (r_last.ok() < size) {
+      end = r_last.ok() + 1;
+    }
+  }
+  result.is_partial = true;
+  if (begin >= size) {
+    result.is_satisfiable = false;
+  } else {
+    result.begin = begin;
+    result.end = end;
+  }
+  return result;
+}
+
+}  // namespace td
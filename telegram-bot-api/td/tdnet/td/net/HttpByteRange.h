@@ -0,0 +1,25 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+
+namespace td {
+
+// part of a resource requested with the Range header
+struct HttpByteRange {
+  int64 begin = 0;
+  int64 end = 0;
+  bool is_partial = false;     // the response must have status 206
+  bool is_satisfiable = true;  // the response must have status 416 otherwise
+
+  // only a single byte range is supported; other Range headers are ignored and the whole resource is returned
+  static HttpByteRange parse(Slice range, int64 size);
+};
+
+}  // namespace td
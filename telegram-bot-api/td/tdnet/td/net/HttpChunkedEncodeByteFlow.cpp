@@ -0,0 +1,38 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/net/HttpChunkedEncodeByteFlow.h"
+
+#include "td/utils/Slice.h"
+#include "td/utils/Status.h"
+
+namespace td {
+
+bool HttpChunkedEncodeByteFlow::loop() {
+  auto size = input_->size();
+  if (size == 0) {
+    if (!is_input_active_) {
+      output_.append(Slice("0\r\n\r\n"));
+      finish(Status::OK());
+    }
+    return false;
+  }
+
+  char length[2 * sizeof(size_t) + 2];
+  auto end = length + sizeof(length);
+  auto begin = end;
+  *--begin = '\n';
+  *--begin = '\r';
+  for (auto value = size; value != 0; value /= 16) {
+    *--begin = "0123456789abcdef"[value % 16];
+  }
+  output_.append(Slice(begin, end));
+  output_.append(input_->cut_head(size));
+  output_.append(Slice("\r\n"));
+  return true;
+}
+
+}  // namespace td
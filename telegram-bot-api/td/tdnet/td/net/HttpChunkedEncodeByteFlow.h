@@ -0,0 +1,19 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/ByteFlow.h"
+
+namespace td {
+
+// encodes the input with chunked transfer encoding; the last chunk is written after the input is closed
+class HttpChunkedEncodeByteFlow final : public ByteFlowBase {
+ public:
+  bool loop() final;
+};
+
+}  // namespace td
@@ -26,6 +26,7 @@ HttpConnectionBase::HttpConnectionBase(State state, BufferedFd<SocketFd> fd, Ssl
     , idle_timeout_(idle_timeout)
     , slow_scheduler_id_(slow_scheduler_id) {
   CHECK(state_ != State::Close);
+  is_pipelining_allowed_ = state_ == State::Write;
 
   if (ssl_stream_) {
     read_source_ >> ssl_stream_.read_byte_flow() >> read_sink_;
@@ -58,7 +59,12 @@ void HttpConnectionBase::tear_down() {
 }
 
 void HttpConnectionBase::write_next_noflush(BufferSlice buffer) {
-  CHECK(state_ == State::Write);
+  CHECK(state_ == State::Write || (state_ == State::Read && is_pipelining_allowed_));
+  if (gzip_body_ != nullptr) {
+    gzip_body_->input_.append(std::move(buffer));
+    gzip_body_->source_.wakeup();
+    return;
+  }
   write_buffer_.append(std::move(buffer));
 }
 void HttpConnectionBase::write_next(BufferSlice buffer) {
@@ -66,10 +72,99 @@ void HttpConnectionBase::write_next(BufferSlice buffer) {
   loop();
 }
 
+void HttpConnectionBase::write_file(FileFd file, int64 offset, int64 size) {
+  CHECK(state_ == State::Write);
+  CHECK(!ssl_stream_);
+  CHECK(write_file_.empty());
+  if (size <= 0) {
+    return;
+  }
+
+  // the data written before must be sent before the file
+  write_source_.wakeup();
+  write_file_ = std::move(file);
+  write_file_offset_ = offset;
+  write_file_size_ = size;
+
+  if (slow_scheduler_id_ != -1) {
+    // reading of the file can block, so it must be sent from a separate scheduler
+    LOG(INFO) << "Send file: migrate to " << slow_scheduler_id_;
+    yield();
+    migrate(slow_scheduler_id_);
+    slow_scheduler_id_ = -1;
+  }
+}
+
+void HttpConnectionBase::write_gzip_body(int compression_level) {
+  CHECK(state_ == State::Write || (state_ == State::Read && is_pipelining_allowed_));
+  CHECK(gzip_body_ == nullptr);
+  gzip_body_ = make_unique<GzipBody>();
+  gzip_body_->gzip_flow_.init_encode(compression_level, true);
+  gzip_body_->sink_.set_output(&write_buffer_);
+  gzip_body_->source_ >> gzip_body_->gzip_flow_ >> gzip_body_->chunked_flow_ >> gzip_body_->sink_;
+}
+
+Status HttpConnectionBase::finish_gzip_body() {
+  CHECK(gzip_body_ != nullptr);
+  gzip_body_->source_.close_input(Status::OK());
+  CHECK(gzip_body_->sink_.is_ready());
+  auto status = std::move(gzip_body_->sink_.status());
+  gzip_body_ = nullptr;
+  return status;
+}
+
+Status HttpConnectionBase::flush_write_file() {
+  while (write_file_size_ > 0 && can_write_local(fd_) && !fd_.need_flush_write()) {
+    auto part_size = static_cast<size_t>(min(write_file_size_, static_cast<int64>(1 << 20)));
+#if TD_PORT_POSIX
+    TRY_RESULT(sent_size, fd_.send_file(write_file_.get_native_fd(), write_file_offset_, part_size));
+    if (sent_size == 0) {
+      if (can_write_local(fd_)) {
+        return Status::Error("Unexpected end of file");
+      }
+      break;
+    }
+#else
+    BufferSlice part(min(part_size, static_cast<size_t>(1 << 16)));
+    TRY_RESULT(sent_size, write_file_.pread(part.as_mutable_slice(), write_file_offset_));
+    if (sent_size == 0) {
+      return Status::Error("Unexpected end of file");
+    }
+    part.truncate(sent_size);
+    fd_.output_buffer().append(std::move(part));
+    TRY_STATUS(fd_.flush_write());
+#endif
+    write_file_offset_ += static_cast<int64>(sent_size);
+    write_file_size_ -= static_cast<int64>(sent_size);
+    live_event();
+  }
+  if (write_file_size_ == 0) {
+    write_file_.close();
+  }
+  return Status::OK();
+}
+
 void HttpConnectionBase::write_ok() {
+  if (gzip_body_ != nullptr) {
+    auto status = finish_gzip_body();
+    if (status.is_error()) {
+      LOG(ERROR) << "Failed to compress the body: " << status;
+      state_ = State::Close;
+      loop();
+      return;
+    }
+  }
+  if (state_ == State::Read) {
+    CHECK(is_pipelining_allowed_);
+    CHECK(pending_answer_count_ > 0);
+    pending_answer_count_++;
+    loop();
+    return;
+  }
   CHECK(state_ == State::Write);
   current_query_ = make_unique<HttpQuery>();
   state_ = State::Read;
+  pending_answer_count_ = 1;
   live_event();
   loop();
 }
@@ -84,7 +179,7 @@ void HttpConnectionBase::write_error(Status error) {
 void HttpConnectionBase::timeout_expired() {
   LOG(INFO) << "Idle timeout expired";
 
-  if (fd_.need_flush_write()) {
+  if (fd_.need_flush_write() || !write_file_.empty()) {
     on_error(Status::Error("Write timeout expired"));
   } else if (state_ == State::Read) {
     on_error(Status::Error("Read timeout expired"));
@@ -115,7 +210,8 @@ void HttpConnectionBase::loop() {
 
   bool want_read = false;
   bool can_be_slow = slow_scheduler_id_ == -1;
-  if (state_ == State::Read) {
+  // the next query isn't read until the whole file is sent, because its answer must be sent after the file
+  if (state_ == State::Read && write_file_.empty()) {
     auto res = reader_.read_next(current_query_.get(), can_be_slow);
     if (res.is_error()) {
       if (res.error().message() == "SLOW") {
@@ -140,17 +236,29 @@ void HttpConnectionBase::loop() {
       close_after_write_ = true;
       on_error(Status::Error(res.error().public_message()));
     } else if (res.ok() == 0) {
-      state_ = State::Write;
       LOG(DEBUG) << "Send query to handler";
       live_event();
       current_query_->peer_address_ = peer_address_;
-      on_query(std::move(current_query_));
+      if (pending_answer_count_ > 1) {
+        // continue reading answers to the pipelined queries
+        pending_answer_count_--;
+        auto query = std::move(current_query_);
+        current_query_ = make_unique<HttpQuery>();
+        on_query(std::move(query));
+        yield();
+      } else {
+        state_ = State::Write;
+        pending_answer_count_ = 0;
+        on_query(std::move(current_query_));
+      }
     } else {
       want_read = true;
     }
   }
 
-  write_source_.wakeup();
+  if (write_file_.empty()) {
+    write_source_.wakeup();
+  }
 
   if (can_write_local(fd_)) {
     LOG(DEBUG) << "Can write to the connection";
@@ -159,7 +267,18 @@ void HttpConnectionBase::loop() {
       LOG(INFO) << "Receive flush_write error: " << r.error();
       on_error(Status::Error(r.error().public_message()));
     }
-    if (close_after_write_ && !fd_.need_flush_write()) {
+    if (!write_file_.empty() && !fd_.need_flush_write()) {
+      auto status = flush_write_file();
+      if (status.is_error()) {
+        LOG(INFO) << "Failed to send file: " << status;
+        write_file_.close();
+        state_ = State::Close;
+      } else if (write_file_.empty()) {
+        // send the data written after the file
+        yield();
+      }
+    }
+    if (close_after_write_ && !fd_.need_flush_write() && write_file_.empty()) {
       return stop();
     }
   }
@@ -6,6 +6,7 @@
 //
 #pragma once
 
+#include "td/net/HttpChunkedEncodeByteFlow.h"
 #include "td/net/HttpQuery.h"
 #include "td/net/HttpReader.h"
 #include "td/net/SslStream.h"
@@ -15,6 +16,9 @@
 #include "td/utils/buffer.h"
 #include "td/utils/BufferedFd.h"
 #include "td/utils/ByteFlow.h"
+#include "td/utils/common.h"
+#include "td/utils/GzipByteFlow.h"
+#include "td/utils/port/FileFd.h"
 #include "td/utils/port/IPAddress.h"
 #include "td/utils/port/SocketFd.h"
 #include "td/utils/Status.h"
@@ -27,6 +31,12 @@ class HttpConnectionBase : public Actor {
  public:
   void write_next_noflush(BufferSlice buffer);
   void write_next(BufferSlice buffer);
+  // sends size bytes of the file starting from the offset after all previously written data;
+  // the file isn't copied to user space if possible, so it can't be used with SSL connections
+  void write_file(FileFd file, int64 offset, int64 size);
+  // data written after this call until write_ok is compressed with gzip and sent with chunked transfer encoding;
+  // the headers must be already written and must contain "Content-Encoding: gzip" and "Transfer-Encoding: chunked"
+  void write_gzip_body(int compression_level);
   void write_ok();
   void write_error(Status error);
 
@@ -50,6 +60,22 @@ class HttpConnectionBase : public Actor {
   ByteFlowSource write_source_{&write_buffer_reader_};
   ByteFlowMoveSink write_sink_{&fd_.output_buffer()};
 
+  // the body, which is being compressed; the compressed chunks are appended to write_buffer_
+  struct GzipBody {
+    ChainBufferWriter input_;
+    ChainBufferReader input_reader_ = input_.extract_reader();
+    ByteFlowSource source_{&input_reader_};
+    GzipByteFlow gzip_flow_;
+    HttpChunkedEncodeByteFlow chunked_flow_;
+    ByteFlowMoveSink sink_;
+  };
+  unique_ptr<GzipBody> gzip_body_;
+
+  // data written after the file is kept in write_buffer_ until the whole file is sent
+  FileFd write_file_;
+  int64 write_file_offset_ = 0;
+  int64 write_file_size_ = 0;
+
   size_t max_post_size_;
   size_t max_files_;
   int32 idle_timeout_;
@@ -57,10 +83,18 @@ class HttpConnectionBase : public Actor {
   unique_ptr<HttpQuery> current_query_;
   bool close_after_write_ = false;
 
+  // outbound connections can send next queries before answers to the previous queries are received
+  bool is_pipelining_allowed_ = false;
+  size_t pending_answer_count_ = 0;
+
   int32 slow_scheduler_id_{-1};
 
   void live_event();
 
+  Status flush_write_file() TD_WARN_UNUSED_RESULT;
+
+  Status finish_gzip_body() TD_WARN_UNUSED_RESULT;
+
   void start_up() final;
   void tear_down() final;
   void timeout_expired() final;
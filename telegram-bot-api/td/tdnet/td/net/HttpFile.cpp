@@ -14,7 +14,7 @@ namespace td {
 
 HttpFile::~HttpFile() {
   if (!temp_file_name.empty()) {
-    HttpReader::delete_temp_file(temp_file_name);
+    HttpReader::delete_temp_file(temp_file_name, reserved_memory_size);
   }
 }
 
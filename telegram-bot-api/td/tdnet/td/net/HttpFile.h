@@ -18,13 +18,16 @@ class HttpFile {
   string content_type;
   int64 size;
   string temp_file_name;
+  int64 reserved_memory_size;  // size accounted in the limit for the in-memory temporary directory
 
-  HttpFile(string field_name, string name, string content_type, int64 size, string temp_file_name)
+  HttpFile(string field_name, string name, string content_type, int64 size, string temp_file_name,
+           int64 reserved_memory_size = 0)
       : field_name(std::move(field_name))
       , name(std::move(name))
       , content_type(std::move(content_type))
       , size(size)
-      , temp_file_name(std::move(temp_file_name)) {
+      , temp_file_name(std::move(temp_file_name))
+      , reserved_memory_size(reserved_memory_size) {
   }
 
   HttpFile(const HttpFile &) = delete;
@@ -35,8 +38,10 @@ class HttpFile {
       , name(std::move(other.name))
       , content_type(std::move(other.content_type))
       , size(other.size)
-      , temp_file_name(std::move(other.temp_file_name)) {
+      , temp_file_name(std::move(other.temp_file_name))
+      , reserved_memory_size(other.reserved_memory_size) {
     other.temp_file_name.clear();
+    other.reserved_memory_size = 0;
   }
 
   HttpFile &operator=(HttpFile &&) = delete;
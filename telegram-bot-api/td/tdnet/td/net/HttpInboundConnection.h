@@ -25,6 +25,8 @@ class HttpInboundConnection final : public detail::HttpConnectionBase {
   };
   // Inherited interface
   // void write_next(BufferSlice buffer);
+  // void write_gzip_body(int compression_level);
+  // void write_file(FileFd file, int64 offset, int64 size);
   // void write_ok();
   // void write_error(Status error);
 
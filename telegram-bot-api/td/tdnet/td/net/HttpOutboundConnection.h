@@ -33,6 +33,7 @@ class HttpOutboundConnection final : public detail::HttpConnectionBase {
   }
   // Inherited interface
   // void write_next(BufferSlice buffer);
+  // void write_gzip_body(int compression_level);
   // void write_ok();
   // void write_error(Status error);
 
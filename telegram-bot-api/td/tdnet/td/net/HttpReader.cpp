@@ -17,8 +17,10 @@
 #include "td/utils/Parser.h"
 #include "td/utils/PathView.h"
 #include "td/utils/port/path.h"
+#include "td/utils/ScopeGuard.h"
 #include "td/utils/SliceBuilder.h"
 
+#include <atomic>
 #include <cstddef>
 #include <cstring>
 
@@ -26,6 +28,29 @@ namespace td {
 
 constexpr const char HttpReader::TEMP_DIRECTORY_PREFIX[];
 
+static string memory_temporary_dir;
+static int64 max_memory_temporary_files_size;
+static int64 max_memory_temporary_file_size;
+static std::atomic<int64> memory_temporary_files_size{0};
+
+Status HttpReader::set_memory_temporary_dir(CSlice dir, int64 max_size, int64 max_file_size) {
+  if (dir.empty()) {
+    memory_temporary_dir.clear();
+    max_memory_temporary_files_size = 0;
+    max_memory_temporary_file_size = 0;
+    return Status::OK();
+  }
+  string input_dir = dir.str();
+  if (dir.back() != TD_DIR_SLASH) {
+    input_dir += TD_DIR_SLASH;
+  }
+  TRY_STATUS(mkpath(input_dir, 0750));
+  TRY_RESULT_ASSIGN(memory_temporary_dir, realpath(input_dir));
+  max_memory_temporary_files_size = max_size;
+  max_memory_temporary_file_size = max_file_size;
+  return Status::OK();
+}
+
 void HttpReader::init(ChainBufferReader *input, size_t max_post_size, size_t max_files) {
   input_ = input;
   state_ = State::ReadHeaders;
@@ -174,7 +199,9 @@ Result<size_t> HttpReader::read_next(HttpQuery *query, bool can_be_slow) {
         }
         // save content to a file
         if (temp_file_.empty()) {
-          auto open_status = open_temp_file("file");
+          // without content encoding the whole content is the file, so its size is known in advance
+          bool is_encoded = !content_encoding_.empty() && content_encoding_ != "none";
+          auto open_status = open_temp_file("file", is_encoded ? 0 : static_cast<int64>(content_length_));
           if (open_status.is_error()) {
             return Status::Error(500, "Internal Server Error: can't create temporary file");
           }
@@ -187,7 +214,8 @@ Result<size_t> HttpReader::read_next(HttpQuery *query, bool can_be_slow) {
           restart = true;
         }
         if (flow_sink_.is_ready()) {
-          query_->files_.emplace_back("file", "", content_type_.str(), file_size_, temp_file_name_);
+          query_->files_.emplace_back("file", "", content_type_.str(), file_size_, temp_file_name_,
+                                      reserved_memory_size_);
           close_temp_file();
           break;
         }
@@ -464,7 +492,7 @@ Result<bool> HttpReader::parse_multipart_form_data(bool can_be_slow) {
           return Status::Error("SLOW");
         }
         if (temp_file_.empty()) {
-          auto open_status = open_temp_file(file_name_);
+          auto open_status = open_temp_file(file_name_, 0);
           if (open_status.is_error()) {
             return Status::Error(500, "Internal Server Error: can't create temporary file");
           }
@@ -477,7 +505,8 @@ Result<bool> HttpReader::parse_multipart_form_data(bool can_be_slow) {
 
           TRY_STATUS(save_file_part(std::move(file_part)));
 
-          query_->files_.emplace_back(file_field_name_, file_name_, field_content_type_, file_size_, temp_file_name_);
+          query_->files_.emplace_back(file_field_name_, file_name_, field_content_type_, file_size_, temp_file_name_,
+                                      reserved_memory_size_);
           close_temp_file();
 
           form_data_parse_state_ = FormDataParseState::CheckForLastBoundary;
@@ -774,9 +803,19 @@ Status HttpReader::parse_head(MutableSlice head) {
   return parser.status().is_ok() ? Status::OK() : Status::Error(400, "Bad Request");
 }
 
-Status HttpReader::open_temp_file(CSlice desired_file_name) {
+Status HttpReader::open_temp_file(CSlice desired_file_name, int64 min_file_size) {
   CHECK(temp_file_.empty());
 
+  if (!memory_temporary_dir.empty() && min_file_size <= max_memory_temporary_file_size &&
+      memory_temporary_files_size.load(std::memory_order_relaxed) < max_memory_temporary_files_size) {
+    auto status = open_temp_file_in_dir(memory_temporary_dir, desired_file_name);
+    if (status.is_ok()) {
+      is_temp_file_in_memory_ = true;
+      return Status::OK();
+    }
+    LOG(WARNING) << "Failed to create temporary file in memory: " << status;
+  }
+
   auto tmp_dir = get_temporary_dir();
   if (tmp_dir.empty()) {
     return Status::Error("Can't find temporary directory");
@@ -784,7 +823,10 @@ Status HttpReader::open_temp_file(CSlice desired_file_name) {
 
   TRY_RESULT(dir, realpath(tmp_dir, true));
   CHECK(!dir.empty());
+  return open_temp_file_in_dir(dir, desired_file_name);
+}
 
+Status HttpReader::open_temp_file_in_dir(CSlice dir, CSlice desired_file_name) {
   auto first_try = try_open_temp_file(dir, desired_file_name);
   if (first_try.is_ok()) {
     return Status::OK();
@@ -831,6 +873,49 @@ Status HttpReader::try_open_temp_file(Slice directory_name, CSlice desired_file_
   return Status::OK();
 }
 
+Status HttpReader::move_temp_file_to_disk() {
+  CHECK(is_temp_file_in_memory_);
+  LOG(INFO) << "Move temporary file " << temp_file_name_ << " of size " << reserved_memory_size_ << " to disk";
+  string memory_file_name = temp_file_name_;
+  auto memory_file_size = reserved_memory_size_;
+  auto file_size = file_size_;
+  temp_file_.close();
+  temp_file_name_.clear();
+  is_temp_file_in_memory_ = false;
+  reserved_memory_size_ = 0;
+  SCOPE_EXIT {
+    delete_temp_file(memory_file_name, memory_file_size);
+  };
+
+  auto tmp_dir = get_temporary_dir();
+  if (tmp_dir.empty()) {
+    return Status::Error("Can't find temporary directory");
+  }
+  TRY_RESULT(dir, realpath(tmp_dir, true));
+  TRY_STATUS(open_temp_file_in_dir(dir, PathView(memory_file_name).file_name().str()));
+  file_size_ = file_size;
+
+  auto status = [&] {
+    TRY_RESULT(memory_file, FileFd::open(memory_file_name, FileFd::Read));
+    BufferSlice buffer(1 << 16);
+    while (true) {
+      TRY_RESULT(read_size, memory_file.read(buffer.as_mutable_slice()));
+      if (read_size == 0) {
+        break;
+      }
+      TRY_RESULT(written_size, temp_file_.write(buffer.as_slice().substr(0, read_size)));
+      if (written_size != read_size) {
+        return Status::Error("Failed to write file");
+      }
+    }
+    return Status::OK();
+  }();
+  if (status.is_error()) {
+    clean_temporary_file();
+  }
+  return status;
+}
+
 Status HttpReader::save_file_part(BufferSlice &&file_part) {
   file_size_ += narrow_cast<int64>(file_part.size());
   if (file_size_ > MAX_FILE_SIZE) {
@@ -839,6 +924,29 @@ Status HttpReader::save_file_part(BufferSlice &&file_part) {
         413, PSLICE() << "Request Entity Too Large: file of size " << file_size_ << " is too big to be uploaded");
   }
 
+  if (is_temp_file_in_memory_) {
+    auto part_size = narrow_cast<int64>(file_part.size());
+    bool need_move = file_size_ > max_memory_temporary_file_size;
+    if (!need_move &&
+        memory_temporary_files_size.fetch_add(part_size, std::memory_order_relaxed) + part_size >
+            max_memory_temporary_files_size) {
+      // uploaded files aren't released fast enough
+      memory_temporary_files_size.fetch_sub(part_size, std::memory_order_relaxed);
+      need_move = true;
+    }
+    if (need_move) {
+      // store the file on disk; at most max_memory_temporary_file_size bytes are copied, and files are saved only
+      // after the connection has moved to the slow scheduler
+      auto status = move_temp_file_to_disk();
+      if (status.is_error()) {
+        LOG(ERROR) << "Failed to move temporary file to disk: " << status;
+        return Status::Error(500, "Internal Server Error: can't upload the file");
+      }
+    } else {
+      reserved_memory_size_ += part_size;
+    }
+  }
+
   LOG(DEBUG) << "Save file part of size " << file_part.size() << " to file " << temp_file_name_;
   auto result_written = temp_file_.write(file_part.as_slice());
   if (result_written.is_error() || result_written.ok() != file_part.size()) {
@@ -850,8 +958,9 @@ Status HttpReader::save_file_part(BufferSlice &&file_part) {
 
 void HttpReader::clean_temporary_file() {
   string file_name = temp_file_name_;
+  auto reserved_memory_size = reserved_memory_size_;
   close_temp_file();
-  delete_temp_file(file_name);
+  delete_temp_file(file_name, reserved_memory_size);
 }
 
 void HttpReader::close_temp_file() {
@@ -860,12 +969,17 @@ void HttpReader::close_temp_file() {
   temp_file_.close();
   CHECK(temp_file_.empty());
   temp_file_name_.clear();
+  is_temp_file_in_memory_ = false;
+  reserved_memory_size_ = 0;
 }
 
-void HttpReader::delete_temp_file(CSlice file_name) {
+void HttpReader::delete_temp_file(CSlice file_name, int64 reserved_memory_size) {
   CHECK(!file_name.empty());
   LOG(DEBUG) << "Unlink temporary file " << file_name;
   unlink(file_name).ignore();
+  if (reserved_memory_size != 0) {
+    memory_temporary_files_size.fetch_sub(reserved_memory_size, std::memory_order_relaxed);
+  }
   PathView path_view(file_name);
   Slice parent = path_view.parent_dir();
   const size_t prefix_length = std::strlen(TEMP_DIRECTORY_PREFIX);
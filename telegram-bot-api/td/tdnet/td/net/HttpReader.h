@@ -40,7 +40,13 @@ class HttpReader {
     }
   }
 
-  static void delete_temp_file(CSlice file_name);
+  // uploaded files are stored in the directory, which is supposed to be in a RAM-backed file system, while
+  // total size of the stored files doesn't exceed max_size and size of each file doesn't exceed max_file_size;
+  // other files are stored in the temporary directory
+  // an empty directory disables storing of files in memory
+  static Status set_memory_temporary_dir(CSlice dir, int64 max_size, int64 max_file_size) TD_WARN_UNUSED_RESULT;
+
+  static void delete_temp_file(CSlice file_name, int64 reserved_memory_size = 0);
 
  private:
   size_t max_post_size_ = 0;
@@ -86,6 +92,8 @@ class HttpReader {
   FileFd temp_file_;
   string temp_file_name_;
   int64 file_size_ = 0;
+  bool is_temp_file_in_memory_ = false;
+  int64 reserved_memory_size_ = 0;
 
   Result<size_t> split_header() TD_WARN_UNUSED_RESULT;
   void process_header(MutableSlice header_name, MutableSlice header_value);
@@ -95,8 +103,10 @@ class HttpReader {
   Status parse_json_parameters(MutableSlice parameters) TD_WARN_UNUSED_RESULT;
   Status parse_head(MutableSlice head) TD_WARN_UNUSED_RESULT;
 
-  Status open_temp_file(CSlice desired_file_name) TD_WARN_UNUSED_RESULT;
+  Status open_temp_file(CSlice desired_file_name, int64 min_file_size) TD_WARN_UNUSED_RESULT;
+  Status open_temp_file_in_dir(CSlice directory_name, CSlice desired_file_name) TD_WARN_UNUSED_RESULT;
   Status try_open_temp_file(Slice directory_name, CSlice desired_file_name) TD_WARN_UNUSED_RESULT;
+  Status move_temp_file_to_disk() TD_WARN_UNUSED_RESULT;
   Status save_file_part(BufferSlice &&file_part) TD_WARN_UNUSED_RESULT;
   void close_temp_file();
   void clean_temporary_file();
@@ -153,6 +153,74 @@ X509_STORE *load_system_certificate_store() {
 
 using SslCtxPtr = std::shared_ptr<SSL_CTX>;
 
+// client TLS sessions by host name and port; shared by all users of the SSL context
+class SslSessionCache {
+ public:
+  SslSessionCache() = default;
+  SslSessionCache(const SslSessionCache &) = delete;
+  SslSessionCache &operator=(const SslSessionCache &) = delete;
+  SslSessionCache(SslSessionCache &&) = delete;
+  SslSessionCache &operator=(SslSessionCache &&) = delete;
+  ~SslSessionCache() {
+    clear();
+  }
+
+  SSL_SESSION *get(Slice host, int port) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    auto key = get_key(host, port);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(key);
+    if (it == sessions_.end()) {
+      return nullptr;
+    }
+    SSL_SESSION_up_ref(it->second);
+    return it->second;
+#else
+    return nullptr;
+#endif
+  }
+
+  void add(Slice host, int port, SSL_SESSION *session) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    auto key = get_key(host, port);
+    SSL_SESSION_up_ref(session);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sessions_.size() >= MAX_SESSION_COUNT) {
+      clear();
+    }
+    auto &old_session = sessions_[key];
+    if (old_session != nullptr) {
+      SSL_SESSION_free(old_session);
+    }
+    old_session = session;
+#endif
+  }
+
+ private:
+  static constexpr size_t MAX_SESSION_COUNT = 100000;
+
+  std::mutex mutex_;
+  FlatHashMap<string, SSL_SESSION *> sessions_;
+
+  // different ports of the same host can belong to different services, which must not share sessions
+  static string get_key(Slice host, int port) {
+    return PSTRING() << host << ':' << port;
+  }
+
+  void clear() {
+    for (auto &it : sessions_) {
+      SSL_SESSION_free(it.second);
+    }
+    sessions_.clear();
+  }
+};
+
+std::shared_ptr<SslSessionCache> get_default_ssl_session_cache(SslCtx::VerifyPeer verify_peer) {
+  static auto verified_session_cache = std::make_shared<SslSessionCache>();
+  static auto unverified_session_cache = std::make_shared<SslSessionCache>();
+  return verify_peer == SslCtx::VerifyPeer::On ? verified_session_cache : unverified_session_cache;
+}
+
 Result<SslCtxPtr> do_create_ssl_ctx(CSlice cert_file, SslCtx::VerifyPeer verify_peer) {
   auto ssl_method =
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
@@ -249,6 +317,7 @@ class SslCtxImpl {
       } else {
         TRY_RESULT_ASSIGN(ssl_ctx_ptr_, get_default_unverified_ssl_ctx());
       }
+      session_cache_ = get_default_ssl_session_cache(verify_peer);
       return Status::OK();
     }
 
@@ -262,6 +331,7 @@ class SslCtxImpl {
       return r_ssl_ctx_ptr.move_as_error();
     }
     ssl_ctx_ptr_ = r_ssl_ctx_ptr.move_as_ok();
+    session_cache_ = std::make_shared<SslSessionCache>();
     return Status::OK();
   }
 
@@ -269,8 +339,17 @@ class SslCtxImpl {
     return static_cast<void *>(ssl_ctx_ptr_.get());
   }
 
+  void *get_openssl_session(Slice host, int port) const {
+    return static_cast<void *>(session_cache_->get(host, port));
+  }
+
+  void add_openssl_session(Slice host, int port, void *openssl_session) const {
+    session_cache_->add(host, port, static_cast<SSL_SESSION *>(openssl_session));
+  }
+
  private:
   SslCtxPtr ssl_ctx_ptr_;
+  std::shared_ptr<SslSessionCache> session_cache_;
 };
 
 }  // namespace detail
@@ -321,6 +400,16 @@ void *SslCtx::get_openssl_ctx() const {
   return impl_ == nullptr ? nullptr : impl_->get_openssl_ctx();
 }
 
+void *SslCtx::get_openssl_session(Slice host, int port) const {
+  return impl_ == nullptr ? nullptr : impl_->get_openssl_session(host, port);
+}
+
+void SslCtx::add_openssl_session(Slice host, int port, void *openssl_session) const {
+  if (impl_ != nullptr) {
+    impl_->add_openssl_session(host, port, openssl_session);
+  }
+}
+
 SslCtx::SslCtx(unique_ptr<detail::SslCtxImpl> impl) : impl_(std::move(impl)) {
 }
 
@@ -362,6 +451,13 @@ void *SslCtx::get_openssl_ctx() const {
   return nullptr;
 }
 
+void *SslCtx::get_openssl_session(Slice host, int port) const {
+  return nullptr;
+}
+
+void SslCtx::add_openssl_session(Slice host, int port, void *openssl_session) const {
+}
+
 SslCtx::SslCtx(unique_ptr<detail::SslCtxImpl> impl) : impl_(std::move(impl)) {
 }
 
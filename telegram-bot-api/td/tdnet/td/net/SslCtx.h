@@ -32,6 +32,12 @@ class SslCtx {
 
   void *get_openssl_ctx() const;
 
+  // returns a new reference to SSL_SESSION for resumption of a TLS session with the host and port or nullptr
+  void *get_openssl_session(Slice host, int port) const;
+
+  // remembers SSL_SESSION of an established TLS session with the host and port for later resumption
+  void add_openssl_session(Slice host, int port, void *openssl_session) const;
+
   explicit operator bool() const noexcept {
     return static_cast<bool>(impl_);
   }
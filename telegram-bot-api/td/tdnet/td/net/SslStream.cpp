@@ -136,7 +136,7 @@ using SslHandle = std::unique_ptr<SSL, SslHandleDeleter>;
 
 class SslStreamImpl {
  public:
-  Status init(CSlice host, SslCtx ssl_ctx, bool check_ip_address_as_host) {
+  Status init(CSlice host, int port, SslCtx ssl_ctx, bool check_ip_address_as_host) {
     if (!ssl_ctx) {
       return Status::Error("Invalid SSL context provided");
     }
@@ -177,7 +177,17 @@ class SslStreamImpl {
 #endif
     SSL_set_connect_state(ssl_handle.get());
 
+    // try to resume the last TLS session with the host and port to avoid a full handshake
+    auto *session = static_cast<SSL_SESSION *>(ssl_ctx.get_openssl_session(host, port));
+    if (session != nullptr) {
+      SSL_set_session(ssl_handle.get(), session);
+      SSL_SESSION_free(session);
+    }
+
     ssl_handle_ = std::move(ssl_handle);
+    ssl_ctx_ = std::move(ssl_ctx);
+    host_ = host.str();
+    port_ = port;
 
     return Status::OK();
   }
@@ -197,6 +207,10 @@ class SslStreamImpl {
 
  private:
   SslHandle ssl_handle_;
+  SslCtx ssl_ctx_;
+  string host_;
+  int port_ = 0;
+  bool is_session_saved_ = false;
 
   friend class SslReadByteFlow;
   friend class SslWriteByteFlow;
@@ -228,6 +242,16 @@ class SslStreamImpl {
     if (size <= 0) {
       return process_ssl_error(size);
     }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (!is_session_saved_) {
+      // session tickets in TLS 1.3 are received after the handshake, so the session can't be saved earlier
+      auto *session = SSL_get0_session(ssl_handle_.get());
+      if (session != nullptr && SSL_SESSION_is_resumable(session)) {
+        is_session_saved_ = true;
+        ssl_ctx_.add_openssl_session(host_, port_, session);
+      }
+    }
+#endif
     return size;
   }
 
@@ -357,9 +381,9 @@ SslStream::SslStream(SslStream &&) noexcept = default;
 SslStream &SslStream::operator=(SslStream &&) noexcept = default;
 SslStream::~SslStream() = default;
 
-Result<SslStream> SslStream::create(CSlice host, SslCtx ssl_ctx, bool use_ip_address_as_host) {
+Result<SslStream> SslStream::create(CSlice host, int port, SslCtx ssl_ctx, bool use_ip_address_as_host) {
   auto impl = make_unique<detail::SslStreamImpl>();
-  TRY_STATUS(impl->init(host, ssl_ctx, use_ip_address_as_host));
+  TRY_STATUS(impl->init(host, port, ssl_ctx, use_ip_address_as_host));
   return SslStream(std::move(impl));
 }
 SslStream::SslStream(unique_ptr<detail::SslStreamImpl> impl) : impl_(std::move(impl)) {
@@ -392,7 +416,7 @@ SslStream::SslStream(SslStream &&) noexcept = default;
 SslStream &SslStream::operator=(SslStream &&) noexcept = default;
 SslStream::~SslStream() = default;
 
-Result<SslStream> SslStream::create(CSlice host, SslCtx ssl_ctx, bool check_ip_address_as_host) {
+Result<SslStream> SslStream::create(CSlice host, int port, SslCtx ssl_ctx, bool check_ip_address_as_host) {
   return Status::Error("Not supported in Emscripten");
 }
 
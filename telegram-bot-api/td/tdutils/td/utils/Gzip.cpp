@@ -32,11 +32,13 @@ class Gzip::Impl {
   ~Impl() = default;
 };
 
-Status Gzip::init_encode() {
+Status Gzip::init_encode(int compression_level, bool gzip_format) {
   CHECK(mode_ == Mode::Empty);
+  CHECK(0 <= compression_level && compression_level <= 9);
   init_common();
   mode_ = Mode::Encode;
-  int ret = deflateInit2(&impl_->stream_, 6, Z_DEFLATED, 15, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+  int ret = deflateInit2(&impl_->stream_, compression_level, Z_DEFLATED, gzip_format ? 15 + 16 : 15, MAX_MEM_LEVEL,
+                         Z_DEFAULT_STRATEGY);
   if (ret != Z_OK) {
     return Status::Error(PSLICE() << "zlib deflate init failed: " << ret);
   }
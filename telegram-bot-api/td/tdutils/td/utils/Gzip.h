@@ -35,7 +35,8 @@ class Gzip {
     return Status::OK();
   }
 
-  Status init_encode() TD_WARN_UNUSED_RESULT;
+  // compression_level must be from 0 to 9; the zlib format is used unless gzip_format is true
+  Status init_encode(int compression_level = 6, bool gzip_format = false) TD_WARN_UNUSED_RESULT;
 
   Status init_decode() TD_WARN_UNUSED_RESULT;
 
@@ -26,8 +26,8 @@ class GzipByteFlow final : public ByteFlowBase {
     gzip_.init_decode().ensure();
   }
 
-  void init_encode() {
-    gzip_.init_encode().ensure();
+  void init_encode(int compression_level = 6, bool gzip_format = false) {
+    gzip_.init_encode(compression_level, gzip_format).ensure();
   }
 
   void set_max_output_size(size_t max_output_size) {
@@ -6,14 +6,110 @@
 //
 #include "td/utils/JsonBuilder.h"
 
+#include "td/utils/bits.h"
 #include "td/utils/misc.h"
 #include "td/utils/ScopeGuard.h"
 #include "td/utils/SliceBuilder.h"
 
 #include <cstring>
+#include <iterator>
+
+#if defined(__AVX2__)
+#define TD_AVX2 1
+#endif
+
+#if defined(__SSE2__) || (TD_MSVC && (defined(_M_X64) || (defined(_M_IX86) && _M_IX86_FP >= 2)))
+#define TD_SSE2 1
+#endif
+
+#if TD_AVX2
+#include <immintrin.h>
+#elif TD_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace td {
 
+static inline bool is_json_plain_char(char c, bool escape_non_ascii) {
+  auto ch = static_cast<unsigned char>(c);
+  return ch >= 0x20 && ch != '"' && ch != '\\' && (ch < 0x80 || !escape_non_ascii);
+}
+
+// returns length of the longest prefix of the string, which can be written to JSON as is
+static size_t get_json_plain_prefix_length(const char *s, size_t len, bool escape_non_ascii) {
+  size_t pos = 0;
+#if TD_AVX2
+  const __m256i quote32 = _mm256_set1_epi8('"');
+  const __m256i backslash32 = _mm256_set1_epi8('\\');
+  const __m256i max_control32 = _mm256_set1_epi8(0x1F);
+  for (; pos + 32 <= len; pos += 32) {
+    auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + pos));
+    auto special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote32), _mm256_cmpeq_epi8(chunk, backslash32));
+    if (escape_non_ascii) {
+      // bytes 0x00-0x1F and 0x80-0xFF are negative or not greater than 0x1F as signed integers
+      special = _mm256_or_si256(special, _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), chunk));
+    } else {
+      special = _mm256_or_si256(special, _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, max_control32), chunk));
+    }
+    auto mask = static_cast<uint32>(_mm256_movemask_epi8(special));
+    if (mask != 0) {
+      return pos + count_trailing_zeroes32(mask);
+    }
+  }
+#endif
+#if TD_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i max_control = _mm_set1_epi8(0x1F);
+  for (; pos + 16 <= len; pos += 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + pos));
+    auto special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+    if (escape_non_ascii) {
+      special = _mm_or_si128(special, _mm_cmplt_epi8(chunk, _mm_set1_epi8(0x20)));
+    } else {
+      special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, max_control), chunk));
+    }
+    auto mask = static_cast<uint32>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return pos + count_trailing_zeroes32(mask);
+    }
+  }
+#endif
+  while (pos < len && is_json_plain_char(s[pos], escape_non_ascii)) {
+    pos++;
+  }
+  return pos;
+}
+
+static void store_json_escaped_char(StringBuilder &sb, char c) {
+  switch (c) {
+    case '"':
+      sb << '\\' << '"';
+      break;
+    case '\\':
+      sb << '\\' << '\\';
+      break;
+    case '\b':
+      sb << '\\' << 'b';
+      break;
+    case '\f':
+      sb << '\\' << 'f';
+      break;
+    case '\n':
+      sb << '\\' << 'n';
+      break;
+    case '\r':
+      sb << '\\' << 'r';
+      break;
+    case '\t':
+      sb << '\\' << 't';
+      break;
+    default:
+      sb << JsonOneChar(static_cast<unsigned char>(c));
+      break;
+  }
+}
+
 StringBuilder &operator<<(StringBuilder &sb, const JsonRawString &val) {
   sb << '"';
   SCOPE_EXIT {
@@ -22,118 +118,133 @@ StringBuilder &operator<<(StringBuilder &sb, const JsonRawString &val) {
   auto *s = val.value_.begin();
   auto len = val.value_.size();
 
-  for (size_t pos = 0; pos < len; pos++) {
-    auto ch = static_cast<unsigned char>(s[pos]);
-    switch (ch) {
-      case '"':
-        sb << '\\' << '"';
-        break;
-      case '\\':
-        sb << '\\' << '\\';
-        break;
-      case '\b':
-        sb << '\\' << 'b';
-        break;
-      case '\f':
-        sb << '\\' << 'f';
-        break;
-      case '\n':
-        sb << '\\' << 'n';
-        break;
-      case '\r':
-        sb << '\\' << 'r';
-        break;
-      case '\t':
-        sb << '\\' << 't';
-        break;
-      default:
-        if (ch <= 31) {
-          sb << JsonOneChar(s[pos]);
-          break;
-        }
-        sb << s[pos];
-        break;
+  size_t pos = 0;
+  while (pos < len) {
+    if (is_json_plain_char(s[pos], false)) {
+      auto plain_length = get_json_plain_prefix_length(s + pos, len - pos, false);
+      sb << Slice(s + pos, plain_length);
+      pos += plain_length;
+      continue;
     }
+    store_json_escaped_char(sb, s[pos++]);
   }
   return sb;
 }
 
 StringBuilder &operator<<(StringBuilder &sb, const JsonString &val) {
+  val.store(sb, val.escape_non_ascii_);
+  return sb;
+}
+
+void JsonString::store(StringBuilder &sb, bool escape_non_ascii) const {
   sb << '"';
   SCOPE_EXIT {
     sb << '"';
   };
-  auto *s = val.str_.begin();
-  auto len = val.str_.size();
+  // the string is valid UTF-8, so it can be written as is if non-ASCII characters don't need to be escaped
+  auto *s = str_.begin();
+  auto len = str_.size();
+
+  size_t pos = 0;
+  while (pos < len) {
+    if (is_json_plain_char(s[pos], escape_non_ascii)) {
+      // copy the whole run of characters, which don't need escaping, at once
+      auto plain_length = get_json_plain_prefix_length(s + pos, len - pos, escape_non_ascii);
+      sb << Slice(s + pos, plain_length);
+      pos += plain_length;
+      continue;
+    }
 
-  for (size_t pos = 0; pos < len; pos++) {
     auto ch = static_cast<unsigned char>(s[pos]);
-    switch (ch) {
-      case '"':
-        sb << '\\' << '"';
-        break;
-      case '\\':
-        sb << '\\' << '\\';
-        break;
-      case '\b':
-        sb << '\\' << 'b';
-        break;
-      case '\f':
-        sb << '\\' << 'f';
-        break;
-      case '\n':
-        sb << '\\' << 'n';
-        break;
-      case '\r':
-        sb << '\\' << 'r';
-        break;
-      case '\t':
-        sb << '\\' << 't';
-        break;
-      default:
-        if (ch <= 31) {
-          sb << JsonOneChar(s[pos]);
-          break;
-        }
-        if (128 <= ch) {
-          uint32 a = ch;
-          CHECK((a & 0x40) != 0);
-
-          CHECK(pos + 1 < len);
-          uint32 b = static_cast<unsigned char>(s[++pos]);
-          CHECK((b & 0xc0) == 0x80);
-          if ((a & 0x20) == 0) {
-            CHECK((a & 0x1e) > 0);
-            sb << JsonChar(((a & 0x1f) << 6) | (b & 0x3f));
-            break;
-          }
+    if (ch < 128) {
+      store_json_escaped_char(sb, s[pos++]);
+      continue;
+    }
 
-          CHECK(pos + 1 < len);
-          uint32 c = static_cast<unsigned char>(s[++pos]);
-          CHECK((c & 0xc0) == 0x80);
-          if ((a & 0x10) == 0) {
-            CHECK(((a & 0x0f) | (b & 0x20)) > 0);
-            sb << JsonChar(((a & 0x0f) << 12) | ((b & 0x3f) << 6) | (c & 0x3f));
-            break;
-          }
+    uint32 a = ch;
+    CHECK((a & 0x40) != 0);
+
+    CHECK(pos + 1 < len);
+    uint32 b = static_cast<unsigned char>(s[++pos]);
+    CHECK((b & 0xc0) == 0x80);
+    if ((a & 0x20) == 0) {
+      CHECK((a & 0x1e) > 0);
+      sb << JsonChar(((a & 0x1f) << 6) | (b & 0x3f));
+      pos++;
+      continue;
+    }
 
-          CHECK(pos + 1 < len);
-          uint32 d = static_cast<unsigned char>(s[++pos]);
-          CHECK((d & 0xc0) == 0x80);
-          if ((a & 0x08) == 0) {
-            CHECK(((a & 0x07) | (b & 0x30)) > 0);
-            sb << JsonChar(((a & 0x07) << 18) | ((b & 0x3f) << 12) | ((c & 0x3f) << 6) | (d & 0x3f));
-            break;
-          }
+    CHECK(pos + 1 < len);
+    uint32 c = static_cast<unsigned char>(s[++pos]);
+    CHECK((c & 0xc0) == 0x80);
+    if ((a & 0x10) == 0) {
+      CHECK(((a & 0x0f) | (b & 0x20)) > 0);
+      sb << JsonChar(((a & 0x0f) << 12) | ((b & 0x3f) << 6) | (c & 0x3f));
+      pos++;
+      continue;
+    }
 
-          UNREACHABLE();
-          break;
-        }
-        sb << s[pos];
-        break;
+    CHECK(pos + 1 < len);
+    uint32 d = static_cast<unsigned char>(s[++pos]);
+    CHECK((d & 0xc0) == 0x80);
+    if ((a & 0x08) == 0) {
+      CHECK(((a & 0x07) | (b & 0x30)) > 0);
+      sb << JsonChar(((a & 0x07) << 18) | ((b & 0x3f) << 12) | ((c & 0x3f) << 6) | (d & 0x3f));
+      pos++;
+      continue;
     }
+
+    UNREACHABLE();
+  }
+}
+
+// returns pointer to the first '"' or '\\' in the range or end if there is none
+static const char *find_json_string_special(const char *begin, const char *end) {
+  auto *cur = begin;
+#if TD_AVX2
+  const __m256i quote32 = _mm256_set1_epi8('"');
+  const __m256i backslash32 = _mm256_set1_epi8('\\');
+  for (; end - cur >= 32; cur += 32) {
+    auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cur));
+    auto special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote32), _mm256_cmpeq_epi8(chunk, backslash32));
+    auto mask = static_cast<uint32>(_mm256_movemask_epi8(special));
+    if (mask != 0) {
+      return cur + count_trailing_zeroes32(mask);
+    }
+  }
+#endif
+#if TD_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; end - cur >= 16; cur += 16) {
+    auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur));
+    auto special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+    auto mask = static_cast<uint32>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return cur + count_trailing_zeroes32(mask);
+    }
+  }
+#endif
+  while (cur < end && *cur != '"' && *cur != '\\') {
+    cur++;
+  }
+  return cur;
+}
+
+// returns pointer to the closing '"' of a string or end if there is none
+static const char *find_json_string_end(const char *begin, const char *end, bool &has_escapes) {
+  auto *cur = begin;
+  while (true) {
+    cur = find_json_string_special(cur, end);
+    if (cur == end || *cur == '"') {
+      return cur;
+    }
+    has_escapes = true;
+    if (end - cur <= 2) {
+      return end;
+    }
+    cur += 2;
   }
-  return sb;
 }
 
 Result<MutableSlice> json_string_decode(Parser &parser) {
@@ -142,17 +253,16 @@ Result<MutableSlice> json_string_decode(Parser &parser) {
   }
   auto *cur_src = parser.data().data();
   auto *end_src = parser.data().end();
-  auto *end = cur_src;
-  while (end < end_src && end[0] != '"') {
-    if (end[0] == '\\') {
-      end++;
-    }
-    end++;
-  }
+  bool has_escapes = false;
+  auto *end = cur_src + (find_json_string_end(cur_src, end_src, has_escapes) - cur_src);
   if (end >= end_src) {
     return Status::Error("Closing '\"' not found");
   }
   parser.advance(end + 1 - cur_src);
+  if (!has_escapes) {
+    // the string can be used in place
+    return MutableSlice(cur_src, end);
+  }
   end_src = end;
 
   auto *cur_dest = cur_src;
@@ -261,17 +371,15 @@ Status json_string_skip(Parser &parser) {
   auto *begin_src = parser.data().data();
   auto *cur_src = begin_src;
   auto *end_src = parser.data().end();
-  auto *end = cur_src;
-  while (end < end_src && *end != '"') {
-    if (*end == '\\') {
-      end++;
-    }
-    end++;
-  }
+  bool has_escapes = false;
+  auto *end = cur_src + (find_json_string_end(cur_src, end_src, has_escapes) - cur_src);
   if (end >= end_src) {
     return Status::Error("Closing '\"' not found");
   }
   parser.advance(end + 1 - cur_src);
+  if (!has_escapes) {
+    return Status::OK();
+  }
   end_src = end;
 
   while (cur_src != end_src) {
@@ -336,7 +444,16 @@ Status json_string_skip(Parser &parser) {
   return Status::OK();
 }
 
-Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
+namespace {
+// elements of all arrays and objects being parsed; each array and object is moved to its own vector
+// with exactly one allocation after all its elements are parsed
+struct JsonDecodeStacks {
+  JsonArray values;
+  JsonObject members;
+};
+}  // namespace
+
+static Result<JsonValue> do_json_decode_impl(Parser &parser, int32 max_depth, JsonDecodeStacks &stacks) {
   if (max_depth < 0) {
     return Status::Error("Too big object depth");
   }
@@ -365,16 +482,16 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
     case '[': {
       parser.skip('[');
       parser.skip_whitespaces();
-      std::vector<JsonValue> res;
       if (parser.try_skip(']')) {
-        return JsonValue::create_array(std::move(res));
+        return JsonValue::create_array(JsonArray());
       }
+      auto first_value = stacks.values.size();
       while (true) {
         if (parser.empty()) {
           return Status::Error("Unexpected string end");
         }
-        TRY_RESULT(value, do_json_decode(parser, max_depth - 1));
-        res.emplace_back(std::move(value));
+        TRY_RESULT(value, do_json_decode_impl(parser, max_depth - 1, stacks));
+        stacks.values.push_back(std::move(value));
 
         parser.skip_whitespaces();
         if (parser.try_skip(']')) {
@@ -389,15 +506,18 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
         }
         return Status::Error("Unexpected symbol while parsing JSON Array");
       }
+      auto values_begin = stacks.values.begin() + first_value;
+      JsonArray res(std::make_move_iterator(values_begin), std::make_move_iterator(stacks.values.end()));
+      stacks.values.erase(values_begin, stacks.values.end());
       return JsonValue::create_array(std::move(res));
     }
     case '{': {
       parser.skip('{');
       parser.skip_whitespaces();
-      std::vector<std::pair<MutableSlice, JsonValue>> res;
       if (parser.try_skip('}')) {
-        return JsonValue::make_object(std::move(res));
+        return JsonValue::make_object(JsonObject());
       }
+      auto first_member = stacks.members.size();
       while (true) {
         if (parser.empty()) {
           return Status::Error("Unexpected string end");
@@ -407,8 +527,8 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
         if (!parser.try_skip(':')) {
           return Status::Error("':' expected");
         }
-        TRY_RESULT(value, do_json_decode(parser, max_depth - 1));
-        res.emplace_back(key, std::move(value));
+        TRY_RESULT(value, do_json_decode_impl(parser, max_depth - 1, stacks));
+        stacks.members.emplace_back(key, std::move(value));
 
         parser.skip_whitespaces();
         if (parser.try_skip('}')) {
@@ -423,6 +543,9 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
         }
         return Status::Error("Unexpected symbol while parsing JSON Object");
       }
+      auto members_begin = stacks.members.begin() + first_member;
+      JsonObject res(std::make_move_iterator(members_begin), std::make_move_iterator(stacks.members.end()));
+      stacks.members.erase(members_begin, stacks.members.end());
       return JsonValue::make_object(std::move(res));
     }
     case '-':
@@ -456,6 +579,11 @@ Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
   UNREACHABLE();
 }
 
+Result<JsonValue> do_json_decode(Parser &parser, int32 max_depth) {
+  JsonDecodeStacks stacks;
+  return do_json_decode_impl(parser, max_depth, stacks);
+}
+
 Status do_json_skip(Parser &parser, int32 max_depth) {
   if (max_depth < 0) {
     return Status::Error("Too big object depth");
@@ -6,6 +6,7 @@
 //
 #pragma once
 
+#include "td/utils/buffer.h"
 #include "td/utils/common.h"
 #include "td/utils/logging.h"
 #include "td/utils/Parser.h"
@@ -156,13 +157,19 @@ class JsonRawString {
 
 class JsonString {
  public:
-  explicit JsonString(Slice str) : str_(str) {
+  // if escape_non_ascii is false, then non-ASCII characters are written as is instead of \uXXXX escapes
+  explicit JsonString(Slice str, bool escape_non_ascii = true) : str_(str), escape_non_ascii_(escape_non_ascii) {
   }
 
   friend StringBuilder &operator<<(StringBuilder &sb, const JsonString &val);
 
  private:
+  friend class JsonScope;
+
   Slice str_;
+  bool escape_non_ascii_;
+
+  void store(StringBuilder &sb, bool escape_non_ascii) const;
 };
 
 class JsonScope;
@@ -208,10 +215,20 @@ class JsonBuilder {
     }
   }
 
+  // if disabled, then non-ASCII characters in all strings are written as is instead of \uXXXX escapes;
+  // enabled by default
+  void set_escape_non_ascii(bool escape_non_ascii) {
+    escape_non_ascii_ = escape_non_ascii;
+  }
+  bool escape_non_ascii() const {
+    return escape_non_ascii_;
+  }
+
  private:
   StringBuilder sb_;
   JsonScope *scope_ = nullptr;
   int32 offset_;
+  bool escape_non_ascii_ = true;
 };
 
 class Jsonable {};
@@ -278,7 +295,7 @@ class JsonScope {
     return *this;
   }
   JsonScope &operator<<(const JsonString &x) {
-    *sb_ << x;
+    x.store(*sb_, x.escape_non_ascii_ && jb_->escape_non_ascii());
     return *this;
   }
   JsonScope &operator<<(const JsonRawString &x) {
@@ -752,10 +769,11 @@ inline Result<JsonValue> json_decode(MutableSlice json) {
 }
 
 template <class StrT, class ValT>
-StrT json_encode(const ValT &val, bool pretty = false) {
+StrT json_encode(const ValT &val, bool pretty = false, bool escape_non_ascii = true) {
   auto buf_len = 1 << 18;
   auto buf = StackAllocator::alloc(buf_len);
   JsonBuilder jb(StringBuilder(buf.as_slice(), true), pretty ? 0 : -1);
+  jb.set_escape_non_ascii(escape_non_ascii);
   jb.enter_value() << val;
   if (pretty) {
     jb.string_builder() << "\n";
@@ -765,6 +783,39 @@ StrT json_encode(const ValT &val, bool pretty = false) {
   return StrT(slice.begin(), slice.size());
 }
 
+// calls f(JsonBuilder &) to write JSON directly into a buffer of size_hint bytes, which becomes the result;
+// the result is copied only if it doesn't fit into the buffer, and then the number of copied bytes is added to
+// copied_size
+template <class F>
+BufferSlice json_build_buffer(size_t size_hint, size_t &copied_size, F &&f, int32 offset = -1) {
+  BufferSlice buffer(max(size_hint, static_cast<size_t>(128)));
+  JsonBuilder jb(StringBuilder(buffer.as_mutable_slice(), true), offset);
+  f(jb);
+  LOG_IF(ERROR, jb.string_builder().is_error()) << "JSON buffer overflow";
+  auto slice = jb.string_builder().as_cslice();
+  if (slice.begin() == buffer.as_slice().begin()) {
+    buffer.truncate(slice.size());
+    return buffer;
+  }
+  copied_size += slice.size();
+  return BufferSlice(slice);
+}
+
+template <class ValT>
+BufferSlice json_encode_buffer(const ValT &val, size_t size_hint, size_t &copied_size, bool pretty = false,
+                               bool escape_non_ascii = true) {
+  return json_build_buffer(
+      size_hint, copied_size,
+      [&val, pretty, escape_non_ascii](JsonBuilder &jb) {
+        jb.set_escape_non_ascii(escape_non_ascii);
+        jb.enter_value() << val;
+        if (pretty) {
+          jb.string_builder() << "\n";
+        }
+      },
+      pretty ? 0 : -1);
+}
+
 template <class T>
 class ToJsonImpl final : private Jsonable {
  public:
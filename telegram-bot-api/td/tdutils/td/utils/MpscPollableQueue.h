@@ -73,6 +73,12 @@ class MpscPollableQueue {
     return writer_vector_.empty() && reader_vector_.empty();
   }
 
+  // returns the number of values, which weren't taken by the reader yet; can be called from any thread
+  size_t get_unread_count() {
+    auto guard = lock_.lock();
+    return writer_vector_.size();
+  }
+
   void init() {
     event_fd_.init();
   }
@@ -144,6 +150,11 @@ class MpscPollableQueue {
     UNREACHABLE();
   }
 
+  size_t get_unread_count() {
+    UNREACHABLE();
+    return 0;
+  }
+
   MpscPollableQueue() = default;
   MpscPollableQueue(const MpscPollableQueue &) = delete;
   MpscPollableQueue &operator=(const MpscPollableQueue &) = delete;
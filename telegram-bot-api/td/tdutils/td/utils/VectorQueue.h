@@ -9,6 +9,7 @@
 #include "td/utils/common.h"
 #include "td/utils/Span.h"
 
+#include <iterator>
 #include <utility>
 
 namespace td {
@@ -43,6 +44,10 @@ class VectorQueue {
     try_shrink();
   }
 
+  void pop_back() {
+    vector_.pop_back();
+  }
+
   const T &front() const {
     return vector_[read_pos_];
   }
@@ -65,6 +70,18 @@ class VectorQueue {
     return vector_.size() - read_pos_;
   }
 
+  // returns number of elements, for which memory is allocated, including already popped elements
+  size_t capacity() const {
+    return vector_.capacity();
+  }
+
+  // vector::shrink_to_fit does nothing if exceptions are disabled, so the elements are moved to a new vector
+  void shrink_to_fit() {
+    vector<T>(std::make_move_iterator(vector_.begin() + read_pos_), std::make_move_iterator(vector_.end()))
+        .swap(vector_);
+    read_pos_ = 0;
+  }
+
   const T *data() const {
     return vector_.data() + read_pos_;
   }
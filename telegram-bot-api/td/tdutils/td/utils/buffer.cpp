@@ -55,6 +55,10 @@ BufferAllocator::ReaderPtr BufferAllocator::create_reader(size_t size) {
   if (size < 512) {
     return create_reader_fast(size);
   }
+  return create_reader_exact(size);
+}
+
+BufferAllocator::ReaderPtr BufferAllocator::create_reader_exact(size_t size) {
   auto ptr = create_writer_exact(size);
   ptr->end_ += (size + 7) & -8;
   return create_reader(ptr);
@@ -79,6 +79,8 @@ class BufferAllocator {
 
   static ReaderPtr create_reader_fast(size_t size);
 
+  static ReaderPtr create_reader_exact(size_t size);
+
   static WriterPtr create_writer_exact(size_t size);
 
   struct BufferRawDeleter {
@@ -216,6 +218,19 @@ class BufferSlice {
     }
   }
 
+  // moves the data to a buffer of its own if the current buffer has more than max_unused_size other bytes,
+  // so a long-living slice doesn't keep alive memory, which it doesn't use
+  void shrink_to_fit(size_t max_unused_size) {
+    if (is_null() || buffer_->data_size_ - size() <= max_unused_size) {
+      return;
+    }
+    auto data_size = size();
+    BufferSlice result(BufferAllocator::create_reader_exact(data_size));
+    result.truncate(data_size);
+    result.as_mutable_slice().copy_from(as_slice());
+    *this = std::move(result);
+  }
+
   BufferSlice from_slice(Slice slice) const {
     auto res = BufferSlice(BufferAllocator::create_reader(buffer_));
     res.debug_untrack();
@@ -9,6 +9,7 @@
 #include "td/utils/port/config.h"
 
 #include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/detail/EpollOrIoUring.h"
 #include "td/utils/port/detail/KQueue.h"
 #include "td/utils/port/detail/Poll.h"
 #include "td/utils/port/detail/Select.h"
@@ -18,7 +19,9 @@ namespace td {
 
 // clang-format off
 
-#if TD_POLL_EPOLL
+#if TD_POLL_IO_URING
+  using Poll = detail::EpollOrIoUring;
+#elif TD_POLL_EPOLL
   using Poll = detail::Epoll;
 #elif TD_POLL_KQUEUE
   using Poll = detail::KQueue;
@@ -32,4 +35,14 @@ namespace td {
 
 // clang-format on
 
+// makes Poll instances initialized after the call use io_uring instead of epoll, if it is supported by the kernel
+// returns whether io_uring will be used
+inline bool set_poll_use_io_uring(bool use_io_uring) {
+#if TD_POLL_IO_URING
+  return detail::EpollOrIoUring::set_use_io_uring(use_io_uring);
+#else
+  return false;
+#endif
+}
+
 }  // namespace td
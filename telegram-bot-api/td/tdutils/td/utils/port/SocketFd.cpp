@@ -33,6 +33,10 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+
+#if TD_LINUX || TD_ANDROID
+#include <sys/sendfile.h>
+#endif
 #endif
 
 #include <atomic>
@@ -456,6 +460,37 @@ class SocketFdImpl {
     return write_finish();
   }
 
+  Result<size_t> send_file(const NativeFd &file_fd, int64 offset, size_t size) {
+    int native_fd = get_native_fd().socket();
+    auto file_offset = static_cast<off_t>(offset);
+#if TD_LINUX || TD_ANDROID
+    auto write_res =
+        detail::skip_eintr([&] { return ::sendfile(native_fd, file_fd.fd(), &file_offset, size); });
+    if (write_res >= 0) {
+      auto result = narrow_cast<size_t>(write_res);
+      LOG_CHECK(result <= size) << "Receive " << write_res << " as sendfile response, but tried to write only " << size
+                                << " bytes";
+      return result;
+    }
+    auto sendfile_errno = errno;
+    if (sendfile_errno == EINVAL || sendfile_errno == ENOSYS || sendfile_errno == EOVERFLOW) {
+      return Status::PosixError(sendfile_errno, PSLICE() << "Failed to send file " << file_fd);
+    }
+    return write_finish();
+#else
+    char buf[1 << 14];
+    auto read_res = detail::skip_eintr(
+        [&] { return ::pread(file_fd.fd(), buf, static_cast<size_t>(min(size, sizeof(buf))), file_offset); });
+    if (read_res < 0) {
+      return OS_ERROR(PSLICE() << "Read from " << file_fd << " has failed");
+    }
+    if (read_res == 0) {
+      return 0;
+    }
+    return write(Slice(buf, static_cast<size_t>(read_res)));
+#endif
+  }
+
   Result<size_t> write_finish() {
     auto write_errno = errno;
     if (write_errno == EAGAIN
@@ -701,4 +736,11 @@ Result<size_t> SocketFd::read(MutableSlice slice) {
   return impl_->read(slice);
 }
 
+#if TD_PORT_POSIX
+Result<size_t> SocketFd::send_file(const NativeFd &file_fd, int64 offset, size_t size) {
+  CHECK(!empty());
+  return impl_->send_file(file_fd, offset, size);
+}
+#endif
+
 }  // namespace td
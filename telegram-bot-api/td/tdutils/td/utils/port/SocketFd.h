@@ -48,6 +48,11 @@ class SocketFd {
   Result<size_t> writev(Span<IoSlice> slices) TD_WARN_UNUSED_RESULT;
   Result<size_t> read(MutableSlice slice) TD_WARN_UNUSED_RESULT;
 
+#if TD_PORT_POSIX
+  // writes up to size bytes of the file starting from the offset without copying them to user space if possible
+  Result<size_t> send_file(const NativeFd &file_fd, int64 offset, size_t size) TD_WARN_UNUSED_RESULT;
+#endif
+
   const NativeFd &get_native_fd() const;
   static Result<SocketFd> from_native_fd(NativeFd fd);
 
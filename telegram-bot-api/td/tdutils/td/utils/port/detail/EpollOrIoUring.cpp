@@ -0,0 +1,81 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/utils/port/detail/EpollOrIoUring.h"
+
+char disable_linker_warning_about_empty_file_epoll_or_io_uring_cpp TD_UNUSED;
+
+#ifdef TD_POLL_IO_URING
+
+#include <atomic>
+#include <utility>
+
+namespace td {
+namespace detail {
+
+static std::atomic<bool> use_io_uring_poll{false};
+
+bool EpollOrIoUring::set_use_io_uring(bool use_io_uring) {
+  use_io_uring = use_io_uring && IoUring::is_supported();
+  use_io_uring_poll.store(use_io_uring, std::memory_order_relaxed);
+  return use_io_uring;
+}
+
+void EpollOrIoUring::init() {
+  CHECK(io_uring_ == nullptr);
+  if (use_io_uring_poll.load(std::memory_order_relaxed)) {
+    io_uring_ = make_unique<IoUring>();
+    io_uring_->init();
+  } else {
+    epoll_.init();
+  }
+}
+
+void EpollOrIoUring::clear() {
+  if (io_uring_ != nullptr) {
+    io_uring_->clear();
+    io_uring_ = nullptr;
+  } else {
+    epoll_.clear();
+  }
+}
+
+void EpollOrIoUring::subscribe(PollableFd fd, PollFlags flags) {
+  if (io_uring_ != nullptr) {
+    io_uring_->subscribe(std::move(fd), flags);
+  } else {
+    epoll_.subscribe(std::move(fd), flags);
+  }
+}
+
+void EpollOrIoUring::unsubscribe(PollableFdRef fd) {
+  if (io_uring_ != nullptr) {
+    io_uring_->unsubscribe(std::move(fd));
+  } else {
+    epoll_.unsubscribe(std::move(fd));
+  }
+}
+
+void EpollOrIoUring::unsubscribe_before_close(PollableFdRef fd) {
+  if (io_uring_ != nullptr) {
+    io_uring_->unsubscribe_before_close(std::move(fd));
+  } else {
+    epoll_.unsubscribe_before_close(std::move(fd));
+  }
+}
+
+void EpollOrIoUring::run(int timeout_ms) {
+  if (io_uring_ != nullptr) {
+    io_uring_->run(timeout_ms);
+  } else {
+    epoll_.run(timeout_ms);
+  }
+}
+
+}  // namespace detail
+}  // namespace td
+
+#endif
@@ -0,0 +1,60 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/port/config.h"
+
+#include "td/utils/port/detail/Epoll.h"
+#include "td/utils/port/detail/IoUring.h"
+
+#ifdef TD_POLL_IO_URING
+
+#include "td/utils/common.h"
+#include "td/utils/port/detail/PollableFd.h"
+#include "td/utils/port/PollBase.h"
+#include "td/utils/port/PollFlags.h"
+
+namespace td {
+namespace detail {
+
+// uses io_uring if it was enabled and is supported by the kernel, and epoll otherwise
+class EpollOrIoUring final : public PollBase {
+ public:
+  EpollOrIoUring() = default;
+  EpollOrIoUring(const EpollOrIoUring &) = delete;
+  EpollOrIoUring &operator=(const EpollOrIoUring &) = delete;
+  EpollOrIoUring(EpollOrIoUring &&) = delete;
+  EpollOrIoUring &operator=(EpollOrIoUring &&) = delete;
+  ~EpollOrIoUring() final = default;
+
+  static bool set_use_io_uring(bool use_io_uring);
+
+  void init() final;
+
+  void clear() final;
+
+  void subscribe(PollableFd fd, PollFlags flags) final;
+
+  void unsubscribe(PollableFdRef fd) final;
+
+  void unsubscribe_before_close(PollableFdRef fd) final;
+
+  void run(int timeout_ms) final;
+
+  static bool is_edge_triggered() {
+    return true;
+  }
+
+ private:
+  Epoll epoll_;
+  unique_ptr<IoUring> io_uring_;
+};
+
+}  // namespace detail
+}  // namespace td
+
+#endif
@@ -0,0 +1,303 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "td/utils/port/detail/IoUring.h"
+
+char disable_linker_warning_about_empty_file_io_uring_cpp TD_UNUSED;
+
+#ifdef TD_POLL_IO_URING
+
+#include "td/utils/logging.h"
+#include "td/utils/misc.h"
+#include "td/utils/Status.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace td {
+namespace detail {
+
+static constexpr uint32 IO_URING_REQUIRED_FEATURES =
+    IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+
+static int io_uring_setup(uint32 entries, io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, uint32 to_submit, uint32 min_complete, uint32 flags,
+                          const io_uring_getevents_arg *arg) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, sizeof(io_uring_getevents_arg)));
+}
+
+IoUring::~IoUring() {
+  clear();
+}
+
+bool IoUring::is_supported() {
+  static const bool is_supported = [] {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    NativeFd ring_fd(io_uring_setup(4, &params));
+    return ring_fd && (params.features & IO_URING_REQUIRED_FEATURES) == IO_URING_REQUIRED_FEATURES;
+  }();
+  return is_supported;
+}
+
+void IoUring::init() {
+  CHECK(!ring_fd_);
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = COMPLETION_QUEUE_SIZE;
+  ring_fd_ = NativeFd(io_uring_setup(SUBMISSION_QUEUE_SIZE, &params));
+  auto io_uring_setup_errno = errno;
+  LOG_IF(FATAL, !ring_fd_) << Status::PosixError(io_uring_setup_errno, "io_uring_setup failed");
+  LOG_IF(FATAL, (params.features & IO_URING_REQUIRED_FEATURES) != IO_URING_REQUIRED_FEATURES)
+      << "Unsupported io_uring features: " << params.features;
+
+  ring_size_ = max(params.sq_off.array + params.sq_entries * sizeof(uint32),
+                   params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_.fd(),
+               IORING_OFF_SQ_RING);
+  auto ring_mmap_errno = errno;
+  LOG_IF(FATAL, ring_ == MAP_FAILED) << Status::PosixError(ring_mmap_errno, "io_uring ring mmap failed");
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_.fd(),
+                   IORING_OFF_SQES);
+  auto sqes_mmap_errno = errno;
+  LOG_IF(FATAL, sqes == MAP_FAILED) << Status::PosixError(sqes_mmap_errno, "io_uring submission queue mmap failed");
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  auto *ring = static_cast<char *>(ring_);
+  sq_head_ = reinterpret_cast<uint32 *>(ring + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<uint32 *>(ring + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<uint32 *>(ring + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<uint32 *>(ring + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_local_tail_ = *sq_tail_;
+  pending_submit_count_ = 0;
+
+  cq_head_ = reinterpret_cast<uint32 *>(ring + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32 *>(ring + params.cq_off.tail);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+  cq_mask_ = *reinterpret_cast<uint32 *>(ring + params.cq_off.ring_mask);
+}
+
+void IoUring::clear() {
+  if (!ring_fd_) {
+    return;
+  }
+  munmap(sqes_, sqes_size_);
+  sqes_ = nullptr;
+  munmap(ring_, ring_size_);
+  ring_ = nullptr;
+
+  // closing of the ring cancels all its requests
+  ring_fd_.close();
+
+  subscriptions_.clear();
+  free_subscription_ids_.clear();
+  fd_to_subscription_id_.clear();
+  for (auto *list_node = list_root_.next; list_node != &list_root_;) {
+    auto pollable_fd = PollableFd::from_list_node(list_node);
+    list_node = list_node->next;
+  }
+}
+
+uint64 IoUring::get_user_data(uint32 subscription_id, uint32 generation) {
+  return (static_cast<uint64>(generation) << 32) | subscription_id;
+}
+
+io_uring_sqe *IoUring::get_sqe() {
+  if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    // the submission queue is full; submit it without waiting for completions
+    enter(0, nullptr);
+    CHECK(sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) < sq_entries_);
+  }
+  auto index = sq_local_tail_ & sq_mask_;
+  auto *sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  sq_local_tail_++;
+  pending_submit_count_++;
+  return sqe;
+}
+
+void IoUring::enter(uint32 min_complete, const __kernel_timespec *timeout) {
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.ts = reinterpret_cast<uint64>(timeout);
+  int err = io_uring_enter(ring_fd_.fd(), pending_submit_count_, min_complete,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+  auto io_uring_enter_errno = errno;
+  // the kernel may have consumed only some of the requests, if it failed to allocate memory for them
+  pending_submit_count_ = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  LOG_IF(FATAL, err == -1 && io_uring_enter_errno != EINTR && io_uring_enter_errno != ETIME &&
+                    io_uring_enter_errno != EBUSY && io_uring_enter_errno != EAGAIN)
+      << Status::PosixError(io_uring_enter_errno, "io_uring_enter failed");
+}
+
+void IoUring::add_poll(uint32 subscription_id) {
+  const auto &subscription = subscriptions_[subscription_id];
+  auto poll_events = subscription.poll_events;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  poll_events = (poll_events << 16) | (poll_events >> 16);
+#endif
+
+  auto *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = subscription.native_fd;
+  sqe->poll32_events = poll_events;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = get_user_data(subscription_id, subscription.generation);
+}
+
+void IoUring::subscribe(PollableFd fd, PollFlags flags) {
+  uint32 poll_events = POLLHUP | POLLERR;
+#ifdef POLLRDHUP
+  poll_events |= POLLRDHUP;
+#endif
+  if (flags.can_read()) {
+    poll_events |= POLLIN;
+  }
+  if (flags.can_write()) {
+    poll_events |= POLLOUT;
+  }
+  auto native_fd = fd.native_fd().fd();
+  CHECK(native_fd >= 0);
+  auto *list_node = fd.release_as_list_node();
+  list_root_.put(list_node);
+
+  uint32 subscription_id;
+  if (free_subscription_ids_.empty()) {
+    subscription_id = narrow_cast<uint32>(subscriptions_.size());
+    subscriptions_.emplace_back();
+  } else {
+    subscription_id = free_subscription_ids_.back();
+    free_subscription_ids_.pop_back();
+  }
+  auto &subscription = subscriptions_[subscription_id];
+  subscription.list_node = list_node;
+  subscription.native_fd = native_fd;
+  subscription.poll_events = poll_events;
+
+  auto fd_index = static_cast<size_t>(native_fd);
+  if (fd_index >= fd_to_subscription_id_.size()) {
+    fd_to_subscription_id_.resize(max(fd_index + 1, 2 * fd_to_subscription_id_.size()), 0);
+  }
+  LOG_CHECK(fd_to_subscription_id_[fd_index] == 0) << native_fd;
+  fd_to_subscription_id_[fd_index] = subscription_id + 1;
+
+  add_poll(subscription_id);
+}
+
+void IoUring::unsubscribe(PollableFdRef fd_ref) {
+  auto fd = fd_ref.lock();
+  auto native_fd = fd.native_fd().fd();
+  auto fd_index = static_cast<size_t>(native_fd);
+  LOG_CHECK(fd_index < fd_to_subscription_id_.size() && fd_to_subscription_id_[fd_index] != 0) << native_fd;
+  auto subscription_id = fd_to_subscription_id_[fd_index] - 1;
+  fd_to_subscription_id_[fd_index] = 0;
+
+  // the request is removed by the next system call; until then its completions are ignored,
+  // because the subscription generation changes
+  auto &subscription = subscriptions_[subscription_id];
+  auto *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = get_user_data(subscription_id, subscription.generation);
+  sqe->user_data = REMOVE_USER_DATA;
+
+  subscription.list_node = nullptr;
+  subscription.native_fd = -1;
+  subscription.generation++;
+  free_subscription_ids_.push_back(subscription_id);
+}
+
+void IoUring::unsubscribe_before_close(PollableFdRef fd) {
+  unsubscribe(fd);
+}
+
+void IoUring::run(int timeout_ms) {
+  if (timeout_ms == 0 || __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_) {
+    enter(0, nullptr);
+  } else if (timeout_ms < 0) {
+    enter(1, nullptr);
+  } else {
+    __kernel_timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = timeout_ms % 1000 * 1000000;
+    enter(1, &timeout);
+  }
+
+  process_completions();
+}
+
+void IoUring::process_completions() {
+  auto head = *cq_head_;
+  auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const auto *cqe = &cqes_[head & cq_mask_];
+    if (cqe->user_data == REMOVE_USER_DATA) {
+      continue;
+    }
+    auto subscription_id = static_cast<uint32>(cqe->user_data);
+    auto generation = static_cast<uint32>(cqe->user_data >> 32);
+    CHECK(subscription_id < subscriptions_.size());
+    const auto &subscription = subscriptions_[subscription_id];
+    if (subscription.generation != generation) {
+      // the subscription has already been removed
+      continue;
+    }
+    CHECK(subscription.list_node != nullptr);
+
+    PollFlags flags;
+    if (cqe->res < 0) {
+      LOG(ERROR) << Status::PosixError(-cqe->res, "io_uring poll failed") << ", fd = " << subscription.native_fd;
+      flags = PollFlags::Error();
+    } else {
+      if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+        // the multishot request was terminated by the kernel, for example, because of a completion queue overflow
+        add_poll(subscription_id);
+      }
+      auto events = static_cast<uint32>(cqe->res);
+      if (events & POLLIN) {
+        flags = flags | PollFlags::Read();
+      }
+      if (events & POLLOUT) {
+        flags = flags | PollFlags::Write();
+      }
+#ifdef POLLRDHUP
+      if (events & POLLRDHUP) {
+        flags = flags | PollFlags::Close();
+      }
+#endif
+      if (events & POLLHUP) {
+        flags = flags | PollFlags::Close();
+      }
+      if (events & POLLERR) {
+        flags = flags | PollFlags::Error();
+      }
+    }
+    auto pollable_fd = PollableFd::from_list_node(subscription.list_node);
+    pollable_fd.add_flags(flags);
+    pollable_fd.release_as_list_node();
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+}  // namespace detail
+}  // namespace td
+
+#endif
@@ -0,0 +1,117 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/utils/port/config.h"
+
+#if TD_POLL_EPOLL && TD_LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+// multishot poll requests were added in Linux 5.13 together with IORING_FEAT_RSRC_TAGS
+#if defined(IORING_POLL_ADD_MULTI) && defined(IORING_FEAT_RSRC_TAGS) && defined(__NR_io_uring_setup)
+#define TD_POLL_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef TD_POLL_IO_URING
+
+#include "td/utils/common.h"
+#include "td/utils/List.h"
+#include "td/utils/port/detail/NativeFd.h"
+#include "td/utils/port/detail/PollableFd.h"
+#include "td/utils/port/PollBase.h"
+#include "td/utils/port/PollFlags.h"
+
+namespace td {
+namespace detail {
+
+// edge-triggered poll over multishot IORING_OP_POLL_ADD requests
+// subscriptions and unsubscriptions are queued in the submission ring and are submitted
+// together with waiting for events, so a whole event loop iteration costs a single system call
+class IoUring final : public PollBase {
+ public:
+  IoUring() = default;
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+  IoUring(IoUring &&) = delete;
+  IoUring &operator=(IoUring &&) = delete;
+  ~IoUring() final;
+
+  // returns true if the kernel supports all io_uring features needed by the class
+  static bool is_supported();
+
+  void init() final;
+
+  void clear() final;
+
+  void subscribe(PollableFd fd, PollFlags flags) final;
+
+  void unsubscribe(PollableFdRef fd) final;
+
+  void unsubscribe_before_close(PollableFdRef fd) final;
+
+  void run(int timeout_ms) final;
+
+  static bool is_edge_triggered() {
+    return true;
+  }
+
+ private:
+  static constexpr uint32 SUBMISSION_QUEUE_SIZE = 1024;
+  static constexpr uint32 COMPLETION_QUEUE_SIZE = 8192;
+  static constexpr uint64 REMOVE_USER_DATA = static_cast<uint64>(-1);
+
+  struct Subscription {
+    ListNode *list_node = nullptr;
+    int native_fd = -1;
+    uint32 generation = 0;
+    uint32 poll_events = 0;
+  };
+
+  NativeFd ring_fd_;
+  void *ring_ = nullptr;
+  size_t ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  uint32 *sq_head_ = nullptr;
+  uint32 *sq_tail_ = nullptr;
+  uint32 *sq_array_ = nullptr;
+  uint32 sq_mask_ = 0;
+  uint32 sq_entries_ = 0;
+  uint32 sq_local_tail_ = 0;
+  uint32 pending_submit_count_ = 0;
+
+  uint32 *cq_head_ = nullptr;
+  uint32 *cq_tail_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+  uint32 cq_mask_ = 0;
+
+  // user_data of a poll request is a subscription index and its generation,
+  // so completions of removed subscriptions are recognized and ignored
+  vector<Subscription> subscriptions_;
+  vector<uint32> free_subscription_ids_;
+  vector<uint32> fd_to_subscription_id_;  // native fd -> subscription index + 1
+  ListNode list_root_;
+
+  static uint64 get_user_data(uint32 subscription_id, uint32 generation);
+
+  io_uring_sqe *get_sqe();
+
+  void enter(uint32 min_complete, const __kernel_timespec *timeout);
+
+  void add_poll(uint32 subscription_id);
+
+  void process_completions();
+};
+
+}  // namespace detail
+}  // namespace td
+
+#endif
@@ -10,6 +10,8 @@
 
 #include "td/utils/format.h"
 #include "td/utils/logging.h"
+#include "td/utils/misc.h"
+#include "td/utils/PathView.h"
 #include "td/utils/port/detail/skip_eintr.h"
 #include "td/utils/ScopeGuard.h"
 #include "td/utils/SliceBuilder.h"
@@ -83,6 +85,28 @@ Status mkpath(CSlice path, int32 mode) {
   return Status::OK();
 }
 
+Result<string> realpath_in_directory(CSlice directory, Slice path, bool allow_absolute_path) {
+  string full_path;
+  if (PathView(path).is_absolute()) {
+    if (!allow_absolute_path) {
+      return Status::Error("Absolute path is specified");
+    }
+    full_path = path.str();
+  } else {
+    full_path = PSTRING() << directory << TD_DIR_SLASH << path;
+  }
+
+  TRY_RESULT(real_directory, realpath(directory));
+  TRY_RESULT(real_path, realpath(full_path));
+  if (real_directory.empty() || real_directory.back() != TD_DIR_SLASH) {
+    real_directory += TD_DIR_SLASH;
+  }
+  if (!begins_with(real_path, real_directory)) {
+    return Status::Error("File is outside of the directory");
+  }
+  return std::move(real_path);
+}
+
 Status rmrf(CSlice path) {
   return walk_path(path, [](CSlice path, WalkPath::Type type) {
     switch (type) {
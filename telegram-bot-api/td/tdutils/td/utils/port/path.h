@@ -25,6 +25,10 @@ Status rename(CSlice from, CSlice to) TD_WARN_UNUSED_RESULT;
 
 Result<string> realpath(CSlice slice, bool ignore_access_denied = false) TD_WARN_UNUSED_RESULT;
 
+// returns the real path of the file at the given path relative to the directory, failing if the file isn't inside
+// the directory after resolution of symbolic links and ".."; absolute paths are accepted only if allowed
+Result<string> realpath_in_directory(CSlice directory, Slice path, bool allow_absolute_path) TD_WARN_UNUSED_RESULT;
+
 Status chdir(CSlice dir) TD_WARN_UNUSED_RESULT;
 
 Status rmdir(CSlice dir) TD_WARN_UNUSED_RESULT;
@@ -4,9 +4,14 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
+#include "td/utils/buffer.h"
+#include "td/utils/common.h"
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
+#include "td/utils/Parser.h"
+#include "td/utils/Random.h"
 #include "td/utils/Slice.h"
+#include "td/utils/SliceBuilder.h"
 #include "td/utils/StringBuilder.h"
 #include "td/utils/tests.h"
 
@@ -88,3 +93,102 @@ TEST(JSON, kphp) {
       "{\"keyboard\":[[\"\\u2022 abcdefg\"],[\"\\u2022 hijklmnop\"],[\"\\u2022 "
       "qrstuvwxyz\"]],\"one_time_keyboard\":true}");
 }
+
+TEST(JSON, encode_buffer) {
+  for (size_t size_hint : {0, 10, 100, 1000, 10000}) {
+    for (size_t length : {0, 10, 100, 1000, 10000}) {
+      td::string str(length, 'a');
+      size_t copied_size = 0;
+      auto result = td::json_encode_buffer(td::JsonString(str), size_hint, copied_size);
+      ASSERT_EQ(PSTRING() << '"' << str << '"', result.as_slice());
+      auto pretty_result = td::json_encode_buffer(td::JsonString(str), size_hint, copied_size, true);
+      ASSERT_EQ(td::json_encode<td::string>(td::JsonString(str), true), pretty_result.as_slice());
+      if (length + 100 < size_hint) {
+        ASSERT_EQ(0u, copied_size);
+      }
+      if (length > size_hint + 1000) {
+        ASSERT_TRUE(copied_size >= 2 * (length + 2));
+      }
+    }
+  }
+}
+
+TEST(JSON, string_escaping) {
+  const td::vector<td::string> parts{"a", "bcd", "\"", "\\", "\n", "\t", "\x01", "\x1f", "\x7f", "/",
+                                     "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", td::string(40, 'x')};
+  for (auto escape_non_ascii : {true, false}) {
+    for (int i = 0; i < 1000; i++) {
+      td::string str;
+      auto part_count = td::Random::fast(0, 30);
+      for (int j = 0; j < part_count; j++) {
+        str += parts[td::Random::fast(0, static_cast<int>(parts.size()) - 1)];
+      }
+
+      auto encoded = td::json_encode<td::string>(td::JsonString(str), false, escape_non_ascii);
+      for (auto c : encoded) {
+        auto ch = static_cast<unsigned char>(c);
+        ASSERT_TRUE(ch >= 0x20);
+        if (escape_non_ascii) {
+          ASSERT_TRUE(ch < 0x80);
+        }
+      }
+      auto encoded_copy = encoded;
+      auto r_value = td::json_decode(encoded_copy);
+      ASSERT_TRUE(r_value.is_ok());
+      ASSERT_TRUE(r_value.ok().type() == td::JsonValue::Type::String);
+      ASSERT_EQ(str, r_value.ok().get_string());
+
+      auto raw_encoded = td::json_encode<td::string>(td::JsonRawString(str));
+      if (!escape_non_ascii) {
+        ASSERT_EQ(encoded, raw_encoded);
+      }
+
+      // non-ASCII characters are escaped only if both the string and the builder require it
+      ASSERT_EQ(encoded, td::json_encode<td::string>(td::JsonString(str, escape_non_ascii)));
+      ASSERT_EQ(raw_encoded, td::json_encode<td::string>(td::JsonString(str, escape_non_ascii), false, false));
+    }
+  }
+  ASSERT_EQ("\"\\u00e9\\ud83d\\ude00\"", td::json_encode<td::string>(td::JsonString("\xc3\xa9\xf0\x9f\x98\x80")));
+}
+
+TEST(JSON, string_decoding) {
+  const td::vector<td::string> parts{"a",      "bcd",      "\\\"",     "\\\\",         "\\/",
+                                     "\\n",    "\\t",     "\\b\\f\\r", "\\u0001",       "\\u00e9",
+                                     "\\u20ac", "\xc3\xa9", "\\/",       "\\ud83d\\ude00", td::string(40, 'x')};
+  for (int i = 0; i < 1000; i++) {
+    td::string str;
+    auto part_count = td::Random::fast(0, 30);
+    for (int j = 0; j < part_count; j++) {
+      str += parts[td::Random::fast(0, static_cast<int>(parts.size()) - 1)];
+    }
+
+    auto json = PSTRING() << "{\"" << str << "\":[\"" << str << "\",{\"key\":\"" << str << "\"}],\"x\":[]}";
+    auto json_copy = json;
+    auto r_value = td::json_decode(json_copy);
+    ASSERT_TRUE(r_value.is_ok());
+    auto &object = r_value.ok_ref().get_object();
+    ASSERT_EQ(2u, object.size());
+    auto &array = object[0].second.get_array();
+    ASSERT_EQ(2u, array.size());
+    ASSERT_EQ(object[0].first, array[0].get_string());
+    ASSERT_EQ(object[0].first, array[1].get_object()[0].second.get_string());
+    ASSERT_TRUE(object[1].second.get_array().empty());
+
+    auto expected_str = PSTRING() << '"' << str << '"';
+    auto r_expected = td::json_decode(expected_str);
+    ASSERT_TRUE(r_expected.is_ok());
+    ASSERT_EQ(r_expected.ok().get_string(), object[0].first);
+
+    json_copy = json;
+    td::Parser parser(json_copy);
+    ASSERT_TRUE(td::do_json_skip(parser, 100).is_ok());
+    ASSERT_TRUE(parser.empty());
+  }
+
+  for (auto bad_json : {"\"", "\"abc", "\"abc\\\"", "\"abc\\", "[\"abc\",\"def\"", "{\"abc\":\"def\\\"}"}) {
+    td::string str = bad_json;
+    ASSERT_TRUE(td::json_decode(str).is_error());
+    str = td::string(40, ' ') + bad_json;
+    ASSERT_TRUE(td::json_decode(str).is_error());
+  }
+}
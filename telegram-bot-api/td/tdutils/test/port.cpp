@@ -12,6 +12,8 @@
 #include "td/utils/port/FileFd.h"
 #include "td/utils/port/IoSlice.h"
 #include "td/utils/port/path.h"
+#include "td/utils/port/Poll.h"
+#include "td/utils/port/PollFlags.h"
 #include "td/utils/port/signals.h"
 #include "td/utils/port/sleep.h"
 #include "td/utils/port/thread.h"
@@ -32,6 +34,10 @@
 #include <signal.h>
 #endif
 
+#if TD_PORT_POSIX
+#include <unistd.h>
+#endif
+
 TEST(Port, files) {
   td::CSlice main_dir = "test_dir";
   td::rmrf(main_dir).ignore();
@@ -107,6 +113,58 @@ TEST(Port, files) {
   ASSERT_STREQ("Habcd world?!", buf_slice.substr(0, 13));
 }
 
+TEST(Port, RealPathInDirectory) {
+  td::CSlice main_dir = "realpath_test_dir";
+  td::rmrf(main_dir).ignore();
+  td::string directory = PSTRING() << main_dir << TD_DIR_SLASH << "bot";
+  td::mkpath(PSLICE() << directory << TD_DIR_SLASH << "documents" << TD_DIR_SLASH).ensure();
+  auto create_file = [](td::CSlice path) {
+    td::FileFd::open(path, td::FileFd::Write | td::FileFd::CreateNew).move_as_ok().close();
+  };
+  td::string file_path = PSTRING() << directory << TD_DIR_SLASH << "documents" << TD_DIR_SLASH << "file.txt";
+  td::string outside_path = PSTRING() << main_dir << TD_DIR_SLASH << "secret.txt";
+  create_file(file_path);
+  create_file(outside_path);
+  auto real_file_path = td::realpath(file_path).move_as_ok();
+  auto real_outside_path = td::realpath(outside_path).move_as_ok();
+
+  auto get_path = [&](td::Slice path, bool allow_absolute_path) {
+    return td::realpath_in_directory(directory, path, allow_absolute_path);
+  };
+  td::string slash(1, TD_DIR_SLASH);
+  ASSERT_EQ(real_file_path, get_path(PSLICE() << "documents" << slash << "file.txt", false).move_as_ok());
+  td::string dotted_path = PSTRING() << "documents" << slash << ".." << slash << "documents" << slash << "file.txt";
+  ASSERT_EQ(real_file_path, get_path(dotted_path, false).move_as_ok());
+  ASSERT_TRUE(get_path(PSLICE() << ".." << slash << "secret.txt", false).is_error());
+  ASSERT_TRUE(get_path(PSLICE() << "documents" << slash << ".." << slash << ".." << slash << "secret.txt", false)
+                  .is_error());
+  ASSERT_TRUE(get_path(PSLICE() << "documents" << slash << "missing.txt", false).is_error());
+
+  // absolute paths are accepted only if allowed and only inside the directory
+  ASSERT_TRUE(get_path(real_file_path, false).is_error());
+  ASSERT_EQ(real_file_path, get_path(real_file_path, true).move_as_ok());
+  ASSERT_TRUE(get_path(real_outside_path, true).is_error());
+
+  // a directory with the same prefix isn't inside the directory
+  td::mkdir(PSLICE() << directory << "2").ensure();
+  td::string sibling_path = PSTRING() << directory << "2" << TD_DIR_SLASH << "file.txt";
+  create_file(sibling_path);
+  ASSERT_TRUE(get_path(PSLICE() << ".." << slash << "bot2" << slash << "file.txt", false).is_error());
+  ASSERT_TRUE(get_path(td::realpath(sibling_path).move_as_ok(), true).is_error());
+
+#if TD_PORT_POSIX
+  // symbolic links are resolved before the check
+  td::string link_path = PSTRING() << directory << TD_DIR_SLASH << "link.txt";
+  ASSERT_EQ(0, symlink(real_outside_path.c_str(), link_path.c_str()));
+  ASSERT_TRUE(get_path("link.txt", false).is_error());
+  td::string inner_link_path = PSTRING() << directory << TD_DIR_SLASH << "inner_link.txt";
+  ASSERT_EQ(0, symlink(real_file_path.c_str(), inner_link_path.c_str()));
+  ASSERT_EQ(real_file_path, get_path("inner_link.txt", false).move_as_ok());
+#endif
+
+  td::rmrf(main_dir).ensure();
+}
+
 TEST(Port, SparseFiles) {
   td::CSlice path = "sparse.txt";
   td::unlink(path).ignore();
@@ -293,6 +351,64 @@ TEST(Port, EventFdAndSignals) {
 #endif
 #endif
 
+#if TD_PORT_POSIX && !TD_EVENTFD_UNSUPPORTED
+TEST(Port, PollEventFd) {
+  for (auto use_io_uring : {false, true}) {
+    if (td::set_poll_use_io_uring(use_io_uring) != use_io_uring) {
+      LOG(INFO) << "Skip io_uring poll test";
+      continue;
+    }
+
+    td::vector<td::EventFd> event_fds(10);
+    td::Poll poll;
+    poll.init();
+    for (auto &event_fd : event_fds) {
+      event_fd.init();
+      poll.subscribe(event_fd.get_poll_info().extract_pollable_fd(nullptr), td::PollFlags::Read());
+    }
+    poll.run(0);
+    for (auto &event_fd : event_fds) {
+      ASSERT_TRUE(!event_fd.get_poll_info().sync_with_poll().can_read());
+    }
+
+    for (int t = 0; t < 3; t++) {
+      for (size_t i = 0; i < event_fds.size(); i += 2) {
+        event_fds[i].release();
+      }
+      poll.run(100);
+      for (size_t i = 0; i < event_fds.size(); i++) {
+        ASSERT_EQ(i % 2 == 0, event_fds[i].get_poll_info().sync_with_poll().can_read());
+        event_fds[i].acquire();
+        ASSERT_TRUE(!event_fds[i].get_poll_info().get_flags_local().can_read());
+      }
+    }
+
+    for (size_t i = 0; i < event_fds.size(); i += 2) {
+      poll.unsubscribe(event_fds[i].get_poll_info().get_pollable_fd_ref());
+    }
+    for (auto &event_fd : event_fds) {
+      event_fd.release();
+    }
+    poll.run(100);
+    for (size_t i = 0; i < event_fds.size(); i++) {
+      ASSERT_EQ(i % 2 == 1, event_fds[i].get_poll_info().sync_with_poll().can_read());
+    }
+
+    for (size_t i = 0; i < event_fds.size(); i += 2) {
+      event_fds[i].acquire();
+      poll.subscribe(event_fds[i].get_poll_info().extract_pollable_fd(nullptr), td::PollFlags::Read());
+      event_fds[i].release();
+    }
+    poll.run(100);
+    for (auto &event_fd : event_fds) {
+      ASSERT_TRUE(event_fd.get_poll_info().sync_with_poll().can_read());
+    }
+    poll.clear();
+  }
+  td::set_poll_use_io_uring(false);
+}
+#endif
+
 #if TD_HAVE_THREAD_AFFINITY
 TEST(Port, ThreadAffinityMask) {
   auto thread_id = td::this_thread::get_id();
@@ -27,14 +27,18 @@
 #include "td/utils/logging.h"
 #include "td/utils/port/FileFd.h"
 #include "td/utils/port/thread.h"
+#include "td/utils/Promise.h"
 #include "td/utils/Random.h"
 #include "td/utils/Slice.h"
+#include "td/utils/SliceBuilder.h"
 #include "td/utils/Status.h"
 #include "td/utils/tests.h"
+#include "td/utils/Time.h"
 
 #include <limits>
 #include <map>
 #include <memory>
+#include <utility>
 
 template <class ContainerT>
 static typename ContainerT::value_type &rand_elem(ContainerT &cont) {
@@ -745,3 +749,102 @@ TEST(DB, persistent_key_value) {
   }
   td::SqliteDb::destroy(path).ignore();
 }
+
+TEST(DB, binlog_group_sync) {
+  using KeyValue = td::BinlogKeyValue<td::ConcurrentBinlog>;
+  constexpr int BINLOG_COUNT = 10;
+  auto get_path = [](int i) {
+    return PSTRING() << "test_group_sync" << i;
+  };
+  for (int i = 0; i < BINLOG_COUNT; i++) {
+    td::Binlog::destroy(get_path(i)).ignore();
+  }
+
+  auto get_batch_count = [] {
+    auto statistics = td::ConcurrentBinlog::get_sync_statistics();
+    td::uint64 single_count = statistics.batch_size_counts[0];
+    td::uint64 total_count = 0;
+    for (auto count : statistics.batch_size_counts) {
+      total_count += count;
+    }
+    return std::make_pair(single_count, total_count);
+  };
+  auto old_batch_count = get_batch_count();
+
+  class Main final : public td::Actor {
+   public:
+    explicit Main(td::vector<td::string> paths) : paths_(std::move(paths)) {
+    }
+
+    void start_up() final {
+      for (auto &path : paths_) {
+        auto kv = std::make_shared<KeyValue>();
+        kv->init(path).ensure();
+        kvs_.push_back(std::move(kv));
+      }
+      send_closure_later(actor_id(this), &Main::sync);
+    }
+
+    void sync() {
+      // the binlog actors are idle, so the requests are handled immediately
+      for (size_t i = 0; i < kvs_.size(); i++) {
+        kvs_[i]->set("key", paths_[i]);
+        kvs_[i]->force_sync(td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Result<td::Unit> result) {
+          result.ensure();
+          send_closure(actor_id, &Main::on_synced);
+        }));
+      }
+      // make all sync timeouts expire in the same scheduler loop iteration regardless of the time spent above
+      td::Time::jump_in_future(td::Time::now() + 1);
+    }
+
+    void on_synced() {
+      CHECK(left_count_ > 0);
+      if (--left_count_ == 0) {
+        for (auto &kv : kvs_) {
+          kv->close(td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Unit) {
+            send_closure(actor_id, &Main::on_closed);
+          }));
+        }
+      }
+    }
+
+    void on_closed() {
+      if (++closed_count_ == kvs_.size()) {
+        td::Scheduler::instance()->finish();
+        stop();
+      }
+    }
+
+   private:
+    td::vector<td::string> paths_;
+    td::vector<std::shared_ptr<KeyValue>> kvs_;
+    size_t left_count_ = BINLOG_COUNT;
+    size_t closed_count_ = 0;
+  };
+
+  td::vector<td::string> paths;
+  for (int i = 0; i < BINLOG_COUNT; i++) {
+    paths.push_back(get_path(i));
+  }
+  td::ConcurrentScheduler sched(0, 0);
+  sched.create_actor_unsafe<Main>(0, "Main", paths).release();
+  sched.start();
+  while (sched.run_main(10)) {
+    // empty
+  }
+  sched.finish();
+
+  // all the binlogs needed sync at the same time, so they must have been synced in a single batch
+  auto new_batch_count = get_batch_count();
+  ASSERT_EQ(old_batch_count.first, new_batch_count.first);
+  ASSERT_TRUE(new_batch_count.second > old_batch_count.second);
+
+  for (auto &path : paths) {
+    td::BinlogKeyValue<td::Binlog> kv;
+    kv.init(path).ensure();
+    ASSERT_EQ(path, kv.get("key"));
+    kv.close();
+    td::Binlog::destroy(path).ignore();
+  }
+}
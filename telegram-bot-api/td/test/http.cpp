@@ -10,7 +10,9 @@
 #include "td/net/DarwinHttp.h"
 #endif
 
+#include "td/net/HttpByteRange.h"
 #include "td/net/HttpChunkedByteFlow.h"
+#include "td/net/HttpChunkedEncodeByteFlow.h"
 #include "td/net/HttpHeaderCreator.h"
 #include "td/net/HttpQuery.h"
 #include "td/net/HttpReader.h"
@@ -23,6 +25,7 @@
 #include "td/utils/ByteFlow.h"
 #include "td/utils/common.h"
 #include "td/utils/crypto.h"
+#include "td/utils/filesystem.h"
 #include "td/utils/format.h"
 #include "td/utils/Gzip.h"
 #include "td/utils/GzipByteFlow.h"
@@ -108,6 +111,21 @@ static td::string rand_http_query(td::string content) {
   return make_http_query(std::move(content), false, is_chunked, is_gzip);
 }
 
+static td::string make_multipart_query(const td::string &file_content) {
+  td::string boundary = "--------boundary";
+  td::string content = PSTRING() << "--" << boundary << "\r\n"
+                                 << "Content-Disposition: form-data; name=\"document\"; filename=\"file.txt\"\r\n"
+                                 << "Content-Type: text/plain\r\n\r\n"
+                                 << file_content << "\r\n--" << boundary << "--\r\n";
+  td::HttpHeaderCreator hc;
+  hc.init_post("/");
+  hc.set_content_type(PSLICE() << "multipart/form-data; boundary=" << boundary);
+  hc.set_content_size(content.size());
+  auto r_header = hc.finish();
+  CHECK(r_header.is_ok());
+  return PSTRING() << r_header.ok() << content;
+}
+
 static td::string join(const td::vector<td::string> &v) {
   td::string res;
   for (auto &s : v) {
@@ -211,6 +229,125 @@ TEST(Http, reader) {
   ASSERT_EQ(start_size, td::BufferAllocator::get_buffer_slice_size());
 }
 
+TEST(Http, memory_temporary_files) {
+  auto r_memory_dir = td::mkdtemp(td::get_temporary_dir(), "memory");
+  ASSERT_TRUE(r_memory_dir.is_ok());
+  auto memory_dir = r_memory_dir.move_as_ok();
+  td::HttpReader::set_memory_temporary_dir(memory_dir, 10000, 8000).ensure();
+  auto real_memory_dir = td::realpath(memory_dir).move_as_ok();
+
+  auto read_query = [](const td::string &file_content) {
+    td::ChainBufferWriter input_writer;
+    auto input = input_writer.extract_reader();
+    td::HttpReader reader;
+    reader.init(&input, 100, 1);
+
+    auto query = make_multipart_query(file_content);
+    auto query_ptr = td::make_unique<td::HttpQuery>();
+    size_t prefix_size = query.size() / 2;
+    input_writer.append(td::Slice(query).substr(0, prefix_size));
+    input.sync_with_writer();
+    auto r_state = reader.read_next(query_ptr.get());
+    ASSERT_TRUE(r_state.is_ok());
+    ASSERT_TRUE(r_state.ok() != 0);
+
+    input_writer.append(td::Slice(query).substr(prefix_size));
+    input.sync_with_writer();
+    r_state = reader.read_next(query_ptr.get());
+    ASSERT_TRUE(r_state.is_ok());
+    ASSERT_EQ(0u, r_state.ok());
+    ASSERT_EQ(1u, query_ptr->files_.size());
+    ASSERT_EQ(file_content, td::read_file_str(query_ptr->files_[0].temp_file_name).move_as_ok());
+    return query_ptr;
+  };
+  auto is_in_memory = [&](const td::unique_ptr<td::HttpQuery> &query) {
+    return td::begins_with(query->files_[0].temp_file_name, real_memory_dir);
+  };
+
+  auto first = read_query(td::string(6000, 'a'));
+  ASSERT_TRUE(is_in_memory(first));
+  auto second = read_query(td::string(6000, 'b'));
+  ASSERT_TRUE(!is_in_memory(second));
+  auto third = read_query(td::string(3000, 'c'));
+  ASSERT_TRUE(is_in_memory(third));
+  first = nullptr;
+  auto fourth = read_query(td::string(6000, 'd'));
+  ASSERT_TRUE(is_in_memory(fourth));
+  second = nullptr;
+  third = nullptr;
+  fourth = nullptr;
+  auto fifth = read_query(td::string(9000, 'e'));
+  ASSERT_TRUE(!is_in_memory(fifth));
+  fifth = nullptr;
+
+  td::HttpReader::set_memory_temporary_dir(td::CSlice(), 0, 0).ensure();
+  auto sixth = read_query(td::string(10, 'f'));
+  ASSERT_TRUE(!is_in_memory(sixth));
+  td::rmdir(memory_dir).ensure();
+}
+
+TEST(Http, byte_range) {
+  auto check = [](td::Slice range, td::int64 size, td::int64 begin, td::int64 end, bool is_partial,
+                  bool is_satisfiable) {
+    auto byte_range = td::HttpByteRange::parse(range, size);
+    ASSERT_EQ(begin, byte_range.begin);
+    ASSERT_EQ(end, byte_range.end);
+    ASSERT_EQ(is_partial, byte_range.is_partial);
+    ASSERT_EQ(is_satisfiable, byte_range.is_satisfiable);
+  };
+  auto check_whole = [&](td::Slice range, td::int64 size) {
+    check(range, size, 0, size, false, true);
+  };
+  auto check_unsatisfiable = [&](td::Slice range, td::int64 size) {
+    auto byte_range = td::HttpByteRange::parse(range, size);
+    ASSERT_TRUE(byte_range.is_partial);
+    ASSERT_TRUE(!byte_range.is_satisfiable);
+  };
+
+  check_whole("", 1000);
+  check_whole("bytes", 1000);
+  check_whole("items=0-10", 1000);
+  check_whole("bytes=", 1000);
+  check_whole("bytes=-", 1000);
+  check_whole("bytes=abc", 1000);
+  check_whole("bytes=10", 1000);
+  check_whole("bytes=a-10", 1000);
+  check_whole("bytes=10-a", 1000);
+  check_whole("bytes=+10-20", 1000);
+  check_whole("bytes=--10", 1000);
+  check_whole("bytes=20-10", 1000);
+
+  check("bytes=0-0", 1000, 0, 1, true, true);
+  check("bytes=0-499", 1000, 0, 500, true, true);
+  check("bytes= 500 - 999 ", 1000, 500, 1000, true, true);
+  check("bytes=500-5000", 1000, 500, 1000, true, true);
+  check("bytes=999-999999999999999999", 1000, 999, 1000, true, true);
+
+  // open-ended ranges
+  check("bytes=0-", 1000, 0, 1000, true, true);
+  check("bytes=900-", 1000, 900, 1000, true, true);
+  check("bytes=999-", 1000, 999, 1000, true, true);
+
+  // suffix ranges
+  check("bytes=-1", 1000, 999, 1000, true, true);
+  check("bytes=-100", 1000, 900, 1000, true, true);
+  check("bytes=-1000", 1000, 0, 1000, true, true);
+  check("bytes=-5000", 1000, 0, 1000, true, true);
+
+  // unsatisfiable ranges
+  check_unsatisfiable("bytes=1000-", 1000);
+  check_unsatisfiable("bytes=1000-1999", 1000);
+  check_unsatisfiable("bytes=5000-6000", 1000);
+  check_unsatisfiable("bytes=-0", 1000);
+  check_unsatisfiable("bytes=-10", 0);
+  check_unsatisfiable("bytes=0-", 0);
+
+  // multiple ranges aren't supported, so the whole file is returned
+  check_whole("bytes=0-10,20-30", 1000);
+  check_whole("bytes=0-10, -10", 1000);
+  check_whole("bytes=5000-6000,7000-8000", 1000);
+}
+
 TEST(Http, gzip_bomb) {
 #if TD_ANDROID || TD_TIZEN || TD_EMSCRIPTEN  // the test must be disabled on low-memory systems
   return;
@@ -258,6 +395,33 @@ TEST(Http, gzip) {
   ASSERT_EQ(413, r_state.error().code());
 }
 
+TEST(Http, gzip_encode_flow) {
+  auto str = td::rand_string('a', 'c', 1000000);
+  for (auto gzip_format : {false, true}) {
+    for (int compression_level = 1; compression_level <= 9; compression_level += 4) {
+      td::ChainBufferWriter input_writer;
+      auto input = input_writer.extract_reader();
+      td::ByteFlowSource source(&input);
+      td::GzipByteFlow gzip_flow;
+      gzip_flow.init_encode(compression_level, gzip_format);
+      td::ByteFlowSink sink;
+      source >> gzip_flow >> sink;
+
+      for (auto &part : td::rand_split(str)) {
+        input_writer.append(part);
+        source.wakeup();
+      }
+      source.close_input(td::Status::OK());
+      ASSERT_TRUE(sink.is_ready());
+      ASSERT_TRUE(sink.status().is_ok());
+      auto encoded = sink.result()->move_as_buffer_slice();
+      ASSERT_TRUE(encoded.size() < str.size());
+      ASSERT_EQ(gzip_format, td::begins_with(encoded.as_slice(), "\x1f\x8b"));
+      ASSERT_EQ(str, td::gzdecode(encoded.as_slice()).as_slice().str());
+    }
+  }
+}
+
 TEST(Http, aes_ctr_encode_decode_flow) {
   auto str = td::rand_string('a', 'z', 1000000);
   auto parts = td::rand_split(str);
@@ -419,6 +583,47 @@ TEST(Http, gzip_chunked_flow) {
   ASSERT_EQ(str, sink.result()->move_as_buffer_slice().as_slice().str());
 }
 
+TEST(Http, gzip_chunked_encode_flow) {
+  auto str = td::rand_string('a', 'z', 1000000);
+
+  td::ChainBufferWriter input_writer;
+  auto input = input_writer.extract_reader();
+  td::ByteFlowSource source(&input);
+  td::GzipByteFlow gzip_flow;
+  gzip_flow.init_encode(6, true);
+  td::HttpChunkedEncodeByteFlow chunked_flow;
+  td::ByteFlowSink sink;
+  source >> gzip_flow >> chunked_flow >> sink;
+
+  for (auto &part : td::rand_split(str)) {
+    input_writer.append(part);
+    source.wakeup();
+  }
+  source.close_input(td::Status::OK());
+  ASSERT_TRUE(sink.is_ready());
+  ASSERT_TRUE(sink.status().is_ok());
+  auto encoded = sink.result()->move_as_buffer_slice().as_slice().str();
+  ASSERT_TRUE(td::ends_with(encoded, "\r\n0\r\n\r\n"));
+
+  td::ChainBufferWriter decode_input_writer;
+  auto decode_input = decode_input_writer.extract_reader();
+  td::ByteFlowSource decode_source(&decode_input);
+  td::HttpChunkedByteFlow decode_chunked_flow;
+  td::GzipByteFlow decode_gzip_flow(td::Gzip::Mode::Decode);
+  td::ByteFlowSink decode_sink;
+  decode_source >> decode_chunked_flow >> decode_gzip_flow >> decode_sink;
+
+  for (auto &part : td::rand_split(encoded)) {
+    decode_input_writer.append(part);
+    decode_source.wakeup();
+  }
+  decode_source.close_input(td::Status::OK());
+  ASSERT_TRUE(decode_sink.is_ready());
+  LOG_IF(ERROR, decode_sink.status().is_error()) << decode_sink.status();
+  ASSERT_TRUE(decode_sink.status().is_ok());
+  ASSERT_EQ(str, decode_sink.result()->move_as_buffer_slice().as_slice().str());
+}
+
 TEST(Http, gzip_bomb_with_limit) {
   td::string gzip_bomb_str;
   {
@@ -13,6 +13,7 @@
 #include "td/utils/common.h"
 #include "td/utils/int_types.h"
 #include "td/utils/logging.h"
+#include "td/utils/port/Stat.h"
 #include "td/utils/Random.h"
 #include "td/utils/Slice.h"
 #include "td/utils/SliceBuilder.h"
@@ -31,7 +32,7 @@ TEST(TQueue, hands) {
   auto qid = 12;
   ASSERT_EQ(true, tqueue->get_head(qid).empty());
   ASSERT_EQ(true, tqueue->get_tail(qid).empty());
-  tqueue->push(qid, "hello", 1, 0, td::TQueue::EventId());
+  tqueue->push(qid, td::BufferSlice("hello"), 1, 0, td::TQueue::EventId());
   auto head = tqueue->get_head(qid);
   auto tail = tqueue->get_tail(qid);
   ASSERT_EQ(head.next().ok(), tail);
@@ -102,9 +103,9 @@ class TestTQueue {
   }
 
   EventId push(td::TQueue::QueueId queue_id, const td::string &data, td::int32 expires_at, EventId new_id = EventId()) {
-    auto a_id = baseline_->push(queue_id, data, expires_at, 0, new_id).move_as_ok();
-    auto b_id = memory_->push(queue_id, data, expires_at, 0, new_id).move_as_ok();
-    auto c_id = binlog_->push(queue_id, data, expires_at, 0, new_id).move_as_ok();
+    auto a_id = baseline_->push(queue_id, td::BufferSlice(data), expires_at, 0, new_id).move_as_ok();
+    auto b_id = memory_->push(queue_id, td::BufferSlice(data), expires_at, 0, new_id).move_as_ok();
+    auto c_id = binlog_->push(queue_id, td::BufferSlice(data), expires_at, 0, new_id).move_as_ok();
     ASSERT_EQ(a_id, b_id);
     ASSERT_EQ(a_id, c_id);
     return a_id;
@@ -143,8 +144,8 @@ class TestTQueue {
     for (size_t i = 0; i < a_span.size(); i++) {
       ASSERT_EQ(a_span[i].id, b_span[i].id);
       ASSERT_EQ(a_span[i].id, c_span[i].id);
-      ASSERT_EQ(a_span[i].data, b_span[i].data);
-      ASSERT_EQ(a_span[i].data, c_span[i].data);
+      ASSERT_EQ(a_span[i].data.as_slice(), b_span[i].data.as_slice());
+      ASSERT_EQ(a_span[i].data.as_slice(), c_span[i].data.as_slice());
     }
   }
 
@@ -211,7 +212,7 @@ TEST(TQueue, memory_leak) {
   td::Random::Xorshift128plus rnd(123);
   int i = 0;
   while (true) {
-    auto id = tqueue->push(1, "a", now + 600000, 0, {}).move_as_ok();
+    auto id = tqueue->push(1, td::BufferSlice("a"), now + 600000, 0, {}).move_as_ok();
     ids.push_back(id);
     if (ids.size() > static_cast<std::size_t>(rnd()) % 100000) {
       auto it = static_cast<std::size_t>(rnd()) % ids.size();
@@ -235,7 +236,7 @@ TEST(TQueue, clear) {
   td::vector<td::TQueue::EventId> ids;
   td::Random::Xorshift128plus rnd(123);
   for (size_t i = 0; i < 100000; i++) {
-    tqueue->push(1, td::string(td::Random::fast(100, 500), 'a'), now + 600000, 0, {}).ensure();
+    tqueue->push(1, td::BufferSlice(td::string(td::Random::fast(100, 500), 'a')), now + 600000, 0, {}).ensure();
   }
   auto tail_id = tqueue->get_tail(1);
   auto clear_start_time = td::Time::now();
@@ -249,3 +250,126 @@ TEST(TQueue, clear) {
   CHECK(tqueue->get_tail(1) == tail_id);
   CHECK(deleted_events.size() == 100000 - keep_count);
 }
+
+TEST(TQueue, binlog_force_reindex) {
+  td::CSlice binlog_path("test_tqueue_reindex.binlog");
+  td::Binlog::destroy(binlog_path).ensure();
+
+  auto tqueue = td::TQueue::create();
+  auto tqueue_binlog = td::make_unique<td::TQueueBinlog<td::Binlog>>();
+  auto binlog = std::make_shared<td::Binlog>();
+  binlog->init(binlog_path.str(), [&](const td::BinlogEvent &event) { UNREACHABLE(); }).ensure();
+  tqueue_binlog->set_binlog(binlog);
+  tqueue->set_callback(std::move(tqueue_binlog));
+
+  td::int32 now = 0;
+  for (int i = 0; i < 10000; i++) {
+    tqueue->push(1, td::BufferSlice(td::string(100, 'a')), now + 600000, 0, {}).ensure();
+  }
+  auto tail_id = tqueue->get_tail(1);
+  td::TQueue::Event events[10];
+  td::MutableSpan<td::TQueue::Event> events_span(events, 10);
+  tqueue->get(1, td::TQueue::EventId::from_int32(tail_id.value() - 10).move_as_ok(), true, now, events_span).ensure();
+  ASSERT_EQ(10u, tqueue->get_size(1));
+
+  binlog->force_reindex();
+  ASSERT_TRUE(td::stat(binlog_path).move_as_ok().size_ < 10 * 200);
+  tqueue->extract_callback();
+  binlog->close().ensure();
+
+  auto new_tqueue = td::TQueue::create();
+  tqueue_binlog = td::make_unique<td::TQueueBinlog<td::Binlog>>();
+  binlog = std::make_shared<td::Binlog>();
+  size_t replayed_event_count = 0;
+  binlog
+      ->init(binlog_path.str(),
+             [&](const td::BinlogEvent &event) {
+               tqueue_binlog->replay(event, *new_tqueue).ensure();
+               replayed_event_count++;
+             })
+      .ensure();
+  ASSERT_EQ(10u, replayed_event_count);
+  ASSERT_EQ(10u, new_tqueue->get_size(1));
+  ASSERT_EQ(tail_id, new_tqueue->get_tail(1));
+  binlog->close().ensure();
+  td::Binlog::destroy(binlog_path).ensure();
+}
+
+TEST(TQueue, binlog_reindex_if_needed) {
+  td::CSlice binlog_path("test_tqueue_reindex_if_needed.binlog");
+  td::Binlog::destroy(binlog_path).ensure();
+
+  auto tqueue = td::TQueue::create();
+  auto tqueue_binlog = td::make_unique<td::TQueueBinlog<td::Binlog>>();
+  auto binlog = std::make_shared<td::Binlog>();
+  binlog->init(binlog_path.str(), [&](const td::BinlogEvent &event) { UNREACHABLE(); }).ensure();
+  tqueue_binlog->set_binlog(binlog);
+  tqueue->set_callback(std::move(tqueue_binlog));
+
+  td::int32 now = 0;
+  for (int i = 0; i < 100; i++) {
+    tqueue->push(1, td::BufferSlice(td::string(100, 'a')), now + 600000, 0, {}).ensure();
+  }
+  auto tail_id = tqueue->get_tail(1);
+  td::TQueue::Event events[10];
+  td::MutableSpan<td::TQueue::Event> events_span(events, 10);
+  tqueue->get(1, td::TQueue::EventId::from_int32(tail_id.value() - 10).move_as_ok(), true, now, events_span).ensure();
+  ASSERT_EQ(10u, tqueue->get_size(1));
+
+  auto get_binlog_size = [&] {
+    binlog->flush();
+    return td::stat(binlog_path).move_as_ok().size_;
+  };
+  auto full_size = get_binlog_size();
+  ASSERT_TRUE(full_size > 100 * 100);
+
+  // the binlog is too small to be compacted
+  binlog->reindex_if_needed(full_size, 50);
+  ASSERT_EQ(full_size, get_binlog_size());
+
+  binlog->reindex_if_needed(1000, 50);
+  ASSERT_TRUE(get_binlog_size() < 10 * 200);
+
+  tqueue->extract_callback();
+  binlog->close().ensure();
+  td::Binlog::destroy(binlog_path).ensure();
+}
+
+TEST(TQueue, merge) {
+  auto tqueue = td::TQueue::create();
+  auto other_tqueue = td::TQueue::create();
+  td::int32 now = 0;
+  for (int i = 0; i < 100; i++) {
+    tqueue->push(1, td::BufferSlice("a"), now + 1000, 0, {}).ensure();
+    other_tqueue->push(2, td::BufferSlice("b"), now + 500, 0, {}).ensure();
+  }
+  auto tail_id = other_tqueue->get_tail(2);
+  tqueue->merge(std::move(other_tqueue));
+  ASSERT_EQ(100u, tqueue->get_size(1));
+  ASSERT_EQ(100u, tqueue->get_size(2));
+  ASSERT_EQ(tail_id, tqueue->get_tail(2));
+
+  auto gc_result = tqueue->run_gc(now + 600);
+  ASSERT_EQ(100, gc_result.first);
+  ASSERT_TRUE(gc_result.second);
+  ASSERT_EQ(100u, tqueue->get_size(1));
+  ASSERT_EQ(0u, tqueue->get_size(2));
+}
+
+TEST(TQueue, shared_event_data) {
+  auto tqueue = td::TQueue::create();
+  td::BufferSlice data(td::string(1000, 'a'));
+  auto data_begin = data.as_slice().begin();
+  auto id = tqueue->push(1, std::move(data), 1000, 0, {}).move_as_ok();
+
+  td::TQueue::Event events[10];
+  td::MutableSpan<td::TQueue::Event> events_span(events, 10);
+  ASSERT_EQ(1u, tqueue->get(1, id, false, 0, events_span).move_as_ok());
+  ASSERT_EQ(1u, events_span.size());
+  ASSERT_TRUE(events_span[0].data.as_slice().begin() == data_begin);
+
+  // the event data must stay valid after the event is deleted from the queue
+  tqueue->forget(1, id);
+  ASSERT_EQ(0u, tqueue->get_size(1));
+  ASSERT_EQ(td::string(1000, 'a'), events_span[0].data.as_slice().str());
+}
@@ -7,6 +7,7 @@
 #include "telegram-bot-api/Client.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/Metrics.h"
 
 #include "td/db/TQueue.h"
 
@@ -15,6 +16,7 @@
 
 #include "td/utils/algorithm.h"
 #include "td/utils/base64.h"
+#include "td/utils/buffer.h"
 #include "td/utils/filesystem.h"
 #include "td/utils/HttpUrl.h"
 #include "td/utils/JsonBuilder.h"
@@ -25,7 +27,6 @@
 #include "td/utils/Slice.h"
 #include "td/utils/SliceBuilder.h"
 #include "td/utils/Span.h"
-#include "td/utils/StackAllocator.h"
 #include "td/utils/Status.h"
 #include "td/utils/StringBuilder.h"
 #include "td/utils/Time.h"
@@ -190,8 +191,7 @@ Client::Client(td::ActorShared<> parent, const td::string &bot_token, bool is_te
     , tqueue_id_(tqueue_id)
     , parameters_(std::move(parameters))
     , stat_actor_(std::move(stat_actor)) {
-  static auto is_inited = init_methods();
-  CHECK(is_inited);
+  CHECK(!methods_.empty());
 }
 
 Client::~Client() {
@@ -200,111 +200,119 @@ Client::~Client() {
                                                   yet_unsent_reply_message_ids_, sticker_set_names_);
 }
 
-bool Client::init_methods() {
-  methods_.emplace("getme", &Client::process_get_me_query);
-  methods_.emplace("getmycommands", &Client::process_get_my_commands_query);
-  methods_.emplace("setmycommands", &Client::process_set_my_commands_query);
-  methods_.emplace("deletemycommands", &Client::process_delete_my_commands_query);
-  methods_.emplace("getmydefaultadministratorrights", &Client::process_get_my_default_administrator_rights_query);
-  methods_.emplace("setmydefaultadministratorrights", &Client::process_set_my_default_administrator_rights_query);
-  methods_.emplace("getchatmenubutton", &Client::process_get_chat_menu_button_query);
-  methods_.emplace("setchatmenubutton", &Client::process_set_chat_menu_button_query);
-  methods_.emplace("getuserprofilephotos", &Client::process_get_user_profile_photos_query);
-  methods_.emplace("sendmessage", &Client::process_send_message_query);
-  methods_.emplace("sendanimation", &Client::process_send_animation_query);
-  methods_.emplace("sendaudio", &Client::process_send_audio_query);
-  methods_.emplace("senddice", &Client::process_send_dice_query);
-  methods_.emplace("senddocument", &Client::process_send_document_query);
-  methods_.emplace("sendphoto", &Client::process_send_photo_query);
-  methods_.emplace("sendsticker", &Client::process_send_sticker_query);
-  methods_.emplace("sendvideo", &Client::process_send_video_query);
-  methods_.emplace("sendvideonote", &Client::process_send_video_note_query);
-  methods_.emplace("sendvoice", &Client::process_send_voice_query);
-  methods_.emplace("sendgame", &Client::process_send_game_query);
-  methods_.emplace("sendinvoice", &Client::process_send_invoice_query);
-  methods_.emplace("sendlocation", &Client::process_send_location_query);
-  methods_.emplace("sendvenue", &Client::process_send_venue_query);
-  methods_.emplace("sendcontact", &Client::process_send_contact_query);
-  methods_.emplace("sendpoll", &Client::process_send_poll_query);
-  methods_.emplace("stoppoll", &Client::process_stop_poll_query);
-  methods_.emplace("copymessage", &Client::process_copy_message_query);
-  methods_.emplace("forwardmessage", &Client::process_forward_message_query);
-  methods_.emplace("sendmediagroup", &Client::process_send_media_group_query);
-  methods_.emplace("sendchataction", &Client::process_send_chat_action_query);
-  methods_.emplace("editmessagetext", &Client::process_edit_message_text_query);
-  methods_.emplace("editmessagelivelocation", &Client::process_edit_message_live_location_query);
-  methods_.emplace("stopmessagelivelocation", &Client::process_edit_message_live_location_query);
-  methods_.emplace("editmessagemedia", &Client::process_edit_message_media_query);
-  methods_.emplace("editmessagecaption", &Client::process_edit_message_caption_query);
-  methods_.emplace("editmessagereplymarkup", &Client::process_edit_message_reply_markup_query);
-  methods_.emplace("deletemessage", &Client::process_delete_message_query);
-  methods_.emplace("createinvoicelink", &Client::process_create_invoice_link_query);
-  methods_.emplace("setgamescore", &Client::process_set_game_score_query);
-  methods_.emplace("getgamehighscores", &Client::process_get_game_high_scores_query);
-  methods_.emplace("answerwebappquery", &Client::process_answer_web_app_query_query);
-  methods_.emplace("answerinlinequery", &Client::process_answer_inline_query_query);
-  methods_.emplace("answercallbackquery", &Client::process_answer_callback_query_query);
-  methods_.emplace("answershippingquery", &Client::process_answer_shipping_query_query);
-  methods_.emplace("answerprecheckoutquery", &Client::process_answer_pre_checkout_query_query);
-  methods_.emplace("exportchatinvitelink", &Client::process_export_chat_invite_link_query);
-  methods_.emplace("createchatinvitelink", &Client::process_create_chat_invite_link_query);
-  methods_.emplace("editchatinvitelink", &Client::process_edit_chat_invite_link_query);
-  methods_.emplace("revokechatinvitelink", &Client::process_revoke_chat_invite_link_query);
-  methods_.emplace("getchat", &Client::process_get_chat_query);
-  methods_.emplace("setchatphoto", &Client::process_set_chat_photo_query);
-  methods_.emplace("deletechatphoto", &Client::process_delete_chat_photo_query);
-  methods_.emplace("setchattitle", &Client::process_set_chat_title_query);
-  methods_.emplace("setchatpermissions", &Client::process_set_chat_permissions_query);
-  methods_.emplace("setchatdescription", &Client::process_set_chat_description_query);
-  methods_.emplace("pinchatmessage", &Client::process_pin_chat_message_query);
-  methods_.emplace("unpinchatmessage", &Client::process_unpin_chat_message_query);
-  methods_.emplace("unpinallchatmessages", &Client::process_unpin_all_chat_messages_query);
-  methods_.emplace("setchatstickerset", &Client::process_set_chat_sticker_set_query);
-  methods_.emplace("deletechatstickerset", &Client::process_delete_chat_sticker_set_query);
-  methods_.emplace("getforumtopiciconstickers", &Client::process_get_forum_topic_icon_stickers_query);
-  methods_.emplace("createforumtopic", &Client::process_create_forum_topic_query);
-  methods_.emplace("editforumtopic", &Client::process_edit_forum_topic_query);
-  methods_.emplace("closeforumtopic", &Client::process_close_forum_topic_query);
-  methods_.emplace("reopenforumtopic", &Client::process_reopen_forum_topic_query);
-  methods_.emplace("deleteforumtopic", &Client::process_delete_forum_topic_query);
-  methods_.emplace("unpinallforumtopicmessages", &Client::process_unpin_all_forum_topic_messages_query);
-  methods_.emplace("editgeneralforumtopic", &Client::process_edit_general_forum_topic_query);
-  methods_.emplace("closegeneralforumtopic", &Client::process_close_general_forum_topic_query);
-  methods_.emplace("reopengeneralforumtopic", &Client::process_reopen_general_forum_topic_query);
-  methods_.emplace("hidegeneralforumtopic", &Client::process_hide_general_forum_topic_query);
-  methods_.emplace("unhidegeneralforumtopic", &Client::process_unhide_general_forum_topic_query);
-  methods_.emplace("getchatmember", &Client::process_get_chat_member_query);
-  methods_.emplace("getchatadministrators", &Client::process_get_chat_administrators_query);
-  methods_.emplace("getchatmembercount", &Client::process_get_chat_member_count_query);
-  methods_.emplace("getchatmemberscount", &Client::process_get_chat_member_count_query);
-  methods_.emplace("leavechat", &Client::process_leave_chat_query);
-  methods_.emplace("promotechatmember", &Client::process_promote_chat_member_query);
-  methods_.emplace("setchatadministratorcustomtitle", &Client::process_set_chat_administrator_custom_title_query);
-  methods_.emplace("banchatmember", &Client::process_ban_chat_member_query);
-  methods_.emplace("kickchatmember", &Client::process_ban_chat_member_query);
-  methods_.emplace("restrictchatmember", &Client::process_restrict_chat_member_query);
-  methods_.emplace("unbanchatmember", &Client::process_unban_chat_member_query);
-  methods_.emplace("banchatsenderchat", &Client::process_ban_chat_sender_chat_query);
-  methods_.emplace("unbanchatsenderchat", &Client::process_unban_chat_sender_chat_query);
-  methods_.emplace("approvechatjoinrequest", &Client::process_approve_chat_join_request_query);
-  methods_.emplace("declinechatjoinrequest", &Client::process_decline_chat_join_request_query);
-  methods_.emplace("getstickerset", &Client::process_get_sticker_set_query);
-  methods_.emplace("getcustomemojistickers", &Client::process_get_custom_emoji_stickers_query);
-  methods_.emplace("uploadstickerfile", &Client::process_upload_sticker_file_query);
-  methods_.emplace("createnewstickerset", &Client::process_create_new_sticker_set_query);
-  methods_.emplace("addstickertoset", &Client::process_add_sticker_to_set_query);
-  methods_.emplace("setstickersetthumb", &Client::process_set_sticker_set_thumb_query);
-  methods_.emplace("setstickerpositioninset", &Client::process_set_sticker_position_in_set_query);
-  methods_.emplace("deletestickerfromset", &Client::process_delete_sticker_from_set_query);
-  methods_.emplace("setpassportdataerrors", &Client::process_set_passport_data_errors_query);
-  methods_.emplace("sendcustomrequest", &Client::process_send_custom_request_query);
-  methods_.emplace("answercustomquery", &Client::process_answer_custom_query_query);
-  methods_.emplace("getupdates", &Client::process_get_updates_query);
-  methods_.emplace("setwebhook", &Client::process_set_webhook_query);
-  methods_.emplace("deletewebhook", &Client::process_set_webhook_query);
-  methods_.emplace("getwebhookinfo", &Client::process_get_webhook_info_query);
-  methods_.emplace("getfile", &Client::process_get_file_query);
-  return true;
+void Client::init_methods() {
+  CHECK(methods_.empty());
+  add_method("getme", &Client::process_get_me_query);
+  add_method("getmycommands", &Client::process_get_my_commands_query);
+  add_method("setmycommands", &Client::process_set_my_commands_query);
+  add_method("deletemycommands", &Client::process_delete_my_commands_query);
+  add_method("getmydefaultadministratorrights", &Client::process_get_my_default_administrator_rights_query);
+  add_method("setmydefaultadministratorrights", &Client::process_set_my_default_administrator_rights_query);
+  add_method("getchatmenubutton", &Client::process_get_chat_menu_button_query);
+  add_method("setchatmenubutton", &Client::process_set_chat_menu_button_query);
+  add_method("getuserprofilephotos", &Client::process_get_user_profile_photos_query);
+  add_method("sendmessage", &Client::process_send_message_query);
+  add_method("sendanimation", &Client::process_send_animation_query);
+  add_method("sendaudio", &Client::process_send_audio_query);
+  add_method("senddice", &Client::process_send_dice_query);
+  add_method("senddocument", &Client::process_send_document_query);
+  add_method("sendphoto", &Client::process_send_photo_query);
+  add_method("sendsticker", &Client::process_send_sticker_query);
+  add_method("sendvideo", &Client::process_send_video_query);
+  add_method("sendvideonote", &Client::process_send_video_note_query);
+  add_method("sendvoice", &Client::process_send_voice_query);
+  add_method("sendgame", &Client::process_send_game_query);
+  add_method("sendinvoice", &Client::process_send_invoice_query);
+  add_method("sendlocation", &Client::process_send_location_query);
+  add_method("sendvenue", &Client::process_send_venue_query);
+  add_method("sendcontact", &Client::process_send_contact_query);
+  add_method("sendpoll", &Client::process_send_poll_query);
+  add_method("stoppoll", &Client::process_stop_poll_query);
+  add_method("copymessage", &Client::process_copy_message_query);
+  add_method("forwardmessage", &Client::process_forward_message_query);
+  add_method("sendmediagroup", &Client::process_send_media_group_query);
+  add_method("sendchataction", &Client::process_send_chat_action_query);
+  add_method("editmessagetext", &Client::process_edit_message_text_query);
+  add_method("editmessagelivelocation", &Client::process_edit_message_live_location_query);
+  add_method("stopmessagelivelocation", &Client::process_edit_message_live_location_query);
+  add_method("editmessagemedia", &Client::process_edit_message_media_query);
+  add_method("editmessagecaption", &Client::process_edit_message_caption_query);
+  add_method("editmessagereplymarkup", &Client::process_edit_message_reply_markup_query);
+  add_method("deletemessage", &Client::process_delete_message_query);
+  add_method("createinvoicelink", &Client::process_create_invoice_link_query);
+  add_method("setgamescore", &Client::process_set_game_score_query);
+  add_method("getgamehighscores", &Client::process_get_game_high_scores_query);
+  add_method("answerwebappquery", &Client::process_answer_web_app_query_query);
+  add_method("answerinlinequery", &Client::process_answer_inline_query_query);
+  add_method("answercallbackquery", &Client::process_answer_callback_query_query);
+  add_method("answershippingquery", &Client::process_answer_shipping_query_query);
+  add_method("answerprecheckoutquery", &Client::process_answer_pre_checkout_query_query);
+  add_method("exportchatinvitelink", &Client::process_export_chat_invite_link_query);
+  add_method("createchatinvitelink", &Client::process_create_chat_invite_link_query);
+  add_method("editchatinvitelink", &Client::process_edit_chat_invite_link_query);
+  add_method("revokechatinvitelink", &Client::process_revoke_chat_invite_link_query);
+  add_method("getchat", &Client::process_get_chat_query);
+  add_method("setchatphoto", &Client::process_set_chat_photo_query);
+  add_method("deletechatphoto", &Client::process_delete_chat_photo_query);
+  add_method("setchattitle", &Client::process_set_chat_title_query);
+  add_method("setchatpermissions", &Client::process_set_chat_permissions_query);
+  add_method("setchatdescription", &Client::process_set_chat_description_query);
+  add_method("pinchatmessage", &Client::process_pin_chat_message_query);
+  add_method("unpinchatmessage", &Client::process_unpin_chat_message_query);
+  add_method("unpinallchatmessages", &Client::process_unpin_all_chat_messages_query);
+  add_method("setchatstickerset", &Client::process_set_chat_sticker_set_query);
+  add_method("deletechatstickerset", &Client::process_delete_chat_sticker_set_query);
+  add_method("getforumtopiciconstickers", &Client::process_get_forum_topic_icon_stickers_query);
+  add_method("createforumtopic", &Client::process_create_forum_topic_query);
+  add_method("editforumtopic", &Client::process_edit_forum_topic_query);
+  add_method("closeforumtopic", &Client::process_close_forum_topic_query);
+  add_method("reopenforumtopic", &Client::process_reopen_forum_topic_query);
+  add_method("deleteforumtopic", &Client::process_delete_forum_topic_query);
+  add_method("unpinallforumtopicmessages", &Client::process_unpin_all_forum_topic_messages_query);
+  add_method("editgeneralforumtopic", &Client::process_edit_general_forum_topic_query);
+  add_method("closegeneralforumtopic", &Client::process_close_general_forum_topic_query);
+  add_method("reopengeneralforumtopic", &Client::process_reopen_general_forum_topic_query);
+  add_method("hidegeneralforumtopic", &Client::process_hide_general_forum_topic_query);
+  add_method("unhidegeneralforumtopic", &Client::process_unhide_general_forum_topic_query);
+  add_method("getchatmember", &Client::process_get_chat_member_query);
+  add_method("getchatadministrators", &Client::process_get_chat_administrators_query);
+  add_method("getchatmembercount", &Client::process_get_chat_member_count_query);
+  add_method("getchatmemberscount", &Client::process_get_chat_member_count_query);
+  add_method("leavechat", &Client::process_leave_chat_query);
+  add_method("promotechatmember", &Client::process_promote_chat_member_query);
+  add_method("setchatadministratorcustomtitle", &Client::process_set_chat_administrator_custom_title_query);
+  add_method("banchatmember", &Client::process_ban_chat_member_query);
+  add_method("kickchatmember", &Client::process_ban_chat_member_query);
+  add_method("restrictchatmember", &Client::process_restrict_chat_member_query);
+  add_method("unbanchatmember", &Client::process_unban_chat_member_query);
+  add_method("banchatsenderchat", &Client::process_ban_chat_sender_chat_query);
+  add_method("unbanchatsenderchat", &Client::process_unban_chat_sender_chat_query);
+  add_method("approvechatjoinrequest", &Client::process_approve_chat_join_request_query);
+  add_method("declinechatjoinrequest", &Client::process_decline_chat_join_request_query);
+  add_method("getstickerset", &Client::process_get_sticker_set_query);
+  add_method("getcustomemojistickers", &Client::process_get_custom_emoji_stickers_query);
+  add_method("uploadstickerfile", &Client::process_upload_sticker_file_query);
+  add_method("createnewstickerset", &Client::process_create_new_sticker_set_query);
+  add_method("addstickertoset", &Client::process_add_sticker_to_set_query);
+  add_method("setstickersetthumb", &Client::process_set_sticker_set_thumb_query);
+  add_method("setstickerpositioninset", &Client::process_set_sticker_position_in_set_query);
+  add_method("deletestickerfromset", &Client::process_delete_sticker_from_set_query);
+  add_method("setpassportdataerrors", &Client::process_set_passport_data_errors_query);
+  add_method("sendcustomrequest", &Client::process_send_custom_request_query);
+  add_method("answercustomquery", &Client::process_answer_custom_query_query);
+  add_method("getupdates", &Client::process_get_updates_query);
+  add_method("setwebhook", &Client::process_set_webhook_query);
+  add_method("deletewebhook", &Client::process_set_webhook_query);
+  add_method("getwebhookinfo", &Client::process_get_webhook_info_query);
+  add_method("getfile", &Client::process_get_file_query);
+}
+
+void Client::add_method(Slice method, Status (Client::*handler)(PromisedQueryPtr &query)) {
+  auto method_id = static_cast<size_t>(Query::register_method(method));
+  if (methods_.size() <= method_id) {
+    methods_.resize(method_id + 1);
+  }
+  methods_[method_id] = handler;
 }
 
 bool Client::is_local_method(Slice method) {
@@ -2803,6 +2811,12 @@ class Client::JsonWebhookInfo final : public Jsonable {
     if (client_->webhook_max_connections_ > 0) {
       object("max_connections", client_->webhook_max_connections_);
     }
+    if (client_->webhook_max_batch_size_ > 1) {
+      object("max_batch_size", client_->webhook_max_batch_size_);
+    }
+    if (client_->webhook_gzip_min_size_ > 0) {
+      object("gzip_min_size", client_->webhook_gzip_min_size_);
+    }
     if (!url.empty()) {
       object("ip_address", client_->webhook_ip_address_.empty() ? "<unknown>" : client_->webhook_ip_address_);
     }
@@ -4063,6 +4077,25 @@ void Client::close() {
   }
 }
 
+void Client::hibernate() {
+  LOG(INFO) << "Hibernate idle bot";
+  is_hibernating_ = true;
+  close();
+}
+
+bool Client::can_hibernate() const {
+  if (td_client_.empty() || !was_authorized_ || closing_ || logging_out_ || need_close_) {
+    return false;
+  }
+  if (!webhook_url_.empty() || webhook_set_query_ || active_webhook_set_query_ || long_poll_query_ ||
+      !cmd_queue_.empty() || !pending_send_message_queries_.empty() || !pending_bot_resolve_queries_.empty() ||
+      !file_download_listeners_.empty()) {
+    return false;
+  }
+  auto &tqueue = parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_;
+  return tqueue->get_size(tqueue_id_) == 0;
+}
+
 void Client::log_out(int32 error_code, Slice error_message) {
   LOG(WARNING) << "Logging out due to error " << error_code << ": " << error_message;
   if (error_message == "API_ID_INVALID") {
@@ -4081,7 +4114,7 @@ void Client::log_out(int32 error_code, Slice error_message) {
 }
 
 std::size_t Client::get_pending_update_count() const {
-  return parameters_->shared_data_->tqueue_->get_size(tqueue_id_);
+  return parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_->get_size(tqueue_id_);
 }
 
 void Client::update_last_synchronization_error_date() {
@@ -4114,10 +4147,11 @@ ServerBotInfo Client::get_bot_info() const {
   }
   res.webhook_ = webhook_url_;
   res.has_webhook_certificate_ = has_webhook_certificate_;
-  auto &tqueue = parameters_->shared_data_->tqueue_;
+  auto &tqueue = parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_;
   res.head_update_id_ = tqueue->get_head(tqueue_id_).value();
   res.tail_update_id_ = tqueue->get_tail(tqueue_id_).value();
   res.webhook_max_connections_ = webhook_max_connections_;
+  res.webhook_max_batch_size_ = webhook_max_batch_size_;
   res.pending_update_count_ = tqueue->get_size(tqueue_id_);
   res.start_time_ = start_time_;
   return res;
@@ -4182,8 +4216,10 @@ void Client::start_up() {
   };
   td::ClientActor::Options options;
   options.net_query_stats = parameters_->net_query_stats_;
+  const auto &shared_data = parameters_->shared_data_;
   td_client_ = td::create_actor_on_scheduler<td::ClientActor>(
-      "TdClientActor", 0, td::make_unique<TdCallback>(actor_id(this)), std::move(options));
+      "TdClientActor", shared_data->get_td_scheduler_id(shared_data->get_client_shard_id(tqueue_id_)),
+      td::make_unique<TdCallback>(actor_id(this)), std::move(options));
 }
 
 void Client::send(PromisedQueryPtr query) {
@@ -4754,7 +4790,7 @@ void Client::send_request(object_ptr<td_api::Function> &&f, td::unique_ptr<TdQue
 
 void Client::do_send_request(object_ptr<td_api::Function> &&f, td::unique_ptr<TdQueryCallback> handler) {
   CHECK(!td_client_.empty());
-  auto id = handlers_.create(std::move(handler));
+  auto id = handlers_.create(PendingTdRequest{std::move(handler), td::Time::now()});
   send_closure(td_client_, &td::ClientActor::request, id, std::move(f));
 }
 
@@ -5231,9 +5267,10 @@ void Client::on_result(td::uint64 id, object_ptr<td_api::Object> result) {
     return on_update(std::move(result));
   }
 
-  auto *handler_ptr = handlers_.get(id);
-  CHECK(handler_ptr != nullptr);
-  auto handler = std::move(*handler_ptr);
+  auto *request = handlers_.get(id);
+  CHECK(request != nullptr);
+  ServerMetrics::instance().add_td_request(td::Time::now() - request->send_time_);
+  auto handler = std::move(request->handler_);
   handler->on_result(std::move(result));
   handlers_.erase(id);
 }
@@ -5336,7 +5373,7 @@ void Client::timeout_expired() {
 
 void Client::clear_tqueue() {
   CHECK(webhook_id_.empty());
-  auto &tqueue = parameters_->shared_data_->tqueue_;
+  auto &tqueue = parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_;
   auto deleted_events = tqueue->clear(tqueue_id_, 0);
   td::Scheduler::instance()->destroy_on_scheduler(SharedData::get_file_gc_scheduler_id(), deleted_events);
 }
@@ -7377,7 +7414,8 @@ void Client::on_message_send_succeeded(object_ptr<td_api::message> &&message, in
       extract_yet_unsent_message_query_id(chat_id, old_message_id, &message_info->is_reply_to_message_deleted);
   auto &query = *pending_send_message_queries_[query_id];
   if (query.is_multisend) {
-    query.messages.push_back(td::json_encode<td::string>(JsonMessage(message_info, true, "sent message", this)));
+    query.messages.push_back(td::json_encode<td::string>(JsonMessage(message_info, true, "sent message", this), false,
+                                                         parameters_->shared_data_->json_escape_non_ascii_));
     query.awaited_message_count--;
 
     if (query.awaited_message_count == 0) {
@@ -7457,12 +7495,12 @@ void Client::on_cmd(PromisedQueryPtr query) {
 
   unresolved_bot_usernames_.clear();
 
-  auto method_it = methods_.find(query->method().str());
-  if (method_it == methods_.end()) {
+  auto method_id = query->method_id();
+  if (method_id < 0 || static_cast<size_t>(method_id) >= methods_.size() || methods_[method_id] == nullptr) {
     return fail_query(404, "Not Found: method not found", std::move(query));
   }
 
-  auto result = (this->*(method_it->second))(query);
+  auto result = (this->*(methods_[method_id]))(query);
   if (result.is_error()) {
     fail_query_with_error(std::move(query), result.code(), result.message());
   }
@@ -9158,6 +9196,8 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
                                              : (get_webhook_certificate(query.get()) != nullptr ||
                                                 (query->is_internal() && query->arg("certificate") == "previous"));
   int32 new_max_connections = new_url.empty() ? 0 : get_webhook_max_connections(query.get());
+  int32 new_max_batch_size = new_url.empty() ? 0 : get_webhook_max_batch_size(query.get());
+  int32 new_gzip_min_size = new_url.empty() ? 0 : get_webhook_gzip_min_size(query.get());
   Slice new_ip_address = new_url.empty() ? Slice() : query->arg("ip_address");
   bool new_fix_ip_address = new_url.empty() ? false : get_webhook_fix_ip_address(query.get());
   Slice new_secret_token = new_url.empty() ? Slice() : query->arg("secret_token");
@@ -9169,7 +9209,8 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
     query->set_retry_after_error(1);
     return Status::OK();
   } else if (webhook_url_ == new_url && !has_webhook_certificate_ && !new_has_certificate &&
-             new_max_connections == webhook_max_connections_ && new_fix_ip_address == webhook_fix_ip_address_ &&
+             new_max_connections == webhook_max_connections_ && new_max_batch_size == webhook_max_batch_size_ &&
+             new_gzip_min_size == webhook_gzip_min_size_ && new_fix_ip_address == webhook_fix_ip_address_ &&
              new_secret_token == webhook_secret_token_ &&
              (!new_fix_ip_address || new_ip_address == webhook_ip_address_) && !drop_pending_updates) {
     if (update_allowed_update_types(query.get())) {
@@ -9186,7 +9227,9 @@ td::Status Client::process_set_webhook_query(PromisedQueryPtr &query) {
   if (now > next_set_webhook_logging_time_ || webhook_url_ != new_url) {
     next_set_webhook_logging_time_ = now + 300;
     LOG(WARNING) << "Set webhook to " << new_url << ", max_connections = " << new_max_connections
-                 << ", IP address = " << new_ip_address << ", drop_pending_updates = " << drop_pending_updates;
+                 << ", max_batch_size = " << new_max_batch_size << ", gzip_min_size = " << new_gzip_min_size
+                 << ", IP address = " << new_ip_address
+                 << ", drop_pending_updates = " << drop_pending_updates;
   }
 
   if (!new_url.empty()) {
@@ -9283,6 +9326,12 @@ void Client::save_webhook() const {
     value += "cert/";
   }
   value += PSTRING() << "#maxc" << webhook_max_connections_ << '/';
+  if (webhook_max_batch_size_ > 1) {
+    value += PSTRING() << "#batch" << webhook_max_batch_size_ << '/';
+  }
+  if (webhook_gzip_min_size_ > 0) {
+    value += PSTRING() << "#gzip" << webhook_gzip_min_size_ << '/';
+  }
   if (!webhook_ip_address_.empty()) {
     value += PSTRING() << "#ip" << webhook_ip_address_ << '/';
   }
@@ -9344,6 +9393,8 @@ void Client::on_webhook_closed(Status status) {
   webhook_url_ = td::string();
   has_webhook_certificate_ = false;
   webhook_max_connections_ = 0;
+  webhook_max_batch_size_ = 0;
+  webhook_gzip_min_size_ = 0;
   webhook_ip_address_ = td::string();
   webhook_fix_ip_address_ = false;
   webhook_secret_token_ = td::string();
@@ -9387,6 +9438,15 @@ td::int32 Client::get_webhook_max_connections(const Query *query) const {
   return get_integer_arg(query, "max_connections", default_value, 1, max_value);
 }
 
+td::int32 Client::get_webhook_max_batch_size(const Query *query) {
+  return get_integer_arg(query, "max_batch_size", 1, 1, 100);
+}
+
+td::int32 Client::get_webhook_gzip_min_size(const Query *query) {
+  // 0 disables compression of webhook requests
+  return get_integer_arg(query, "gzip_min_size", 0, 0, 1 << 30);
+}
+
 bool Client::get_webhook_fix_ip_address(const Query *query) {
   if (query->is_internal()) {
     return query->has_arg("fix_ip_address");
@@ -9476,6 +9536,8 @@ void Client::finish_set_webhook(PromisedQueryPtr query) {
   webhook_url_ = new_url.str();
   webhook_set_time_ = td::Time::now();
   webhook_max_connections_ = get_webhook_max_connections(query.get());
+  webhook_max_batch_size_ = get_webhook_max_batch_size(query.get());
+  webhook_gzip_min_size_ = get_webhook_gzip_min_size(query.get());
   webhook_secret_token_ = query->arg("secret_token").str();
   webhook_ip_address_ = query->arg("ip_address").str();
   webhook_fix_ip_address_ = get_webhook_fix_ip_address(query.get());
@@ -9492,7 +9554,8 @@ void Client::finish_set_webhook(PromisedQueryPtr query) {
   webhook_id_ = td::create_actor<WebhookActor>(
       webhook_actor_name, actor_shared(this, webhook_generation_), tqueue_id_, url.move_as_ok(),
       has_webhook_certificate_ ? get_webhook_certificate_path() : td::string(), webhook_max_connections_,
-      query->is_internal(), webhook_ip_address_, webhook_fix_ip_address_, webhook_secret_token_, parameters_);
+      webhook_max_batch_size_, webhook_gzip_min_size_, query->is_internal(), webhook_ip_address_,
+      webhook_fix_ip_address_, webhook_secret_token_, parameters_);
   // wait for webhook verified or webhook callback
   webhook_query_type_ = WebhookQueryType::Verify;
   CHECK(!active_webhook_set_query_);
@@ -9638,6 +9701,12 @@ Client::ClosingError Client::get_closing_error() {
       result.code = 401;
       result.message = Slice("Unauthorized");
     }
+  } else if (is_hibernating_) {
+    // the bot will be restarted by the next request
+    CHECK(closing_);
+    result.code = 429;
+    result.retry_after = 1;
+    result.message = Slice("Too Many Requests: retry after 1");
   } else {
     CHECK(closing_);
     result.code = 500;
@@ -9646,28 +9715,34 @@ Client::ClosingError Client::get_closing_error() {
   return result;
 }
 
-class Client::JsonUpdates final : public Jsonable {
- public:
-  explicit JsonUpdates(td::Span<td::TQueue::Event> updates) : updates_(updates) {
-  }
-  void store(JsonValueScope *scope) const {
-    auto array = scope->enter_array();
-    int left_len = 1 << 22;
-    for (auto &update : updates_) {
-      left_len -= 50 + td::narrow_cast<int>(update.data.size());
-      if (left_len <= 0) {
-        break;
-      }
-      array << JsonUpdate(update.id.value(), update.data);
+void Client::answer_updates(td::Span<td::TQueue::Event> updates, PromisedQueryPtr query) {
+  td::ChainBufferWriter writer;
+  writer.append(td::Slice("{\"ok\":true,\"result\":["));
+  int left_len = 1 << 22;
+  for (size_t i = 0; i < updates.size(); i++) {
+    auto &update = updates[i];
+    left_len -= 50 + td::narrow_cast<int>(update.data.size());
+    if (left_len <= 0) {
+      break;
     }
+    if (i != 0) {
+      writer.append(td::Slice(","));
+    }
+    store_json_update(writer, update.id.value(), update.data);
   }
+  writer.append(td::Slice("]}"));
 
- private:
-  td::Span<td::TQueue::Event> updates_;
-};
+  td::vector<td::BufferSlice> answer;
+  auto reader = writer.extract_reader();
+  while (!reader.empty()) {
+    answer.push_back(reader.read_as_buffer_slice());
+  }
+  query->set_ok(std::move(answer));
+  query.reset();  // send query into promise explicitly
+}
 
 void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQueryPtr query) {
-  auto &tqueue = parameters_->shared_data_->tqueue_;
+  auto &tqueue = parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_;
   LOG(DEBUG) << "Get updates with offset = " << offset << ", limit = " << limit << " and timeout = " << timeout;
   LOG(DEBUG) << "Queue head = " << tqueue->get_head(tqueue_id_) << ", queue tail = " << tqueue->get_tail(tqueue_id_);
 
@@ -9679,7 +9754,7 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     offset = tqueue->get_head(tqueue_id_).value();
   }
 
-  td::MutableSpan<td::TQueue::Event> updates(parameters_->shared_data_->event_buffer_,
+  td::MutableSpan<td::TQueue::Event> updates(parameters_->shared_data_->get_client_shard(tqueue_id_).event_buffer_,
                                              SharedData::TQUEUE_EVENT_BUFFER_SIZE);
   updates.truncate(limit);
   td::TQueue::EventId from;
@@ -9746,7 +9821,12 @@ void Client::do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQu
     send_request(make_object<td_api::setBotUpdatesStatus>(0, ""), td::make_unique<TdOnOkCallback>());
     was_bot_updates_warning_ = false;
   }
-  answer_query(JsonUpdates(updates), std::move(query));
+  answer_updates(updates, std::move(query));
+
+  // release references to the event data
+  for (auto &update : updates) {
+    update.data = {};
+  }
 }
 
 void Client::long_poll_wakeup(bool force_flag) {
@@ -10261,20 +10341,21 @@ void Client::add_update_impl(UpdateType update_type, const td::VirtuallyJsonable
 
   send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Update>, ServerBotStat::Update{}, td::Time::now());
 
-  const size_t BUF_SIZE = 1 << 16;
-  auto buf = td::StackAllocator::alloc(BUF_SIZE);
-  td::JsonBuilder jb(td::StringBuilder(buf.as_slice(), true));
-  jb.enter_value() << get_update_type_name(update_type);
-  jb.string_builder() << ":";
-  jb.enter_value() << update;
-  if (jb.string_builder().is_error()) {
-    LOG(ERROR) << "JSON buffer overflow";
-    return;
-  }
+  // the update is stored in the TQueue for a long time, so it is built in a standalone buffer, which is only slightly
+  // bigger than the previous update; the TQueue copies the update to an exactly-sized buffer if too much space is left
+  size_t copied_size = 0;
+  auto update_buffer = td::json_build_buffer(update_size_hint_, copied_size, [&](td::JsonBuilder &jb) {
+    jb.set_escape_non_ascii(parameters_->shared_data_->json_escape_non_ascii_);
+    jb.enter_value() << get_update_type_name(update_type);
+    jb.string_builder() << ":";
+    jb.enter_value() << update;
+  });
+  update_size_hint_ = td::max(update_buffer.size() + UPDATE_BUFFER_SIZE_RESERVE, MIN_UPDATE_BUFFER_SIZE);
 
-  auto update_slice = jb.string_builder().as_cslice();
-  auto r_id = parameters_->shared_data_->tqueue_->push(tqueue_id_, update_slice.str(), get_unix_time() + timeout,
-                                                       webhook_queue_id, td::TQueue::EventId());
+  auto update_slice = update_buffer.as_slice();
+  auto &tqueue = parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_;
+  auto r_id = tqueue->push(tqueue_id_, update_buffer.clone(), get_unix_time() + timeout, webhook_queue_id,
+                           td::TQueue::EventId());
   if (r_id.is_ok()) {
     auto id = r_id.move_as_ok();
     LOG(DEBUG) << "Update " << id << " was added for " << timeout << " seconds: " << update_slice;
@@ -11261,11 +11342,14 @@ td::int64 Client::get_basic_group_chat_id(int64 basic_group_id) {
 
 constexpr Client::int64 Client::GENERAL_MESSAGE_THREAD_ID;
 
+constexpr std::size_t Client::MIN_UPDATE_BUFFER_SIZE;
+constexpr std::size_t Client::UPDATE_BUFFER_SIZE_RESERVE;
+
 constexpr Client::int64 Client::GREAT_MINDS_SET_ID;
 constexpr Client::Slice Client::GREAT_MINDS_SET_NAME;
 
 constexpr Client::Slice Client::MASK_POINTS[MASK_POINTS_SIZE];
 
-td::FlatHashMap<td::string, td::Status (Client::*)(PromisedQueryPtr &query)> Client::methods_;
+td::vector<td::Status (Client::*)(PromisedQueryPtr &query)> Client::methods_;
 
 }  // namespace telegram_bot_api
@@ -26,6 +26,7 @@
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/Promise.h"
 #include "td/utils/Slice.h"
+#include "td/utils/Span.h"
 #include "td/utils/Status.h"
 #include "td/utils/WaitFreeHashMap.h"
 
@@ -53,9 +54,18 @@ class Client final : public WebhookActor::Callback {
 
   void close();
 
+  // closes the idle bot until the next request; queries received during closing fail with "retry after 1"
+  void hibernate();
+
+  // returns true, if the bot has no webhook, pending updates and unfinished requests
+  bool can_hibernate() const;
+
   // for stats
   ServerBotInfo get_bot_info() const;
 
+  // registers all methods in Query; must be called once before any query is created
+  static void init_methods();
+
  private:
   using int32 = td::int32;
   using int64 = td::int64;
@@ -77,6 +87,10 @@ class Client final : public WebhookActor::Callback {
 
   static constexpr std::size_t MIN_PENDING_UPDATES_WARNING = 200;
 
+  // smaller buffers are cut from chunks shared with other short-living data
+  static constexpr std::size_t MIN_UPDATE_BUFFER_SIZE = 512;
+  static constexpr std::size_t UPDATE_BUFFER_SIZE_RESERVE = 32;
+
   static constexpr int64 GREAT_MINDS_SET_ID = 1842540969984001;
   static constexpr Slice GREAT_MINDS_SET_NAME = "TelegramGreatMinds";
 
@@ -473,7 +487,7 @@ class Client final : public WebhookActor::Callback {
   void on_message_send_succeeded(object_ptr<td_api::message> &&message, int64 old_message_id);
   void on_message_send_failed(int64 chat_id, int64 old_message_id, int64 new_message_id, Status result);
 
-  static bool init_methods();
+  static void add_method(Slice method, Status (Client::*handler)(PromisedQueryPtr &query));
 
   static bool is_local_method(Slice method);
 
@@ -586,6 +600,8 @@ class Client final : public WebhookActor::Callback {
   void hangup_shared() final;
   const td::HttpFile *get_webhook_certificate(const Query *query) const;
   int32 get_webhook_max_connections(const Query *query) const;
+  static int32 get_webhook_max_batch_size(const Query *query);
+  static int32 get_webhook_gzip_min_size(const Query *query);
   static bool get_webhook_fix_ip_address(const Query *query);
   void do_set_webhook(PromisedQueryPtr query, bool was_deleted);
   void on_webhook_certificate_copied(Status status);
@@ -635,7 +651,7 @@ class Client final : public WebhookActor::Callback {
   static void fail_query_with_error(PromisedQueryPtr &&query, object_ptr<td_api::error> error,
                                     Slice default_message = Slice());
 
-  class JsonUpdates;
+  static void answer_updates(td::Span<td::TQueue::Event> updates, PromisedQueryPtr query);
   void do_get_updates(int32 offset, int32 limit, int32 timeout, PromisedQueryPtr query);
 
   void long_poll_wakeup(bool force_flag);
@@ -958,6 +974,7 @@ class Client final : public WebhookActor::Callback {
   bool is_api_id_invalid_ = false;
   bool need_close_ = false;
   bool clear_tqueue_ = false;
+  bool is_hibernating_ = false;
 
   td::ActorShared<> parent_;
   td::string bot_token_;
@@ -978,7 +995,8 @@ class Client final : public WebhookActor::Callback {
   int64 channel_bot_user_id_ = 0;
   int64 service_notifications_user_id_ = 0;
 
-  static td::FlatHashMap<td::string, Status (Client::*)(PromisedQueryPtr &query)> methods_;
+  // handlers of methods by their identifiers from Query::register_method
+  static td::vector<Status (Client::*)(PromisedQueryPtr &query)> methods_;
 
   td::WaitFreeHashMap<FullMessageId, td::unique_ptr<MessageInfo>, FullMessageIdHash> messages_;
   td::WaitFreeHashMap<int64, td::unique_ptr<UserInfo>> users_;
@@ -1056,7 +1074,11 @@ class Client final : public WebhookActor::Callback {
   td::ActorContext context_;
   std::queue<PromisedQueryPtr> cmd_queue_;
   td::vector<object_ptr<td_api::Object>> pending_updates_;
-  td::Container<td::unique_ptr<TdQueryCallback>> handlers_;
+  struct PendingTdRequest {
+    td::unique_ptr<TdQueryCallback> handler_;
+    double send_time_ = 0.0;
+  };
+  td::Container<PendingTdRequest> handlers_;
 
   static constexpr int32 LONG_POLL_MAX_TIMEOUT = 50;
   static constexpr double LONG_POLL_MAX_DELAY = 0.002;
@@ -1083,6 +1105,8 @@ class Client final : public WebhookActor::Callback {
   td::string webhook_url_;
   double webhook_set_time_ = 0;
   int32 webhook_max_connections_ = 0;
+  int32 webhook_max_batch_size_ = 0;
+  int32 webhook_gzip_min_size_ = 0;
   td::string webhook_ip_address_;
   bool webhook_fix_ip_address_ = false;
   td::string webhook_secret_token_;
@@ -1097,6 +1121,7 @@ class Client final : public WebhookActor::Callback {
 
   double disconnection_time_ = 0;         // the time when Connection state changed from "Ready", or 0 if it is "Ready"
   double last_update_creation_time_ = 0;  // the time when the last update was added
+  std::size_t update_size_hint_ = 1 << 10;  // the expected size of the next update JSON
   int32 last_synchronization_error_date_ = 0;  // the date of the last connection error
 
   int32 previous_get_updates_offset_ = -1;
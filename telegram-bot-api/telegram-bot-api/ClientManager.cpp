@@ -7,6 +7,8 @@
 #include "telegram-bot-api/ClientManager.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/Metrics.h"
+#include "telegram-bot-api/Query.h"
 #include "telegram-bot-api/WebhookActor.h"
 
 #include "td/telegram/ClientActor.h"
@@ -22,8 +24,10 @@
 
 #include "td/actor/MultiPromise.h"
 
+#include "td/utils/algorithm.h"
 #include "td/utils/common.h"
 #include "td/utils/format.h"
+#include "td/utils/HashTableUtils.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
 #include "td/utils/Parser.h"
@@ -52,16 +56,24 @@ void ClientManager::close(td::Promise<td::Unit> &&promise) {
 
   close_flag_ = true;
   watchdog_id_.reset();
-  dump_statistics();
+  if (client_shard_id_ == 0) {
+    dump_statistics();
+  }
+  pending_client_shard_close_count_ = client_shards_.size();
+  for (auto &client_shard : client_shards_) {
+    send_closure(client_shard, &ClientManager::close,
+                 td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Unit) {
+                   send_closure(actor_id, &ClientManager::on_client_shard_closed);
+                 }));
+  }
   auto ids = clients_.ids();
   for (auto id : ids) {
     auto *client_info = clients_.get(id);
     CHECK(client_info);
+    remove_client_route(*client_info);
     send_closure(client_info->client_, &Client::close);
   }
-  if (ids.empty()) {
-    close_db();
-  }
+  try_close_db();
 }
 
 void ClientManager::send(PromisedQueryPtr query) {
@@ -84,12 +96,27 @@ void ClientManager::send(PromisedQueryPtr query) {
     return fail_query(401, "Unauthorized: invalid token specified", std::move(query));
   }
 
+  auto tqueue_id = get_tqueue_id(user_id, query->is_test_dc());
+  auto client_shard_id = parameters_->shared_data_->get_client_shard_id(tqueue_id);
+  if (client_shard_id != client_shard_id_) {
+    CHECK(client_shard_id_ == 0);
+    CHECK(static_cast<size_t>(client_shard_id) <= client_shards_.size());
+    return send_closure(client_shards_[client_shard_id - 1], &ClientManager::send, std::move(query));
+  }
+
   if (query->is_test_dc()) {
     token += "/test";
   }
 
   auto id_it = token_to_id_.find(token);
   if (id_it == token_to_id_.end()) {
+    // a bot, which was hibernated recently, was already created once, so its restoration including the queries,
+    // which were received during hibernation, isn't limited by the Client creation flood control
+    bool is_hibernated = hibernated_tokens_.erase(token) != 0;
+    if (is_hibernated) {
+      LOG(INFO) << "Restore hibernated bot " << token;
+    }
+
     td::string ip_address;
     if (query->peer_address().is_valid() && !query->peer_address().is_reserved()) {  // external connection
       ip_address = query->peer_address().get_ip_str().str();
@@ -106,7 +133,7 @@ void ClientManager::send(PromisedQueryPtr query) {
       }
     }
     LOG(DEBUG) << "Receive incoming query for new bot " << token << " from " << query->peer_address();
-    if (!ip_address.empty()) {
+    if (!ip_address.empty() && !is_hibernated) {
       LOG(DEBUG) << "Check Client creation flood control for IP address " << ip_address;
       auto res = flood_controls_.emplace(std::move(ip_address), td::FloodControlFast());
       auto &flood_control = res.first->second;
@@ -122,13 +149,12 @@ void ClientManager::send(PromisedQueryPtr query) {
       }
       flood_control.add_event(now);
     }
-    auto tqueue_id = get_tqueue_id(user_id, query->is_test_dc());
     if (active_client_count_.count(tqueue_id) != 0) {
       // return query->set_retry_after_error(1);
     }
 
-    auto id =
-        clients_.create(ClientInfo{BotStatActor(stat_.actor_id(&stat_)), token, tqueue_id, td::ActorOwn<Client>()});
+    auto id = clients_.create(
+        ClientInfo{BotStatActor(stat_.actor_id(&stat_)), token, tqueue_id, td::ActorOwn<Client>(), false, {}});
     auto *client_info = clients_.get(id);
     client_info->client_ = td::create_actor<Client>(PSLICE() << "Client/" << token, actor_shared(this, id),
                                                     query->token().str(), query->is_test_dc(), tqueue_id, parameters_,
@@ -145,8 +171,18 @@ void ClientManager::send(PromisedQueryPtr query) {
     }
 
     std::tie(id_it, std::ignore) = token_to_id_.emplace(token, id);
+
+    // next queries for the bot will be sent directly to the Client
+    parameters_->shared_data_->client_routes_->add_client(tqueue_id, query->token(),
+                                                           client_info->client_.get());
+  }
+  auto *client_info = clients_.get(id_it->second);
+  if (client_info->is_hibernating_) {
+    // the query will be sent to the new Client after the old one is closed
+    client_info->pending_queries_.push_back(std::move(query));
+    return;
   }
-  send_closure(clients_.get(id_it->second)->client_, &Client::send,
+  send_closure(client_info->client_, &Client::send,
                std::move(query));  // will send 429 if the client is already closed
 }
 
@@ -189,11 +225,8 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
     promise.set_value(td::BufferSlice("Closing"));
     return;
   }
-  size_t buf_size = 1 << 14;
-  auto buf = td::StackAllocator::alloc(buf_size);
-  td::StringBuilder sb(buf.as_slice());
 
-  td::Slice id_filter;
+  td::string id_filter;
   int new_verbosity_level = -1;
   td::string tag;
   for (auto &arg : args) {
@@ -218,40 +251,66 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
     }
   }
 
+  PendingStats pending_stats;
+  pending_stats.promise_ = std::move(promise);
+  pending_stats.id_filter_ = std::move(id_filter);
+  collect_shard_stats(std::move(pending_stats));
+}
+
+void ClientManager::get_metrics(td::Promise<td::BufferSlice> promise) {
+  if (close_flag_) {
+    return promise.set_error(td::Status::Error(500, "Closing"));
+  }
+
+  PendingStats pending_stats;
+  pending_stats.promise_ = std::move(promise);
+  pending_stats.is_metrics_ = true;
+  collect_shard_stats(std::move(pending_stats));
+}
+
+void ClientManager::collect_shard_stats(PendingStats &&pending_stats) {
+  pending_stats.shard_stats_.push_back(do_get_shard_stats(pending_stats.id_filter_));
+  pending_stats.left_shard_count_ = client_shards_.size();
+  auto pending_stats_id = pending_stats_.create(std::move(pending_stats));
+  if (client_shards_.empty()) {
+    return finish_get_stats(pending_stats_id);
+  }
+
+  for (auto &client_shard : client_shards_) {
+    send_closure(client_shard, &ClientManager::get_shard_stats, pending_stats_.get(pending_stats_id)->id_filter_,
+                 td::PromiseCreator::lambda(
+                     [actor_id = actor_id(this), pending_stats_id](td::Result<ShardStats> r_shard_stats) {
+                       send_closure(actor_id, &ClientManager::on_get_shard_stats, pending_stats_id,
+                                    std::move(r_shard_stats));
+                     }));
+  }
+}
+
+void ClientManager::get_shard_stats(td::string id_filter, td::Promise<ShardStats> promise) {
+  if (close_flag_) {
+    return promise.set_error(td::Status::Error(500, "Closing"));
+  }
+  promise.set_value(do_get_shard_stats(id_filter));
+}
+
+ClientManager::ShardStats ClientManager::do_get_shard_stats(td::Slice id_filter) {
   auto now = td::Time::now();
   auto top_clients = get_top_clients(50, id_filter);
-  sb << stat_.get_description() << '\n';
-  if (id_filter.empty()) {
-    sb << "uptime\t" << now - parameters_->start_time_ << '\n';
-    sb << "bot_count\t" << clients_.size() << '\n';
-    sb << "active_bot_count\t" << top_clients.active_count << '\n';
-    auto r_mem_stat = td::mem_stat();
-    if (r_mem_stat.is_ok()) {
-      auto mem_stat = r_mem_stat.move_as_ok();
-      sb << "rss\t" << td::format::as_size(mem_stat.resident_size_) << '\n';
-      sb << "vm\t" << td::format::as_size(mem_stat.virtual_size_) << '\n';
-      sb << "rss_peak\t" << td::format::as_size(mem_stat.resident_size_peak_) << '\n';
-      sb << "vm_peak\t" << td::format::as_size(mem_stat.virtual_size_peak_) << '\n';
-    } else {
-      LOG(INFO) << "Failed to get memory statistics: " << r_mem_stat.error();
-    }
-
-    ServerCpuStat::update(td::Time::now());
-    auto cpu_stats = ServerCpuStat::instance().as_vector(td::Time::now());
-    for (auto &stat : cpu_stats) {
-      sb << stat.key_ << "\t" << stat.value_ << '\n';
-    }
 
-    sb << "buffer_memory\t" << td::format::as_size(td::BufferAllocator::get_buffer_mem()) << '\n';
-    sb << "active_webhook_connections\t" << WebhookActor::get_total_connection_count() << '\n';
-    sb << "active_requests\t" << parameters_->shared_data_->query_count_.load(std::memory_order_relaxed) << '\n';
-    sb << "active_network_queries\t" << td::get_pending_network_query_count(*parameters_->net_query_stats_) << '\n';
-    auto stats = stat_.as_vector(now);
-    for (auto &stat : stats) {
-      sb << stat.key_ << "\t" << stat.value_ << '\n';
-    }
+  ShardStats result;
+  result.client_shard_id_ = client_shard_id_;
+  result.bot_count_ = clients_.size();
+  result.active_bot_count_ = top_clients.active_count;
+  result.hibernated_bot_count_ = hibernated_tokens_.size();
+  result.stats_ = stat_.as_vector(now);
+  for (auto id : clients_.ids()) {
+    auto tqueue_id = clients_.get(id)->tqueue_id_;
+    result.pending_update_count_ += parameters_->shared_data_->get_client_shard(tqueue_id).tqueue_->get_size(tqueue_id);
   }
 
+  size_t buf_size = 1 << 14;
+  auto buf = td::StackAllocator::alloc(buf_size);
+  td::StringBuilder sb(buf.as_slice());
   for (auto top_client_id : top_clients.top_client_ids) {
     auto *client_info = clients_.get(top_client_id);
     CHECK(client_info);
@@ -282,6 +341,9 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
       if (bot_info.webhook_max_connections_ != parameters_->default_max_webhook_connections_) {
         sb << "webhook_max_connections\t" << bot_info.webhook_max_connections_ << '\n';
       }
+      if (bot_info.webhook_max_batch_size_ > 1) {
+        sb << "webhook_max_batch_size\t" << bot_info.webhook_max_batch_size_ << '\n';
+      }
     }
     sb << "head_update_id\t" << bot_info.head_update_id_ << '\n';
     if (bot_info.pending_update_count_ != 0) {
@@ -301,74 +363,312 @@ void ClientManager::get_stats(td::Promise<td::BufferSlice> promise,
     }
   }
   // ignore sb overflow
-  promise.set_value(td::BufferSlice(sb.as_cslice()));
+  result.top_clients_ = sb.as_cslice().str();
+  return result;
+}
+
+void ClientManager::on_get_shard_stats(td::uint64 pending_stats_id, td::Result<ShardStats> r_shard_stats) {
+  auto *pending_stats = pending_stats_.get(pending_stats_id);
+  CHECK(pending_stats != nullptr);
+  if (r_shard_stats.is_ok()) {
+    pending_stats->shard_stats_.push_back(r_shard_stats.move_as_ok());
+  }
+  CHECK(pending_stats->left_shard_count_ > 0);
+  if (--pending_stats->left_shard_count_ == 0) {
+    finish_get_stats(pending_stats_id);
+  }
+}
+
+// writes the non-empty buckets as "<lower bound>:<count>"
+static void store_binlog_sync_histogram(td::StringBuilder &sb, const td::uint64 *counts) {
+  bool is_first = true;
+  for (size_t i = 0; i < td::ConcurrentBinlog::SYNC_STATISTICS_BUCKET_COUNT; i++) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    if (!is_first) {
+      sb << ' ';
+    }
+    is_first = false;
+    sb << (i == 0 ? 0 : static_cast<td::uint64>(1) << i) << ':' << counts[i];
+  }
+}
+
+void ClientManager::finish_get_stats(td::uint64 pending_stats_id) {
+  auto pending_stats = std::move(*pending_stats_.get(pending_stats_id));
+  pending_stats_.erase(pending_stats_id);
+
+  auto &shard_stats = pending_stats.shard_stats_;
+  std::sort(shard_stats.begin(), shard_stats.end(), [](const ShardStats &lhs, const ShardStats &rhs) {
+    return lhs.client_shard_id_ < rhs.client_shard_id_;
+  });
+  if (pending_stats.is_metrics_) {
+    return pending_stats.promise_.set_value(get_metrics_text(shard_stats));
+  }
+
+  size_t buf_size = 1 << 14;
+  auto buf = td::StackAllocator::alloc(buf_size);
+  td::StringBuilder sb(buf.as_slice());
+
+  auto now = td::Time::now();
+  sb << stat_.get_description() << '\n';
+  if (pending_stats.id_filter_.empty()) {
+    size_t bot_count = 0;
+    td::int32 active_bot_count = 0;
+    size_t hibernated_bot_count = 0;
+    size_t pending_update_count = 0;
+    for (auto &stats : shard_stats) {
+      bot_count += stats.bot_count_;
+      active_bot_count += stats.active_bot_count_;
+      hibernated_bot_count += stats.hibernated_bot_count_;
+      pending_update_count += stats.pending_update_count_;
+    }
+    sb << "uptime\t" << now - parameters_->start_time_ << '\n';
+    sb << "bot_count\t" << bot_count << '\n';
+    sb << "active_bot_count\t" << active_bot_count << '\n';
+    if (parameters_->hibernation_timeout_ > 0) {
+      sb << "hibernated_bot_count\t" << hibernated_bot_count << '\n';
+    }
+    sb << "pending_update_count\t" << pending_update_count << '\n';
+    auto r_mem_stat = td::mem_stat();
+    if (r_mem_stat.is_ok()) {
+      auto mem_stat = r_mem_stat.move_as_ok();
+      sb << "rss\t" << td::format::as_size(mem_stat.resident_size_) << '\n';
+      sb << "vm\t" << td::format::as_size(mem_stat.virtual_size_) << '\n';
+      sb << "rss_peak\t" << td::format::as_size(mem_stat.resident_size_peak_) << '\n';
+      sb << "vm_peak\t" << td::format::as_size(mem_stat.virtual_size_peak_) << '\n';
+    } else {
+      LOG(INFO) << "Failed to get memory statistics: " << r_mem_stat.error();
+    }
+
+    ServerCpuStat::update(td::Time::now());
+    auto cpu_stats = ServerCpuStat::instance().as_vector(td::Time::now());
+    for (auto &stat : cpu_stats) {
+      sb << stat.key_ << "\t" << stat.value_ << '\n';
+    }
+
+    sb << "buffer_memory\t" << td::format::as_size(td::BufferAllocator::get_buffer_mem()) << '\n';
+    auto binlog_sync_statistics = td::ConcurrentBinlog::get_sync_statistics();
+    sb << "binlog_sync_batch_size\t";
+    store_binlog_sync_histogram(sb, binlog_sync_statistics.batch_size_counts);
+    sb << '\n';
+    sb << "binlog_sync_latency_us\t";
+    store_binlog_sync_histogram(sb, binlog_sync_statistics.latency_counts);
+    sb << '\n';
+    sb << "active_webhook_connections\t" << WebhookActor::get_total_connection_count() << '\n';
+    sb << "active_requests\t" << parameters_->shared_data_->query_count_.load(std::memory_order_relaxed) << '\n';
+    sb << "active_network_queries\t" << td::get_pending_network_query_count(*parameters_->net_query_stats_) << '\n';
+    if (parameters_->shared_data_->client_shard_count_ == 1) {
+      for (auto &stat : shard_stats[0].stats_) {
+        sb << stat.key_ << "\t" << stat.value_ << '\n';
+      }
+    } else {
+      sb << "client_shard_count\t" << parameters_->shared_data_->client_shard_count_ << '\n';
+      for (auto &stats : shard_stats) {
+        sb << '\n';
+        sb << "client_shard\t" << stats.client_shard_id_ << '\n';
+        sb << "bot_count\t" << stats.bot_count_ << '\n';
+        sb << "active_bot_count\t" << stats.active_bot_count_ << '\n';
+        if (parameters_->hibernation_timeout_ > 0) {
+          sb << "hibernated_bot_count\t" << stats.hibernated_bot_count_ << '\n';
+        }
+        sb << "pending_update_count\t" << stats.pending_update_count_ << '\n';
+        for (auto &stat : stats.stats_) {
+          sb << stat.key_ << "\t" << stat.value_ << '\n';
+        }
+      }
+    }
+  }
+
+  for (auto &stats : shard_stats) {
+    sb << stats.top_clients_;
+  }
+  // ignore sb overflow
+  pending_stats.promise_.set_value(td::BufferSlice(sb.as_cslice()));
+}
+
+td::BufferSlice ClientManager::get_metrics_text(const td::vector<ShardStats> &shard_stats) const {
+  td::StringBuilder sb;
+  auto store_shard_gauge = [&sb, &shard_stats](td::Slice name, td::Slice help, auto get_value) {
+    ServerMetrics::store_header(sb, name, "gauge", help);
+    for (auto &stats : shard_stats) {
+      sb << name << "{client_shard=\"" << stats.client_shard_id_ << "\"} " << get_value(stats) << '\n';
+    }
+  };
+  auto store_gauge = [&sb](td::Slice name, td::Slice help, auto value) {
+    ServerMetrics::store_header(sb, name, "gauge", help);
+    sb << name << ' ' << value << '\n';
+  };
+
+  store_gauge("telegram_bot_api_uptime_seconds", "Time since the server start",
+              static_cast<td::int64>(td::Time::now() - parameters_->start_time_));
+  store_shard_gauge("telegram_bot_api_bots", "Number of running bots",
+                    [](const ShardStats &stats) { return stats.bot_count_; });
+  store_shard_gauge("telegram_bot_api_active_bots", "Number of bots, which received requests recently",
+                    [](const ShardStats &stats) { return stats.active_bot_count_; });
+  store_shard_gauge("telegram_bot_api_hibernated_bots", "Number of hibernated bots",
+                    [](const ShardStats &stats) { return stats.hibernated_bot_count_; });
+  store_shard_gauge("telegram_bot_api_pending_updates", "Number of updates in TQueue, which weren't received by bots",
+                    [](const ShardStats &stats) { return stats.pending_update_count_; });
+  store_gauge("telegram_bot_api_active_requests", "Number of requests being handled",
+              parameters_->shared_data_->query_count_.load(std::memory_order_relaxed));
+  store_gauge("telegram_bot_api_active_webhook_connections", "Number of open webhook connections",
+              WebhookActor::get_total_connection_count());
+  store_gauge("telegram_bot_api_active_network_queries", "Number of pending network queries to Telegram servers",
+              td::get_pending_network_query_count(*parameters_->net_query_stats_));
+  store_gauge("telegram_bot_api_buffer_memory_bytes", "Size of memory used by buffers",
+              td::BufferAllocator::get_buffer_mem());
+  auto r_mem_stat = td::mem_stat();
+  if (r_mem_stat.is_ok()) {
+    store_gauge("telegram_bot_api_resident_memory_bytes", "Resident memory size",
+                r_mem_stat.ok().resident_size_);
+  }
+
+  ServerMetrics::instance().store_metrics(sb, Query::get_method_names());
+  return td::BufferSlice(sb.as_cslice());
 }
 
 td::int64 ClientManager::get_tqueue_id(td::int64 user_id, bool is_test_dc) {
   return user_id + (static_cast<td::int64>(is_test_dc) << 54);
 }
 
-void ClientManager::start_up() {
+void ClientManager::init_tqueue() {
   //NB: the same scheduler as for database in Td
-  auto scheduler_id = 1;
-
-  // init tqueue
-  {
-    auto load_start_time = td::Time::now();
-    auto tqueue_binlog = td::make_unique<td::TQueueBinlog<td::Binlog>>();
-    auto binlog = td::make_unique<td::Binlog>();
-    auto tqueue = td::TQueue::create();
+  auto scheduler_id = SharedData::get_database_scheduler_id();
+
+  auto load_start_time = td::Time::now();
+  auto &shared_data = parameters_->shared_data_;
+  auto client_shard_count = static_cast<size_t>(shared_data->client_shard_count_);
+  auto worker_count = td::clamp(static_cast<size_t>(td::thread::hardware_concurrency()), static_cast<size_t>(1),
+                                MAX_TQUEUE_REPLAY_THREAD_COUNT);
+
+  // the binlog is read and checked sequentially, but its events are parsed and added to TQueues in parallel;
+  // all events of a queue are replayed by the same worker in the binlog order
+  struct ReplayWorker {
+    td::vector<std::pair<size_t, const td::BinlogEvent *>> events;
+    td::vector<td::unique_ptr<td::TQueue>> tqueues;
     td::vector<td::uint64> failed_to_replay_log_event_ids;
     td::int64 loaded_event_count = 0;
-    binlog
-        ->init(parameters_->working_directory_ + "tqueue.binlog",
-               [&](const td::BinlogEvent &event) {
-                 if (tqueue_binlog->replay(event, *tqueue).is_error()) {
-                   failed_to_replay_log_event_ids.push_back(event.id_);
-                 } else {
-                   loaded_event_count++;
-                 }
-               })
-        .ensure();
-    tqueue_binlog.reset();
-
-    if (!failed_to_replay_log_event_ids.empty()) {
-      LOG(ERROR) << "Failed to replay " << failed_to_replay_log_event_ids.size() << " TQueue events";
-      for (auto &log_event_id : failed_to_replay_log_event_ids) {
-        binlog->erase(log_event_id);
+  };
+  td::vector<ReplayWorker> workers(worker_count);
+  td::vector<td::uint64> failed_to_replay_log_event_ids;
+  auto binlog = td::make_unique<td::Binlog>();
+  binlog
+      ->init(parameters_->working_directory_ + "tqueue.binlog",
+             [&](const td::BinlogEvent &event) {
+               // events are owned by the binlog and aren't changed until it is modified
+               auto r_queue_id = td::TQueueBinlog<td::Binlog>::get_queue_id(event);
+               if (r_queue_id.is_error()) {
+                 failed_to_replay_log_event_ids.push_back(event.id_);
+                 return;
+               }
+               auto queue_id = r_queue_id.ok();
+               auto worker_id = td::Hash<td::int64>()(queue_id) % worker_count;
+               workers[worker_id].events.emplace_back(shared_data->get_client_shard_id(queue_id), &event);
+             })
+      .ensure();
+
+  auto replay_start_time = td::Time::now();
+  auto replay_events = [&workers, client_shard_count](size_t worker_id) {
+    auto &worker = workers[worker_id];
+    worker.tqueues.resize(client_shard_count);
+    td::TQueueBinlog<td::Binlog> tqueue_binlog;
+    for (auto &shard_event : worker.events) {
+      auto &tqueue = worker.tqueues[shard_event.first];
+      if (tqueue == nullptr) {
+        tqueue = td::TQueue::create();
+      }
+      if (tqueue_binlog.replay(*shard_event.second, *tqueue).is_error()) {
+        worker.failed_to_replay_log_event_ids.push_back(shard_event.second->id_);
+      } else {
+        worker.loaded_event_count++;
+      }
+    }
+    td::reset_to_empty(worker.events);
+  };
+  td::vector<td::thread> threads;
+  for (size_t i = 1; i < worker_count; i++) {
+    threads.emplace_back(replay_events, i);
+  }
+  replay_events(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  td::vector<td::unique_ptr<td::TQueue>> tqueues;
+  for (size_t i = 0; i < client_shard_count; i++) {
+    tqueues.push_back(td::TQueue::create());
+  }
+  td::int64 loaded_event_count = 0;
+  for (auto &worker : workers) {
+    for (size_t i = 0; i < client_shard_count; i++) {
+      if (worker.tqueues[i] != nullptr) {
+        tqueues[i]->merge(std::move(worker.tqueues[i]));
       }
     }
+    td::append(failed_to_replay_log_event_ids, worker.failed_to_replay_log_event_ids);
+    loaded_event_count += worker.loaded_event_count;
+  }
+  workers.clear();
+
+  if (!failed_to_replay_log_event_ids.empty()) {
+    LOG(ERROR) << "Failed to replay " << failed_to_replay_log_event_ids.size() << " TQueue events";
+    for (auto &log_event_id : failed_to_replay_log_event_ids) {
+      binlog->erase(log_event_id);
+    }
+  }
 
-    auto concurrent_binlog = std::make_shared<td::ConcurrentBinlog>(std::move(binlog), scheduler_id);
+  // all client shards share the same binlog
+  auto concurrent_binlog = std::make_shared<td::ConcurrentBinlog>(std::move(binlog), scheduler_id);
+  for (auto &tqueue : tqueues) {
     auto concurrent_tqueue_binlog = td::make_unique<td::TQueueBinlog<td::BinlogInterface>>();
-    concurrent_tqueue_binlog->set_binlog(std::move(concurrent_binlog));
+    concurrent_tqueue_binlog->set_binlog(concurrent_binlog);
     tqueue->set_callback(std::move(concurrent_tqueue_binlog));
 
-    parameters_->shared_data_->tqueue_ = std::move(tqueue);
-
-    LOG(WARNING) << "Loaded " << loaded_event_count << " TQueue events in " << (td::Time::now() - load_start_time)
-                 << " seconds";
-    next_tqueue_gc_time_ = td::Time::now() + 600;
+    auto client_shard = td::make_unique<SharedData::ClientShard>();
+    client_shard->tqueue_ = std::move(tqueue);
+    shared_data->client_shards_.push_back(std::move(client_shard));
   }
+  tqueue_binlog_ = std::move(concurrent_binlog);
 
-  // init webhook_db
-  auto concurrent_webhook_db = td::make_unique<td::BinlogKeyValue<td::ConcurrentBinlog>>();
-  auto status = concurrent_webhook_db->init(parameters_->working_directory_ + "webhooks_db.binlog", td::DbKey::empty(),
-                                            scheduler_id);
-  LOG_IF(FATAL, status.is_error()) << "Can't open webhooks_db.binlog " << status;
-  parameters_->shared_data_->webhook_db_ = std::move(concurrent_webhook_db);
+  LOG(WARNING) << "Loaded " << loaded_event_count << " TQueue events in " << (td::Time::now() - load_start_time)
+               << " seconds, including " << (td::Time::now() - replay_start_time) << " seconds spent to replay them in "
+               << worker_count << " threads";
+}
 
-  auto &webhook_db = *parameters_->shared_data_->webhook_db_;
-  for (auto key_value : webhook_db.get_all()) {
-    if (!token_range_(td::to_integer<td::uint64>(key_value.first))) {
-      LOG(WARNING) << "DROP WEBHOOK: " << key_value.first << " ---> " << key_value.second;
-      webhook_db.erase(key_value.first);
-      continue;
+void ClientManager::start_up() {
+  stat_ = BotStatActor(td::ActorId<BotStatActor>());
+
+  if (client_shard_id_ == 0) {
+    init_tqueue();
+
+    // init webhook_db
+    auto concurrent_webhook_db = td::make_unique<td::BinlogKeyValue<td::ConcurrentBinlog>>();
+    auto status = concurrent_webhook_db->init(parameters_->working_directory_ + "webhooks_db.binlog",
+                                              td::DbKey::empty(), SharedData::get_database_scheduler_id());
+    LOG_IF(FATAL, status.is_error()) << "Can't open webhooks_db.binlog " << status;
+    parameters_->shared_data_->webhook_db_ = std::move(concurrent_webhook_db);
+
+    // launch other client shards
+    for (td::int32 i = 1; i < parameters_->shared_data_->client_shard_count_; i++) {
+      client_shards_.push_back(td::create_actor_on_scheduler<ClientManager>(
+          PSLICE() << "ClientManager" << i, parameters_->shared_data_->get_client_scheduler_id(i), parameters_,
+          token_range_, i));
     }
 
-    auto query = get_webhook_restore_query(key_value.first, key_value.second, parameters_->shared_data_);
-    send_closure_later(actor_id(this), &ClientManager::send, std::move(query));
+    auto &webhook_db = *parameters_->shared_data_->webhook_db_;
+    for (auto key_value : webhook_db.get_all()) {
+      if (!token_range_(td::to_integer<td::uint64>(key_value.first))) {
+        LOG(WARNING) << "DROP WEBHOOK: " << key_value.first << " ---> " << key_value.second;
+        webhook_db.erase(key_value.first);
+        continue;
+      }
+
+      auto query = get_webhook_restore_query(key_value.first, key_value.second, parameters_->shared_data_);
+      send_closure_later(actor_id(this), &ClientManager::send, std::move(query));
+    }
   }
+  next_tqueue_gc_time_ = td::Time::now() + 600;
 
   // launch watchdog
   watchdog_id_ = td::create_actor_on_scheduler<Watchdog>(
@@ -406,6 +706,16 @@ PromisedQueryPtr ClientManager::get_webhook_restore_query(td::Slice token, td::S
     parser.skip('/');
   }
 
+  if (parser.try_skip("#batch")) {
+    args.emplace_back(add_string("max_batch_size"), add_string(parser.read_till('/')));
+    parser.skip('/');
+  }
+
+  if (parser.try_skip("#gzip")) {
+    args.emplace_back(add_string("gzip_min_size"), add_string(parser.read_till('/')));
+    parser.skip('/');
+  }
+
   if (parser.try_skip("#ip")) {
     args.emplace_back(add_string("ip_address"), add_string(parser.read_till('/')));
     parser.skip('/');
@@ -489,6 +799,13 @@ void ClientManager::dump_statistics() {
 
   td::dump_pending_network_queries(*parameters_->net_query_stats_);
 
+  dump_top_clients();
+  for (auto &client_shard : client_shards_) {
+    send_closure(client_shard, &ClientManager::dump_top_clients);
+  }
+}
+
+void ClientManager::dump_top_clients() {
   auto now = td::Time::now();
   auto top_clients = get_top_clients(10, {});
   for (auto top_client_id : top_clients.top_client_ids) {
@@ -547,7 +864,8 @@ void ClientManager::timeout_expired() {
     LOG(INFO) << "Run TQueue GC at " << unix_time;
     td::int64 deleted_events;
     bool is_finished;
-    std::tie(deleted_events, is_finished) = parameters_->shared_data_->tqueue_->run_gc(unix_time);
+    auto &tqueue = parameters_->shared_data_->client_shards_[client_shard_id_]->tqueue_;
+    std::tie(deleted_events, is_finished) = tqueue->run_gc(unix_time);
     LOG(INFO) << "TQueue GC deleted " << deleted_events << " events";
     next_tqueue_gc_time_ = td::Time::now() + (is_finished ? 60.0 : 1.0);
 
@@ -556,21 +874,100 @@ void ClientManager::timeout_expired() {
       LOG(WARNING) << "TQueue GC already deleted " << tqueue_deleted_events_ << " events since the start";
       last_tqueue_deleted_events_ = tqueue_deleted_events_;
     }
+
+    if (is_finished && tqueue_binlog_ != nullptr) {
+      // keep the binlog close to the size of alive events, so it is replayed fast after a restart,
+      // even if the server isn't closed cleanly
+      tqueue_binlog_->reindex_if_needed(TQUEUE_BINLOG_REINDEX_MIN_SIZE, TQUEUE_BINLOG_MAX_OVERHEAD_PERCENT);
+    }
+  }
+
+  if (parameters_->hibernation_timeout_ > 0 && now > next_hibernation_time_ && !close_flag_) {
+    hibernate_idle_clients(now);
+    delete_expired_hibernated_tokens(now);
+    next_hibernation_time_ = now + HIBERNATION_CHECK_PERIOD;
+  }
+}
+
+void ClientManager::hibernate_idle_clients(double now) {
+  auto min_activity_timestamp = now - parameters_->hibernation_timeout_;
+  size_t hibernated_client_count = 0;
+  for (auto id : clients_.ids()) {
+    auto *client_info = clients_.get(id);
+    CHECK(client_info);
+    if (client_info->is_hibernating_ || client_info->stat_.get_last_activity_timestamp() > min_activity_timestamp ||
+        client_info->stat_.get_active_request_count() != 0 ||
+        !client_info->client_.get_actor_unsafe()->can_hibernate()) {
+      continue;
+    }
+
+    // new queries must be sent through the ClientManager to be delayed until the Client is closed
+    client_info->is_hibernating_ = true;
+    remove_client_route(*client_info);
+    send_closure(client_info->client_, &Client::hibernate);
+
+    // close not too many TDLib instances simultaneously
+    if (++hibernated_client_count == MAX_HIBERNATED_CLIENTS_PER_CHECK) {
+      break;
+    }
+  }
+  if (hibernated_client_count != 0) {
+    LOG(INFO) << "Hibernate " << hibernated_client_count << " idle bots";
   }
 }
 
+void ClientManager::delete_expired_hibernated_tokens(double now) {
+  // bots, which weren't used for a long time, are restored as new bots
+  auto min_hibernation_time = now - HIBERNATED_TOKEN_EXPIRE_TIME;
+  td::table_remove_if(hibernated_tokens_,
+                      [min_hibernation_time](const auto &it) { return it.second < min_hibernation_time; });
+}
+
 void ClientManager::hangup_shared() {
   auto id = get_link_token();
   auto *info = clients_.get(id);
   CHECK(info != nullptr);
   info->client_.release();
+  remove_client_route(*info);
   token_to_id_.erase(info->token_);
+  auto pending_queries = std::move(info->pending_queries_);
+  if (info->is_hibernating_) {
+    hibernated_tokens_[info->token_] = td::Time::now();
+  }
   clients_.erase(id);
 
+  // create a new Client for queries received during hibernation
+  for (auto &query : pending_queries) {
+    send(std::move(query));
+  }
+
   if (close_flag_ && clients_.empty()) {
     CHECK(active_client_count_.empty());
-    close_db();
+    try_close_db();
+  }
+}
+
+void ClientManager::remove_client_route(const ClientInfo &client_info) {
+  td::Slice token = client_info.token_;
+  token.truncate(token.find('/'));  // remove "/test" suffix
+  parameters_->shared_data_->client_routes_->remove_client(client_info.tqueue_id_, token);
+}
+
+void ClientManager::on_client_shard_closed() {
+  CHECK(pending_client_shard_close_count_ > 0);
+  pending_client_shard_close_count_--;
+  try_close_db();
+}
+
+void ClientManager::try_close_db() {
+  if (!close_flag_ || !clients_.empty() || pending_client_shard_close_count_ != 0) {
+    return;
+  }
+  if (client_shard_id_ != 0) {
+    // databases are closed by the shard 0
+    return finish_close();
   }
+  close_db();
 }
 
 void ClientManager::close_db() {
@@ -581,7 +978,25 @@ void ClientManager::close_db() {
   mpas.set_ignore_errors(true);
 
   auto lock = mpas.get_promise();
-  parameters_->shared_data_->tqueue_->close(mpas.get_promise());
+  auto &client_shards = parameters_->shared_data_->client_shards_;
+
+  // the binlog is compacted periodically after TQueue GC; before closing, only a time-limited GC pass is run and
+  // the binlog is compacted if the pass left it sparse enough
+  auto gc_start_time = td::Time::now();
+  auto unix_time = parameters_->shared_data_->get_unix_time(gc_start_time);
+  td::int64 deleted_events = 0;
+  for (auto &client_shard : client_shards) {
+    deleted_events += client_shard->tqueue_->run_gc(unix_time).first;
+  }
+  LOG(WARNING) << "Deleted " << deleted_events << " expired TQueue events in " << (td::Time::now() - gc_start_time)
+               << " seconds";
+  tqueue_binlog_->reindex_if_needed(TQUEUE_BINLOG_REINDEX_MIN_SIZE, TQUEUE_BINLOG_MAX_OVERHEAD_PERCENT);
+
+  for (size_t i = 1; i < client_shards.size(); i++) {
+    // the binlog is shared and will be closed with the first TQueue
+    client_shards[i]->tqueue_->extract_callback();
+  }
+  client_shards[0]->tqueue_->close(mpas.get_promise());
   parameters_->shared_data_->webhook_db_->close(mpas.get_promise());
   lock.set_value(td::Unit());
 }
@@ -596,5 +1011,6 @@ void ClientManager::finish_close() {
 }
 
 constexpr double ClientManager::WATCHDOG_TIMEOUT;
+constexpr size_t ClientManager::MAX_TQUEUE_REPLAY_THREAD_COUNT;
 
 }  // namespace telegram_bot_api
@@ -24,6 +24,10 @@
 #include <memory>
 #include <utility>
 
+namespace td {
+class ConcurrentBinlog;
+}  // namespace td
+
 namespace telegram_bot_api {
 
 struct ClientParameters;
@@ -38,8 +42,9 @@ class ClientManager final : public td::Actor {
       return x % mod == rem;
     }
   };
-  ClientManager(std::shared_ptr<const ClientParameters> parameters, TokenRange token_range)
-      : parameters_(std::move(parameters)), token_range_(token_range) {
+  ClientManager(std::shared_ptr<const ClientParameters> parameters, TokenRange token_range,
+                td::int32 client_shard_id = 0)
+      : parameters_(std::move(parameters)), token_range_(token_range), client_shard_id_(client_shard_id) {
   }
 
   void dump_statistics();
@@ -48,8 +53,13 @@ class ClientManager final : public td::Actor {
 
   void get_stats(td::Promise<td::BufferSlice> promise, td::vector<std::pair<td::string, td::string>> args);
 
+  // returns metrics in the Prometheus text format
+  void get_metrics(td::Promise<td::BufferSlice> promise);
+
   void close(td::Promise<td::Unit> &&promise);
 
+  static td::int64 get_tqueue_id(td::int64 user_id, bool is_test_dc);
+
  private:
   class ClientInfo {
    public:
@@ -57,28 +67,60 @@ class ClientManager final : public td::Actor {
     td::string token_;
     td::int64 tqueue_id_;
     td::ActorOwn<Client> client_;
+    bool is_hibernating_ = false;
+    td::vector<PromisedQueryPtr> pending_queries_;  // queries received during hibernation
   };
   td::Container<ClientInfo> clients_;
-  BotStatActor stat_{td::ActorId<BotStatActor>()};
+  BotStatActor stat_;  // must be registered on the scheduler of the partition
 
   std::shared_ptr<const ClientParameters> parameters_;
   TokenRange token_range_;
 
+  // partitions of the client shards 1, 2, ...; owned by the ClientManager of the shard 0
+  td::int32 client_shard_id_ = 0;
+  td::vector<td::ActorOwn<ClientManager>> client_shards_;
+  size_t pending_client_shard_close_count_ = 0;
+
+  struct ShardStats {
+    td::int32 client_shard_id_ = 0;
+    size_t bot_count_ = 0;
+    td::int32 active_bot_count_ = 0;
+    size_t hibernated_bot_count_ = 0;
+    size_t pending_update_count_ = 0;
+    td::vector<StatItem> stats_;
+    td::string top_clients_;
+  };
+  struct PendingStats {
+    td::Promise<td::BufferSlice> promise_;
+    td::string id_filter_;
+    bool is_metrics_ = false;
+    td::vector<ShardStats> shard_stats_;
+    size_t left_shard_count_ = 0;
+  };
+  td::Container<PendingStats> pending_stats_;
+
   td::FlatHashMap<td::string, td::uint64> token_to_id_;
   td::FlatHashMap<td::string, td::FloodControlFast> flood_controls_;
   td::FlatHashMap<td::int64, td::uint64> active_client_count_;
+  td::FlatHashMap<td::string, double> hibernated_tokens_;  // token -> time of hibernation
 
   bool close_flag_ = false;
   td::vector<td::Promise<td::Unit>> close_promises_;
 
   td::ActorOwn<Watchdog> watchdog_id_;
   double next_tqueue_gc_time_ = 0.0;
+  double next_hibernation_time_ = 0.0;
   td::int64 tqueue_deleted_events_ = 0;
   td::int64 last_tqueue_deleted_events_ = 0;
+  std::shared_ptr<td::ConcurrentBinlog> tqueue_binlog_;
 
   static constexpr double WATCHDOG_TIMEOUT = 0.25;
-
-  static td::int64 get_tqueue_id(td::int64 user_id, bool is_test_dc);
+  static constexpr size_t MAX_TQUEUE_REPLAY_THREAD_COUNT = 16;
+  static constexpr double HIBERNATION_CHECK_PERIOD = 10.0;
+  static constexpr size_t MAX_HIBERNATED_CLIENTS_PER_CHECK = 100;
+  static constexpr double HIBERNATED_TOKEN_EXPIRE_TIME = 86400.0;  // the maximum lifetime of an update
+  static constexpr td::int64 TQUEUE_BINLOG_REINDEX_MIN_SIZE = static_cast<td::int64>(10) << 20;
+  static constexpr td::int64 TQUEUE_BINLOG_MAX_OVERHEAD_PERCENT = 50;
 
   static PromisedQueryPtr get_webhook_restore_query(td::Slice token, td::Slice webhook_info,
                                                     std::shared_ptr<SharedData> shared_data);
@@ -89,10 +131,33 @@ class ClientManager final : public td::Actor {
   };
   TopClients get_top_clients(std::size_t max_count, td::Slice token_filter);
 
+  void collect_shard_stats(PendingStats &&pending_stats);
+
+  void get_shard_stats(td::string id_filter, td::Promise<ShardStats> promise);
+
+  ShardStats do_get_shard_stats(td::Slice id_filter);
+
+  void on_get_shard_stats(td::uint64 pending_stats_id, td::Result<ShardStats> r_shard_stats);
+
+  void finish_get_stats(td::uint64 pending_stats_id);
+
+  td::BufferSlice get_metrics_text(const td::vector<ShardStats> &shard_stats) const;
+
+  void dump_top_clients();
+
+  void init_tqueue();
+
+  void hibernate_idle_clients(double now);
+
+  void delete_expired_hibernated_tokens(double now);
+
   void start_up() final;
   void raw_event(const td::Event::Raw &event) final;
   void timeout_expired() final;
   void hangup_shared() final;
+  void remove_client_route(const ClientInfo &client_info);
+  void on_client_shard_closed();
+  void try_close_db();
   void close_db();
   void finish_close();
 };
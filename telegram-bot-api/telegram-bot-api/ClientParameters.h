@@ -6,6 +6,8 @@
 //
 #pragma once
 
+#include "telegram-bot-api/ClientRoutes.h"
+
 #include "td/db/KeyValueSyncInterface.h"
 #include "td/db/TQueue.h"
 
@@ -14,6 +16,7 @@
 #include "td/actor/actor.h"
 
 #include "td/utils/common.h"
+#include "td/utils/HashTableUtils.h"
 #include "td/utils/List.h"
 #include "td/utils/port/IPAddress.h"
 
@@ -32,15 +35,42 @@ struct SharedData {
   std::atomic<size_t> query_list_size_{0};
   std::atomic<int> next_verbosity_level_{-1};
 
-  // not thread-safe, must be used from a single thread
+  // not thread-safe, must be used only from the scheduler get_client_scheduler_id(0)
   td::ListNode query_list_;
   td::unique_ptr<td::KeyValueSyncInterface> webhook_db_;
-  td::unique_ptr<td::TQueue> tqueue_;
 
   double unix_time_difference_{-1e100};
 
   static constexpr size_t TQUEUE_EVENT_BUFFER_SIZE = 1000;
-  td::TQueue::Event event_buffer_[TQUEUE_EVENT_BUFFER_SIZE];
+
+  // not thread-safe, must be used only from the scheduler of the corresponding client shard
+  struct ClientShard {
+    td::unique_ptr<td::TQueue> tqueue_;
+    td::TQueue::Event event_buffer_[TQUEUE_EVENT_BUFFER_SIZE];
+  };
+  td::vector<td::unique_ptr<ClientShard>> client_shards_;
+
+  // thread-safe, must be created before the schedulers are started
+  td::unique_ptr<ClientRoutes> client_routes_;
+
+  // must not be changed after the schedulers are started
+  td::int32 client_shard_count_ = 1;
+  td::int32 http_scheduler_count_ = 0;
+  // if false, then non-ASCII characters in JSON responses and updates are written as UTF-8 instead of \u escapes
+  bool json_escape_non_ascii_ = true;
+
+  td::int32 get_client_shard_id(td::int64 tqueue_id) const {
+    if (client_shard_count_ == 1) {
+      return 0;
+    }
+    return static_cast<td::int32>(td::Hash<td::int64>()(tqueue_id) % static_cast<td::uint32>(client_shard_count_));
+  }
+
+  ClientShard &get_client_shard(td::int64 tqueue_id) {
+    auto client_shard_id = get_client_shard_id(tqueue_id);
+    CHECK(static_cast<size_t>(client_shard_id) < client_shards_.size());
+    return *client_shards_[client_shard_id];
+  }
 
   td::int32 get_unix_time(double now) const {
     auto result = unix_time_difference_ + now;
@@ -62,6 +92,29 @@ struct SharedData {
     // the same scheduler as for file GC in Td
     return 2;
   }
+
+  td::int32 get_td_scheduler_id(td::int32 client_shard_id) const {
+    // Td uses 3 next schedulers for database, file GC and slow network queries
+    // the shard 0 Td shares the first scheduler with the main thread
+    return 4 * client_shard_id;
+  }
+
+  td::int32 get_client_scheduler_id(td::int32 client_shard_id) const {
+    // the thread for ClientManager partition and all Clients of the shard
+    return 4 * client_shard_count_ + client_shard_id;
+  }
+
+  td::int32 get_http_scheduler_id(td::int32 http_scheduler_id) const {
+    // the thread for a separate HTTP listener, which accepts connections and parses requests on its own
+    return get_client_scheduler_id(client_shard_count_ - 1) + 1 + http_scheduler_id;
+  }
+
+  td::int32 get_thread_count() const {
+    // one thread for watchdogs
+    // one thread for ClientManager watchdogs
+    // one thread for slow HTTP connections and DNS resolving
+    return get_client_scheduler_id(client_shard_count_ - 1) + http_scheduler_count_ + 3;
+  }
 };
 
 struct ClientParameters {
@@ -76,8 +129,21 @@ struct ClientParameters {
   td::string version_;
 
   td::int32 default_max_webhook_connections_ = 0;
+  td::int32 max_webhook_pipelined_requests_ = 1;
+  td::int32 warm_webhook_connections_ = 0;
+  // gzip compression level for webhook request bodies of bots, which enabled their compression
+  td::int32 webhook_compression_level_ = 6;
   td::IPAddress webhook_proxy_ip_address_;
 
+  // responses are compressed only if the client supports it; compression level 0 disables compression;
+  // compression is done only in separate HTTP threads, so it is disabled if there are none
+  td::int32 http_compression_level_ = 0;
+  td::int32 http_compression_min_size_ = 1024;
+
+  // bots without webhook, pending updates and requests during the timeout are closed until the next request;
+  // timeout 0 disables hibernation
+  td::int32 hibernation_timeout_ = 0;
+
   double start_time_ = 0;
 
   td::ActorId<td::GetHostByNameActor> get_host_by_name_actor_id_;
@@ -0,0 +1,106 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/ClientRoutes.h"
+
+#include "telegram-bot-api/ClientManager.h"
+
+#include "td/utils/algorithm.h"
+#include "td/utils/HashTableUtils.h"
+#include "td/utils/logging.h"
+#include "td/utils/misc.h"
+
+namespace telegram_bot_api {
+
+ClientRoutes::ClientRoutes(size_t scheduler_count) : hazard_pointers_(scheduler_count) {
+  for (auto &bucket : buckets_) {
+    bucket.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+ClientRoutes::~ClientRoutes() {
+  for (auto &bucket : buckets_) {
+    td::unique_ptr<Bucket>(bucket.exchange(nullptr)).reset();
+  }
+}
+
+size_t ClientRoutes::get_bucket_id(td::int64 tqueue_id) {
+  return td::Hash<td::int64>()(tqueue_id) % BUCKET_COUNT;
+}
+
+size_t ClientRoutes::get_scheduler_id() const {
+  auto scheduler_id = td::Scheduler::instance()->sched_id();
+  CHECK(scheduler_id >= 0);
+  return static_cast<size_t>(scheduler_id);
+}
+
+td::ActorId<Client> ClientRoutes::get_client(td::Slice token, bool is_test_dc) {
+  auto r_user_id = td::to_integer_safe<td::int64>(token.substr(0, token.find(':')));
+  if (r_user_id.is_error()) {
+    return td::ActorId<Client>();
+  }
+  auto tqueue_id = ClientManager::get_tqueue_id(r_user_id.ok(), is_test_dc);
+
+  td::HazardPointers<Bucket>::Holder holder(hazard_pointers_, get_scheduler_id(), 0);
+  auto *bucket = holder.protect(buckets_[get_bucket_id(tqueue_id)]);
+  if (bucket == nullptr) {
+    return td::ActorId<Client>();
+  }
+  for (auto &route : *bucket) {
+    if (route.tqueue_id_ == tqueue_id && route.token_ == token) {
+      return route.client_;
+    }
+  }
+  return td::ActorId<Client>();
+}
+
+template <class F>
+void ClientRoutes::update_bucket(td::int64 tqueue_id, F &&update) {
+  auto scheduler_id = get_scheduler_id();
+  auto &bucket = buckets_[get_bucket_id(tqueue_id)];
+  td::HazardPointers<Bucket>::Holder holder(hazard_pointers_, scheduler_id, 0);
+  while (true) {
+    auto *old_bucket = holder.protect(bucket);
+    auto new_bucket = old_bucket == nullptr ? td::make_unique<Bucket>() : td::make_unique<Bucket>(*old_bucket);
+    if (!update(*new_bucket)) {
+      return;
+    }
+    if (new_bucket->empty()) {
+      new_bucket = nullptr;
+    }
+    // buckets can be changed concurrently by ClientManagers of other client shards
+    if (bucket.compare_exchange_strong(old_bucket, new_bucket.get())) {
+      new_bucket.release();
+      holder.clear();
+      if (old_bucket != nullptr) {
+        hazard_pointers_.retire(scheduler_id, old_bucket);
+      }
+      return;
+    }
+  }
+}
+
+void ClientRoutes::add_client(td::int64 tqueue_id, td::Slice token, td::ActorId<Client> client) {
+  update_bucket(tqueue_id, [&](Bucket &bucket) {
+    for (auto &route : bucket) {
+      if (route.tqueue_id_ == tqueue_id && route.token_ == token) {
+        route.client_ = client;
+        return true;
+      }
+    }
+    bucket.push_back(Route{tqueue_id, token.str(), client});
+    return true;
+  });
+}
+
+void ClientRoutes::remove_client(td::int64 tqueue_id, td::Slice token) {
+  update_bucket(tqueue_id, [&](Bucket &bucket) {
+    return td::remove_if(bucket,
+                         [&](const Route &route) { return route.tqueue_id_ == tqueue_id && route.token_ == token; });
+  });
+}
+
+}  // namespace telegram_bot_api
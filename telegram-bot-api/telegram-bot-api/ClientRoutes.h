@@ -0,0 +1,65 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/actor/actor.h"
+
+#include "td/utils/common.h"
+#include "td/utils/HazardPointers.h"
+#include "td/utils/Slice.h"
+
+#include <array>
+#include <atomic>
+
+namespace telegram_bot_api {
+
+class Client;
+
+// Routes queries for already running bots directly to their Client actors, bypassing ClientManager.
+// Routes are added and removed by the ClientManager owning the bot, but can be read lock-free
+// from any scheduler thread with an identifier less than scheduler_count.
+class ClientRoutes {
+ public:
+  explicit ClientRoutes(size_t scheduler_count);
+  ClientRoutes(const ClientRoutes &) = delete;
+  ClientRoutes &operator=(const ClientRoutes &) = delete;
+  ClientRoutes(ClientRoutes &&) = delete;
+  ClientRoutes &operator=(ClientRoutes &&) = delete;
+  ~ClientRoutes();
+
+  // returns an empty ActorId if there is no route for the bot; the query must be sent to ClientManager then
+  td::ActorId<Client> get_client(td::Slice token, bool is_test_dc);
+
+  void add_client(td::int64 tqueue_id, td::Slice token, td::ActorId<Client> client);
+
+  void remove_client(td::int64 tqueue_id, td::Slice token);
+
+ private:
+  struct Route {
+    td::int64 tqueue_id_;
+    td::string token_;
+    td::ActorId<Client> client_;
+  };
+
+  // buckets are never changed after they are published
+  using Bucket = td::vector<Route>;
+
+  static constexpr size_t BUCKET_COUNT = 1 << 12;
+
+  std::array<std::atomic<Bucket *>, BUCKET_COUNT> buckets_;
+  td::HazardPointers<Bucket> hazard_pointers_;
+
+  static size_t get_bucket_id(td::int64 tqueue_id);
+
+  size_t get_scheduler_id() const;
+
+  // update must return whether the copy of the bucket was changed
+  template <class F>
+  void update_bucket(td::int64 tqueue_id, F &&update);
+};
+
+}  // namespace telegram_bot_api
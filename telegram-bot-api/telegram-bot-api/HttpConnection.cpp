@@ -6,14 +6,22 @@
 //
 #include "telegram-bot-api/HttpConnection.h"
 
+#include "telegram-bot-api/ClientParameters.h"
 #include "telegram-bot-api/Query.h"
 
+#include "td/net/HttpByteRange.h"
 #include "td/net/HttpHeaderCreator.h"
 
+#include "td/utils/base64.h"
+#include "td/utils/ByteFlow.h"
 #include "td/utils/common.h"
+#include "td/utils/GzipByteFlow.h"
 #include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
+#include "td/utils/misc.h"
 #include "td/utils/Parser.h"
+#include "td/utils/port/path.h"
+#include "td/utils/port/Stat.h"
 #include "td/utils/Promise.h"
 #include "td/utils/SliceBuilder.h"
 
@@ -30,6 +38,10 @@ void HttpConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
     return send_http_error(404, "Not Found: absolute URI is specified in the Request-Line");
   }
 
+  if (url_path_parser.try_skip("/file")) {
+    return handle_file_query(*http_query, url_path_parser.data());
+  }
+
   if (!url_path_parser.try_skip("/bot")) {
     return send_http_error(404, "Not Found");
   }
@@ -44,6 +56,8 @@ void HttpConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
     return send_http_error(404, "Not Found");
   }
 
+  content_encoding_ = get_content_encoding(http_query->get_header("accept-encoding"));
+
   auto method = url_path_parser.data();
   auto query = td::make_unique<Query>(std::move(http_query->container_), token, is_test_dc, method,
                                       std::move(http_query->args_), std::move(http_query->headers_),
@@ -53,9 +67,153 @@ void HttpConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
     send_closure(actor_id, &HttpConnection::on_query_finished, std::move(r_query));
   });
   auto promised_query = PromisedQueryPtr(query.release(), PromiseDeleter(std::move(promise)));
+  auto client = shared_data_->client_routes_->get_client(token, is_test_dc);
+  if (!client.empty()) {
+    // the bot is already running; will send 429 if the client is already closed
+    return send_closure(client, &Client::send, std::move(promised_query));
+  }
   send_closure(client_manager_, &ClientManager::send, std::move(promised_query));
 }
 
+void HttpConnection::handle_file_query(const td::HttpQuery &http_query, td::Slice url_path) {
+  td::ConstParser url_path_parser(url_path);
+  if (!url_path_parser.try_skip("/bot")) {
+    return send_http_error(404, "Not Found");
+  }
+
+  auto token = url_path_parser.read_till('/');
+  bool is_test_dc = false;
+  if (url_path_parser.try_skip("/test")) {
+    is_test_dc = true;
+  }
+  url_path_parser.skip('/');
+  auto file_path = url_path_parser.data();
+  if (url_path_parser.status().is_error() || file_path.empty()) {
+    return send_http_error(404, "Not Found");
+  }
+  if (http_query.type_ != td::HttpQuery::Type::Get) {
+    return send_http_error(405, "Method Not Allowed: only GET requests are supported for files");
+  }
+
+  auto colon_pos = token.find(':');
+  if (token.empty() || token[0] == '0' || token.size() > 80u || colon_pos == td::Slice::npos ||
+      td::to_integer_safe<td::int64>(token.substr(0, colon_pos)).is_error() ||
+      !td::is_base64url_characters(token.substr(colon_pos + 1))) {
+    return send_http_error(401, "Unauthorized: invalid token specified");
+  }
+
+  // must be the same as Client::dir_
+  td::string bot_directory = PSTRING() << parameters_->working_directory_ << token << (is_test_dc ? ":T" : "");
+  if (!parameters_->allow_colon_in_filenames_) {
+    for (auto &c : bot_directory) {
+      if (c == ':') {
+        c = '~';
+      }
+    }
+  }
+
+  // in the local mode getFile returns absolute file paths
+  auto r_path = td::realpath_in_directory(bot_directory, file_path, parameters_->local_mode_);
+  if (r_path.is_error()) {
+    LOG(DEBUG) << "Can't serve file \"" << file_path << "\": " << r_path.error();
+    return send_http_error(404, "Not Found: file not found");
+  }
+
+  auto r_fd = td::FileFd::open(r_path.ok(), td::FileFd::Read);
+  if (r_fd.is_error()) {
+    LOG(DEBUG) << "Can't open file \"" << r_path.ok() << "\": " << r_fd.error();
+    return send_http_error(404, "Not Found: file not found");
+  }
+  auto fd = r_fd.move_as_ok();
+  auto r_stat = fd.stat();
+  if (r_stat.is_error() || !r_stat.ok().is_reg_) {
+    return send_http_error(404, "Not Found: file not found");
+  }
+
+  send_file(std::move(fd), r_stat.ok().size_, http_query.get_header("range"));
+}
+
+void HttpConnection::send_file(td::FileFd fd, td::int64 file_size, td::Slice range) {
+  auto byte_range = td::HttpByteRange::parse(range, file_size);
+  auto begin = byte_range.begin;
+  auto end = byte_range.end;
+
+  td::HttpHeaderCreator hc;
+  if (!byte_range.is_satisfiable) {
+    hc.init_status_line(416);
+    hc.add_header("Content-Range", PSLICE() << "bytes */" << file_size);
+    begin = end = 0;
+  } else {
+    hc.init_status_line(byte_range.is_partial ? 206 : 200);
+    if (byte_range.is_partial) {
+      hc.add_header("Content-Range", PSLICE() << "bytes " << begin << '-' << end - 1 << '/' << file_size);
+    }
+  }
+  hc.set_keep_alive();
+  hc.set_content_type("application/octet-stream");
+  hc.add_header("Accept-Ranges", "bytes");
+  hc.set_content_size(static_cast<size_t>(end - begin));
+
+  auto r_header = hc.finish();
+  if (r_header.is_error()) {
+    LOG(ERROR) << "Bad response headers";
+    send_closure(std::move(connection_), &td::HttpInboundConnection::write_error, r_header.move_as_error());
+    return;
+  }
+  LOG(DEBUG) << "Send file response headers: " << r_header.ok();
+
+  send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
+  if (begin < end) {
+    // the file is sent directly from the page cache without copying to the connection buffers
+    send_closure(connection_, &td::HttpInboundConnection::write_file, std::move(fd), begin, end - begin);
+  }
+  send_closure(std::move(connection_), &td::HttpInboundConnection::write_ok);
+}
+
+HttpConnection::ContentEncoding HttpConnection::get_content_encoding(td::Slice accept_encoding) {
+  auto result = ContentEncoding::None;
+  for (auto coding : td::full_split(accept_encoding, ',')) {
+    auto parameters_pos = coding.find(';');
+    if (parameters_pos != td::Slice::npos) {
+      // only "q=0" is handled, other weights are equally preferred
+      auto weight = td::trim(coding.substr(parameters_pos + 1));
+      coding = coding.substr(0, parameters_pos);
+      if (td::begins_with(weight, "q=") && td::to_double(weight.substr(2)) <= 0.0) {
+        continue;
+      }
+    }
+    auto name = td::to_lower(td::trim(coding));
+    if (name == "gzip" || name == "x-gzip") {
+      return ContentEncoding::Gzip;
+    }
+    if (name == "deflate") {
+      result = ContentEncoding::Deflate;
+    }
+  }
+  return result;
+}
+
+td::BufferSlice HttpConnection::compress(td::vector<td::BufferSlice> &content, int compression_level,
+                                         bool gzip_format) {
+  td::ChainBufferWriter input_writer;
+  auto input = input_writer.extract_reader();
+  td::ByteFlowSource source(&input);
+  td::GzipByteFlow gzip_flow;
+  gzip_flow.init_encode(compression_level, gzip_format);
+  td::ByteFlowSink sink;
+  source >> gzip_flow >> sink;
+
+  for (auto &slice : content) {
+    input_writer.append(slice.clone());
+  }
+  source.wakeup();
+  source.close_input(td::Status::OK());
+  if (!sink.is_ready() || sink.status().is_error()) {
+    return td::BufferSlice();
+  }
+  return sink.result()->move_as_buffer_slice();
+}
+
 void HttpConnection::on_query_finished(td::Result<td::unique_ptr<Query>> r_query) {
   LOG_CHECK(r_query.is_ok()) << r_query.error();
 
@@ -63,7 +221,7 @@ void HttpConnection::on_query_finished(td::Result<td::unique_ptr<Query>> r_query
   send_response(query->http_status_code(), std::move(query->answer()), query->retry_after());
 }
 
-void HttpConnection::send_response(int http_status_code, td::BufferSlice &&content, int retry_after) {
+void HttpConnection::send_response(int http_status_code, td::vector<td::BufferSlice> &&content, int retry_after) {
   td::HttpHeaderCreator hc;
   hc.init_status_line(http_status_code);
   hc.set_keep_alive();
@@ -71,7 +229,27 @@ void HttpConnection::send_response(int http_status_code, td::BufferSlice &&conte
   if (retry_after > 0) {
     hc.add_header("Retry-After", PSLICE() << retry_after);
   }
-  hc.set_content_size(content.size());
+  size_t content_size = 0;
+  for (auto &slice : content) {
+    content_size += slice.size();
+  }
+  if (content_encoding_ != ContentEncoding::None && parameters_->http_compression_level_ > 0 &&
+      content_size >= static_cast<size_t>(parameters_->http_compression_min_size_)) {
+    // compression is enabled only with separate HTTP threads, so the response is compressed in the thread of
+    // the connection and not in the thread of Clients
+    bool gzip_format = content_encoding_ == ContentEncoding::Gzip;
+    auto compressed = compress(content, parameters_->http_compression_level_, gzip_format);
+    if (!compressed.empty() && compressed.size() < content_size) {
+      LOG(DEBUG) << "Compress response from " << content_size << " to " << compressed.size() << " bytes";
+      content.clear();
+      content_size = compressed.size();
+      content.push_back(std::move(compressed));
+      hc.add_header("Content-Encoding", gzip_format ? td::Slice("gzip") : td::Slice("deflate"));
+      hc.add_header("Vary", "Accept-Encoding");
+    }
+  }
+  content_encoding_ = ContentEncoding::None;
+  hc.set_content_size(content_size);
 
   auto r_header = hc.finish();
   LOG(DEBUG) << "Response headers: " << r_header.ok();
@@ -83,12 +261,18 @@ void HttpConnection::send_response(int http_status_code, td::BufferSlice &&conte
   LOG(DEBUG) << "Send result: " << content;
 
   send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
-  send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, std::move(content));
+  for (auto &slice : content) {
+    send_closure(connection_, &td::HttpInboundConnection::write_next_noflush, std::move(slice));
+  }
   send_closure(std::move(connection_), &td::HttpInboundConnection::write_ok);
 }
 
 void HttpConnection::send_http_error(int http_status_code, td::Slice description) {
-  send_response(http_status_code, td::json_encode<td::BufferSlice>(JsonQueryError(http_status_code, description)), 0);
+  td::vector<td::BufferSlice> content;
+  size_t copied_size = 0;
+  content.push_back(td::json_encode_buffer(JsonQueryError(http_status_code, description), QUERY_ERROR_SIZE_HINT,
+                                           copied_size, false, shared_data_->json_escape_non_ascii_));
+  send_response(http_status_code, std::move(content), 0);
 }
 
 }  // namespace telegram_bot_api
@@ -15,6 +15,8 @@
 #include "td/actor/actor.h"
 
 #include "td/utils/buffer.h"
+#include "td/utils/common.h"
+#include "td/utils/port/FileFd.h"
 #include "td/utils/Slice.h"
 #include "td/utils/Status.h"
 
@@ -22,12 +24,14 @@
 
 namespace telegram_bot_api {
 
+struct ClientParameters;
 struct SharedData;
 
 class HttpConnection final : public td::HttpInboundConnection::Callback {
  public:
-  explicit HttpConnection(td::ActorId<ClientManager> client_manager, std::shared_ptr<SharedData> shared_data)
-      : client_manager_(client_manager), shared_data_(std::move(shared_data)) {
+  HttpConnection(td::ActorId<ClientManager> client_manager, std::shared_ptr<const ClientParameters> parameters,
+                 std::shared_ptr<SharedData> shared_data)
+      : client_manager_(client_manager), parameters_(std::move(parameters)), shared_data_(std::move(shared_data)) {
   }
 
   void handle(td::unique_ptr<td::HttpQuery> http_query, td::ActorOwn<td::HttpInboundConnection> connection) final;
@@ -35,16 +39,29 @@ class HttpConnection final : public td::HttpInboundConnection::Callback {
  private:
   td::ActorId<ClientManager> client_manager_;
   td::ActorOwn<td::HttpInboundConnection> connection_;
+  std::shared_ptr<const ClientParameters> parameters_;
   std::shared_ptr<SharedData> shared_data_;
 
+  enum class ContentEncoding : td::int8 { None, Gzip, Deflate };
+  ContentEncoding content_encoding_ = ContentEncoding::None;
+
   void hangup() final {
     connection_.release();
     stop();
   }
 
+  // serves files downloaded by the bot from /file/bot<token>/<file_path>
+  void handle_file_query(const td::HttpQuery &http_query, td::Slice url_path);
+
+  void send_file(td::FileFd fd, td::int64 file_size, td::Slice range);
+
+  static ContentEncoding get_content_encoding(td::Slice accept_encoding);
+
+  static td::BufferSlice compress(td::vector<td::BufferSlice> &content, int compression_level, bool gzip_format);
+
   void on_query_finished(td::Result<td::unique_ptr<Query>> r_query);
 
-  void send_response(int http_status_code, td::BufferSlice &&content, int retry_after);
+  void send_response(int http_status_code, td::vector<td::BufferSlice> &&content, int retry_after);
 
   void send_http_error(int http_status_code, td::Slice description);
 };
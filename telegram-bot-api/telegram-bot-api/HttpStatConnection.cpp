@@ -18,13 +18,20 @@ void HttpStatConnection::handle(td::unique_ptr<td::HttpQuery> http_query,
   CHECK(connection_.empty());
   connection_ = std::move(connection);
 
-  auto promise = td::PromiseCreator::lambda([actor_id = actor_id(this)](td::Result<td::BufferSlice> result) {
-    send_closure(actor_id, &HttpStatConnection::on_result, std::move(result));
-  });
+  // the connection is kept alive, so the format of the response must be chosen for each query
+  bool is_metrics_query = http_query->url_path_ == "/metrics";
+  auto promise = td::PromiseCreator::lambda(
+      [actor_id = actor_id(this), is_metrics_query](td::Result<td::BufferSlice> result) {
+        send_closure(actor_id, &HttpStatConnection::on_result, is_metrics_query, std::move(result));
+      });
+  if (is_metrics_query) {
+    send_closure(client_manager_, &ClientManager::get_metrics, std::move(promise));
+    return;
+  }
   send_closure(client_manager_, &ClientManager::get_stats, std::move(promise), http_query->get_args());
 }
 
-void HttpStatConnection::on_result(td::Result<td::BufferSlice> result) {
+void HttpStatConnection::on_result(bool is_metrics_query, td::Result<td::BufferSlice> result) {
   if (result.is_error()) {
     send_closure(connection_.release(), &td::HttpInboundConnection::write_error,
                  td::Status::Error(500, "Internal Server Error: closing"));
@@ -35,7 +42,11 @@ void HttpStatConnection::on_result(td::Result<td::BufferSlice> result) {
   td::HttpHeaderCreator hc;
   hc.init_status_line(200);
   hc.set_keep_alive();
-  hc.set_content_type("text/plain");
+  if (is_metrics_query) {
+    hc.set_content_type("text/plain; version=0.0.4");
+  } else {
+    hc.set_content_type("text/plain");
+  }
   hc.set_content_size(content.size());
 
   auto r_header = hc.finish();
@@ -0,0 +1,163 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "telegram-bot-api/Metrics.h"
+
+#include "td/db/binlog/ConcurrentBinlog.h"
+
+namespace telegram_bot_api {
+
+// writes duration in microseconds as a number of seconds
+static void store_seconds(td::StringBuilder &sb, td::uint64 microseconds) {
+  auto fraction = microseconds % 1000000;
+  sb << microseconds / 1000000 << '.';
+  for (td::uint64 digit = 100000; digit > fraction && digit > 1; digit /= 10) {
+    sb << '0';
+  }
+  sb << fraction;
+}
+
+static void store_labels(td::StringBuilder &sb, td::Slice labels) {
+  if (!labels.empty()) {
+    sb << '{' << labels << '}';
+  }
+}
+
+static void store_bucket(td::StringBuilder &sb, td::Slice name, td::Slice labels) {
+  sb << name << "_bucket{" << labels;
+  if (!labels.empty()) {
+    sb << ',';
+  }
+  sb << "le=\"";
+}
+
+// histograms without values aren't written
+template <size_t N>
+static void store_latency_histogram(td::StringBuilder &sb, td::Slice name, td::Slice labels,
+                                    const LatencyHistograms<N> &histograms, size_t index) {
+  constexpr size_t BUCKET_COUNT = LatencyHistograms<N>::BUCKET_COUNT;
+  td::int64 counts[BUCKET_COUNT];
+  td::int64 total_count = 0;
+  for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+    counts[bucket] = histograms.get_bucket_count(index, bucket);
+    total_count += counts[bucket];
+  }
+  if (total_count == 0) {
+    return;
+  }
+
+  td::int64 count = 0;
+  for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+    count += counts[bucket];
+    store_bucket(sb, name, labels);
+    if (bucket + 1 == BUCKET_COUNT) {
+      sb << "+Inf";
+    } else {
+      store_seconds(sb, LatencyHistograms<N>::get_bucket_bound(bucket));
+    }
+    sb << "\"} " << count << '\n';
+  }
+  sb << name << "_sum";
+  store_labels(sb, labels);
+  sb << ' ';
+  store_seconds(sb, static_cast<td::uint64>(histograms.get_sum(index)));
+  sb << '\n';
+  sb << name << "_count";
+  store_labels(sb, labels);
+  sb << ' ' << total_count << '\n';
+}
+
+// counts[i] is the number of values in [2^i, 2^(i + 1)), or in [0, 2) for i == 0; the last bucket is unbounded
+static void store_log2_histogram(td::StringBuilder &sb, td::Slice name, const td::uint64 *counts, td::uint64 sum,
+                                 bool is_duration) {
+  constexpr size_t BUCKET_COUNT = td::ConcurrentBinlog::SYNC_STATISTICS_BUCKET_COUNT;
+  td::uint64 count = 0;
+  for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+    count += counts[bucket];
+    store_bucket(sb, name, td::Slice());
+    if (bucket + 1 == BUCKET_COUNT) {
+      sb << "+Inf";
+    } else {
+      auto bound = (static_cast<td::uint64>(2) << bucket) - 1;
+      if (is_duration) {
+        store_seconds(sb, bound);
+      } else {
+        sb << bound;
+      }
+    }
+    sb << "\"} " << count << '\n';
+  }
+  sb << name << "_sum ";
+  if (is_duration) {
+    store_seconds(sb, sum);
+  } else {
+    sb << sum;
+  }
+  sb << '\n';
+  sb << name << "_count " << count << '\n';
+}
+
+void ServerMetrics::store_header(td::StringBuilder &sb, td::Slice name, td::Slice type, td::Slice help) {
+  sb << "# HELP " << name << ' ' << help << '\n';
+  sb << "# TYPE " << name << ' ' << type << '\n';
+}
+
+void ServerMetrics::store_metrics(td::StringBuilder &sb, const td::vector<td::Slice> &method_names) {
+  auto get_method_labels = [&method_names](size_t index) -> td::string {
+    td::Slice method_name = "unknown";
+    if (index < method_names.size() && index < MAX_METHOD_COUNT) {
+      method_name = method_names[index];
+    }
+    return PSTRING() << "method=\"" << method_name << '"';
+  };
+
+  td::Slice name = "telegram_bot_api_request_duration_seconds";
+  store_header(sb, name, "histogram", "Duration of Bot API request handling by method");
+  for (size_t index = 0; index <= MAX_METHOD_COUNT; index++) {
+    store_latency_histogram(sb, name, get_method_labels(index), requests_, index);
+  }
+
+  name = "telegram_bot_api_failed_requests_total";
+  store_header(sb, name, "counter", "Number of failed Bot API requests by method");
+  for (size_t index = 0; index <= MAX_METHOD_COUNT; index++) {
+    auto count = failed_requests_.sum(index);
+    if (count != 0) {
+      sb << name << '{' << get_method_labels(index) << "} " << count << '\n';
+    }
+  }
+
+  name = "telegram_bot_api_tdlib_request_duration_seconds";
+  store_header(sb, name, "histogram", "Time between sending a request to TDLib and receiving its result");
+  store_latency_histogram(sb, name, td::Slice(), td_requests_, 0);
+
+  name = "telegram_bot_api_webhook_update_duration_seconds";
+  store_header(sb, name, "histogram",
+               "Time between sending an update to a webhook and receiving a successful response");
+  store_latency_histogram(sb, name, td::Slice(), webhook_updates_, 0);
+
+  name = "telegram_bot_api_failed_webhook_updates_total";
+  store_header(sb, name, "counter", "Number of unsuccessful attempts to send an update to a webhook");
+  sb << name << ' ' << failed_webhook_updates_.sum(0) << '\n';
+
+  auto binlog_sync_statistics = td::ConcurrentBinlog::get_sync_statistics();
+  name = "telegram_bot_api_binlog_sync_duration_seconds";
+  store_header(sb, name, "histogram", "Duration of syncing a batch of binlog files");
+  store_log2_histogram(sb, name, binlog_sync_statistics.latency_counts, binlog_sync_statistics.latency_sum, true);
+
+  name = "telegram_bot_api_binlog_sync_batch_size";
+  store_header(sb, name, "histogram", "Number of binlog files synced together");
+  store_log2_histogram(sb, name, binlog_sync_statistics.batch_size_counts, binlog_sync_statistics.batch_size_sum,
+                       false);
+
+  name = "telegram_bot_api_scheduler_queue_size";
+  store_header(sb, name, "gauge", "Number of events sent to a scheduler thread and not received by it yet");
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (size_t i = 0; i < scheduler_queue_sizes_.size(); i++) {
+    sb << name << "{scheduler=\"" << i << "\"} " << scheduler_queue_sizes_[i] << '\n';
+  }
+}
+
+}  // namespace telegram_bot_api
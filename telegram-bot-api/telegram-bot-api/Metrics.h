@@ -0,0 +1,182 @@
+//
+// Copyright Aliaksei Levin (levlam@telegram.org), Arseny Smirnov (arseny30@gmail.com) 2014-2023
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "td/actor/actor.h"
+
+#include "td/utils/common.h"
+#include "td/utils/Slice.h"
+#include "td/utils/StringBuilder.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+namespace telegram_bot_api {
+
+// N counters with a separate set of cells for each scheduler, so adding needs neither locks nor messages to other
+// threads; the cells must be allocated by init before the schedulers are started
+template <size_t N>
+class SchedulerMultiCounter {
+ public:
+  void init(size_t scheduler_count) {
+    // the last cells are shared by threads without a scheduler
+    cells_ = td::vector<Cells>(scheduler_count + 1);
+  }
+
+  void add(size_t index, td::int64 diff) {
+    CHECK(index < N);
+    get_cells().counters[index].fetch_add(diff, std::memory_order_relaxed);
+  }
+
+  td::int64 sum(size_t index) const {
+    CHECK(index < N);
+    td::int64 result = 0;
+    for (auto &cells : cells_) {
+      result += cells.counters[index].load(std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+ private:
+  struct Cells {
+    std::array<std::atomic<td::int64>, N> counters;
+    // counters of different schedulers must not share a cache line
+    char pad[TD_CONCURRENCY_PAD];
+  };
+
+  td::vector<Cells> cells_;
+
+  Cells &get_cells() {
+    CHECK(!cells_.empty());
+    auto *scheduler = td::Scheduler::instance();
+    if (scheduler == nullptr || scheduler->sched_id() < 0 ||
+        static_cast<size_t>(scheduler->sched_id()) + 1 >= cells_.size()) {
+      return cells_.back();
+    }
+    return cells_[scheduler->sched_id()];
+  }
+};
+
+// N latency histograms with buckets bounded by 2^k and 1.5 * 2^k microseconds
+template <size_t N>
+class LatencyHistograms {
+ public:
+  static constexpr size_t BUCKET_COUNT = 43;  // the last bucket is unbounded
+
+  // returns upper bound of the bucket in microseconds
+  static td::uint64 get_bucket_bound(size_t bucket) {
+    CHECK(bucket + 1 < BUCKET_COUNT);
+    auto bound = static_cast<td::uint64>(1) << (MIN_BOUND_POWER + bucket / 2);
+    return bucket % 2 == 0 ? bound : bound + bound / 2;
+  }
+
+  void init(size_t scheduler_count) {
+    counters_.init(scheduler_count);
+  }
+
+  void add(size_t index, double duration) {
+    auto value = duration > 0 ? static_cast<td::uint64>(duration * 1e6) : 0;
+    counters_.add(index * CELL_COUNT + get_bucket(value), 1);
+    counters_.add(index * CELL_COUNT + BUCKET_COUNT, static_cast<td::int64>(value));
+  }
+
+  td::int64 get_bucket_count(size_t index, size_t bucket) const {
+    return counters_.sum(index * CELL_COUNT + bucket);
+  }
+
+  // in microseconds
+  td::int64 get_sum(size_t index) const {
+    return counters_.sum(index * CELL_COUNT + BUCKET_COUNT);
+  }
+
+ private:
+  static constexpr size_t MIN_BOUND_POWER = 5;
+  static constexpr size_t CELL_COUNT = BUCKET_COUNT + 1;  // bucket counts and the sum of values
+
+  SchedulerMultiCounter<N * CELL_COUNT> counters_;
+
+  static size_t get_bucket(td::uint64 value) {
+    size_t bucket = 0;
+    while (bucket + 1 < BUCKET_COUNT && value > get_bucket_bound(bucket)) {
+      bucket++;
+    }
+    return bucket;
+  }
+};
+
+// server metrics, which are exported in the Prometheus text format
+class ServerMetrics {
+ public:
+  static constexpr size_t MAX_METHOD_COUNT = 127;
+
+  static ServerMetrics &instance() {
+    static ServerMetrics metrics;
+    return metrics;
+  }
+
+  // must be called before the schedulers are started
+  void init(size_t scheduler_count) {
+    requests_.init(scheduler_count);
+    failed_requests_.init(scheduler_count);
+    td_requests_.init(scheduler_count);
+    webhook_updates_.init(scheduler_count);
+    failed_webhook_updates_.init(scheduler_count);
+  }
+
+  // method_id is an identifier from Query::register_method, or -1 for unknown methods
+  void add_request(td::int32 method_id, bool is_ok, double duration) {
+    auto index = get_method_index(method_id);
+    requests_.add(index, duration);
+    if (!is_ok) {
+      failed_requests_.add(index, 1);
+    }
+  }
+
+  void add_td_request(double duration) {
+    td_requests_.add(0, duration);
+  }
+
+  void add_webhook_update(bool is_ok, double duration) {
+    if (is_ok) {
+      webhook_updates_.add(0, duration);
+    } else {
+      failed_webhook_updates_.add(0, 1);
+    }
+  }
+
+  void set_scheduler_queue_sizes(td::vector<size_t> scheduler_queue_sizes) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    scheduler_queue_sizes_ = std::move(scheduler_queue_sizes);
+  }
+
+  // method_names[i] is the name of the method with identifier i
+  void store_metrics(td::StringBuilder &sb, const td::vector<td::Slice> &method_names);
+
+  static void store_header(td::StringBuilder &sb, td::Slice name, td::Slice type, td::Slice help);
+
+ private:
+  LatencyHistograms<MAX_METHOD_COUNT + 1> requests_;  // the last histogram is for unknown methods
+  SchedulerMultiCounter<MAX_METHOD_COUNT + 1> failed_requests_;
+  LatencyHistograms<1> td_requests_;
+  LatencyHistograms<1> webhook_updates_;
+  SchedulerMultiCounter<1> failed_webhook_updates_;
+
+  std::mutex mutex_;
+  td::vector<size_t> scheduler_queue_sizes_;
+
+  ServerMetrics() = default;
+
+  static size_t get_method_index(td::int32 method_id) {
+    if (method_id < 0 || static_cast<size_t>(method_id) >= MAX_METHOD_COUNT) {
+      return MAX_METHOD_COUNT;
+    }
+    return static_cast<size_t>(method_id);
+  }
+};
+
+}  // namespace telegram_bot_api
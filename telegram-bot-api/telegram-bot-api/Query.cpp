@@ -6,6 +6,7 @@
 //
 #include "telegram-bot-api/Query.h"
 
+#include "telegram-bot-api/Metrics.h"
 #include "telegram-bot-api/Stats.h"
 
 #include "td/actor/actor.h"
@@ -17,12 +18,44 @@
 #include "td/utils/SliceBuilder.h"
 #include "td/utils/Time.h"
 
+#include <algorithm>
 #include <numeric>
 
 namespace telegram_bot_api {
 
 td::FlatHashMap<td::string, td::unique_ptr<td::VirtuallyJsonable>> empty_parameters;
 
+static td::FlatHashMap<td::Slice, td::int32, td::SliceHash> &get_method_ids() {
+  static td::FlatHashMap<td::Slice, td::int32, td::SliceHash> method_ids;
+  return method_ids;
+}
+
+td::int32 Query::register_method(td::Slice method) {
+  auto &method_ids = get_method_ids();
+  auto method_id = static_cast<td::int32>(method_ids.size());
+  auto is_inserted = method_ids.emplace(method, method_id).second;
+  CHECK(is_inserted);
+  return method_id;
+}
+
+td::vector<td::Slice> Query::get_method_names() {
+  const auto &method_ids = get_method_ids();
+  td::vector<td::Slice> result(method_ids.size());
+  for (auto &it : method_ids) {
+    result[it.second] = it.first;
+  }
+  return result;
+}
+
+static td::int32 get_method_id(td::Slice method) {
+  if (method.empty()) {
+    return -1;
+  }
+  const auto &method_ids = get_method_ids();
+  auto it = method_ids.find(method);
+  return it == method_ids.end() ? -1 : it->second;
+}
+
 Query::Query(td::vector<td::BufferSlice> &&container, td::Slice token, bool is_test_dc, td::MutableSlice method,
              td::vector<std::pair<td::MutableSlice, td::MutableSlice>> &&args,
              td::vector<std::pair<td::MutableSlice, td::MutableSlice>> &&headers, td::vector<td::HttpFile> &&files,
@@ -38,21 +71,56 @@ Query::Query(td::vector<td::BufferSlice> &&container, td::Slice token, bool is_t
     , headers_(std::move(headers))
     , files_(std::move(files))
     , is_internal_(is_internal) {
+  build_indices();
   if (method_.empty()) {
     method_ = arg("method");
   }
   td::to_lower_inplace(method_);
+  method_id_ = get_method_id(method_);
   start_timestamp_ = td::Time::now();
   LOG(INFO) << "QUERY: create " << td::tag("ptr", this) << *this;
   if (shared_data_) {
     shared_data_->query_count_.fetch_add(1, std::memory_order_relaxed);
-    if (method_ != "getupdates") {
+    // internal queries and queries received by separate HTTP listeners can be created and destroyed
+    // on other schedulers, so only queries from the main client scheduler are added to the list
+    if (method_ != "getupdates" && !is_internal_ &&
+        td::Scheduler::instance()->sched_id() == shared_data_->get_client_scheduler_id(0)) {
       shared_data_->query_list_size_.fetch_add(1, std::memory_order_relaxed);
       shared_data_->query_list_.put(this);
     }
   }
 }
 
+void Query::build_indices() {
+  index_.resize(args_.size() + files_.size());
+  auto files_begin = index_.begin() + args_.size();
+  std::iota(index_.begin(), files_begin, 0);
+  std::stable_sort(index_.begin(), files_begin,
+                   [this](td::uint32 lhs, td::uint32 rhs) { return args_[lhs].first < args_[rhs].first; });
+
+  std::iota(files_begin, index_.end(), 0);
+  std::stable_sort(files_begin, index_.end(), [this](td::uint32 lhs, td::uint32 rhs) {
+    return td::Slice(files_[lhs].field_name) < td::Slice(files_[rhs].field_name);
+  });
+}
+
+bool Query::need_release_on_gc_scheduler() const {
+  // temporary files are deleted in the destructor of HttpFile
+  if (!files_.empty()) {
+    return true;
+  }
+  size_t size = 0;
+  for (auto &slice : container_) {
+    size += slice.size();
+  }
+  return size + answer_size() > MAX_INPLACE_RELEASE_SIZE;
+}
+
+size_t Query::answer_size() const {
+  return std::accumulate(answer_.begin(), answer_.end(), static_cast<size_t>(0),
+                         [](size_t acc, const td::BufferSlice &slice) { return acc + slice.size(); });
+}
+
 td::int64 Query::query_size() const {
   return std::accumulate(
       container_.begin(), container_.end(), td::int64{0},
@@ -74,20 +142,29 @@ void Query::set_stat_actor(td::ActorId<BotStatActor> stat_actor) {
   send_request_stat();
 }
 
-void Query::set_ok(td::BufferSlice result) {
+void Query::set_ok(td::BufferSlice result, size_t copied_size) {
+  td::vector<td::BufferSlice> answer;
+  answer.push_back(std::move(result));
+  answer_copied_size_ = copied_size;
+  set_ok(std::move(answer));
+}
+
+void Query::set_ok(td::vector<td::BufferSlice> result) {
   CHECK(state_ == State::Query);
-  LOG(INFO) << "QUERY: got ok " << td::tag("ptr", this) << td::tag("text", result.as_slice());
+  LOG(INFO) << "QUERY: got ok " << td::tag("ptr", this) << td::tag("text", result);
   answer_ = std::move(result);
   state_ = State::OK;
   http_status_code_ = 200;
   send_response_stat();
 }
 
-void Query::set_error(int http_status_code, td::BufferSlice result) {
+void Query::set_error(int http_status_code, td::BufferSlice result, size_t copied_size) {
   LOG(INFO) << "QUERY: got error " << td::tag("ptr", this) << td::tag("code", http_status_code)
             << td::tag("text", result.as_slice());
   CHECK(state_ == State::Query);
-  answer_ = std::move(result);
+  answer_.clear();
+  answer_.push_back(std::move(result));
+  answer_copied_size_ = copied_size;
   state_ = State::Error;
   http_status_code_ = http_status_code;
   send_response_stat();
@@ -98,8 +175,11 @@ void Query::set_retry_after_error(int retry_after) {
 
   td::FlatHashMap<td::string, td::unique_ptr<td::VirtuallyJsonable>> parameters;
   parameters.emplace("retry_after", td::make_unique<td::VirtuallyJsonableLong>(retry_after));
-  set_error(429, td::json_encode<td::BufferSlice>(
-                     JsonQueryError(429, PSLICE() << "Too Many Requests: retry after " << retry_after, parameters)));
+  size_t copied_size = 0;
+  auto error = td::json_encode_buffer(
+      JsonQueryError(429, PSLICE() << "Too Many Requests: retry after " << retry_after, parameters),
+      QUERY_ERROR_SIZE_HINT, copied_size, false, json_escape_non_ascii());
+  set_error(429, std::move(error), copied_size);
 }
 
 td::StringBuilder &operator<<(td::StringBuilder &sb, const Query &query) {
@@ -126,16 +206,20 @@ void Query::send_request_stat() const {
 
 void Query::send_response_stat() const {
   auto now = td::Time::now();
-  if (now - start_timestamp_ >= 100.0 && !is_internal_) {
-    LOG(WARNING) << "Answer too old query with code " << http_status_code_ << " and answer size " << answer_.size()
-                 << ": " << *this;
+  if (!is_internal_) {
+    if (now - start_timestamp_ >= 100.0) {
+      LOG(WARNING) << "Answer too old query with code " << http_status_code_ << " and answer size " << answer_size()
+                   << ": " << *this;
+    }
+    ServerMetrics::instance().add_request(method_id_, state_ == State::OK, now - start_timestamp_);
   }
 
   if (stat_actor_.empty()) {
     return;
   }
-  send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Response>,
-               ServerBotStat::Response{state_ == State::OK, answer_.size(), file_count(), files_size()}, now);
+  ServerBotStat::Response response{state_ == State::OK, answer_size(), answer_copied_size_, file_count(),
+                                   files_size()};
+  send_closure(stat_actor_, &BotStatActor::add_event<ServerBotStat::Response>, response, now);
 }
 
 }  // namespace telegram_bot_api
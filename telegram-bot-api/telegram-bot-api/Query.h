@@ -44,15 +44,16 @@ class Query final : public td::ListNode {
   td::Slice method() const {
     return method_;
   }
+  // identifier of the method from register_method or -1 if the method is unknown
+  td::int32 method_id() const {
+    return method_id_;
+  }
   bool has_arg(td::Slice key) const {
-    auto it = std::find_if(args_.begin(), args_.end(),
-                           [&key](const std::pair<td::MutableSlice, td::MutableSlice> &s) { return s.first == key; });
-    return it != args_.end();
+    return find_arg(key) != nullptr;
   }
   td::MutableSlice arg(td::Slice key) const {
-    auto it = std::find_if(args_.begin(), args_.end(),
-                           [&key](const std::pair<td::MutableSlice, td::MutableSlice> &s) { return s.first == key; });
-    return it == args_.end() ? td::MutableSlice() : it->second;
+    auto arg = find_arg(key);
+    return arg == nullptr ? td::MutableSlice() : arg->second;
   }
   const td::vector<std::pair<td::MutableSlice, td::MutableSlice>> &args() const {
     return args_;
@@ -63,8 +64,10 @@ class Query final : public td::ListNode {
     return it == headers_.end() ? td::Slice() : it->second;
   }
   const td::HttpFile *file(td::Slice key) const {
-    auto it = std::find_if(files_.begin(), files_.end(), [&key](const td::HttpFile &f) { return f.field_name == key; });
-    return it == files_.end() ? nullptr : &*it;
+    auto begin = index_.begin() + args_.size();
+    auto it = std::lower_bound(begin, index_.end(), key,
+                               [this](td::uint32 i, td::Slice key) { return files_[i].field_name < key; });
+    return it == index_.end() || files_[*it].field_name != key ? nullptr : &files_[*it];
   }
   const td::vector<td::HttpFile> &files() const {
     return files_;
@@ -74,7 +77,8 @@ class Query final : public td::ListNode {
     return peer_address_;
   }
 
-  td::BufferSlice &answer() {
+  // the answer is the concatenation of all the slices
+  td::vector<td::BufferSlice> &answer() {
     return answer_;
   }
 
@@ -86,9 +90,12 @@ class Query final : public td::ListNode {
     return retry_after_;
   }
 
-  void set_ok(td::BufferSlice result);
+  // copied_size is the number of bytes, which were copied while the result was built
+  void set_ok(td::BufferSlice result, size_t copied_size = 0);
 
-  void set_error(int http_status_code, td::BufferSlice result);
+  void set_ok(td::vector<td::BufferSlice> result);
+
+  void set_error(int http_status_code, td::BufferSlice result, size_t copied_size = 0);
 
   void set_retry_after_error(int retry_after);
 
@@ -100,6 +107,10 @@ class Query final : public td::ListNode {
     return is_internal_;
   }
 
+  bool json_escape_non_ascii() const {
+    return shared_data_ == nullptr || shared_data_->json_escape_non_ascii_;
+  }
+
   Query(td::vector<td::BufferSlice> &&container, td::Slice token, bool is_test_dc, td::MutableSlice method,
         td::vector<std::pair<td::MutableSlice, td::MutableSlice>> &&args,
         td::vector<std::pair<td::MutableSlice, td::MutableSlice>> &&headers, td::vector<td::HttpFile> &&files,
@@ -114,8 +125,10 @@ class Query final : public td::ListNode {
       if (!empty()) {
         shared_data_->query_list_size_.fetch_sub(1, std::memory_order_relaxed);
       }
-      td::Scheduler::instance()->destroy_on_scheduler(SharedData::get_file_gc_scheduler_id(), container_, args_,
-                                                      headers_, files_, answer_);
+      if (need_release_on_gc_scheduler()) {
+        td::Scheduler::instance()->destroy_on_scheduler(SharedData::get_file_gc_scheduler_id(), container_, args_,
+                                                        headers_, files_, answer_);
+      }
     }
   }
 
@@ -125,6 +138,13 @@ class Query final : public td::ListNode {
 
   void set_stat_actor(td::ActorId<BotStatActor> stat_actor);
 
+  // the method must be in lowercase and must be alive until the end of the program;
+  // all methods must be registered before the first query is created
+  static td::int32 register_method(td::Slice method);
+
+  // returns names of all registered methods by their identifiers
+  static td::vector<td::Slice> get_method_names();
+
  private:
   State state_;
   std::shared_ptr<SharedData> shared_data_;
@@ -137,17 +157,40 @@ class Query final : public td::ListNode {
   td::Slice token_;
   bool is_test_dc_;
   td::MutableSlice method_;
+  td::int32 method_id_ = -1;
   td::vector<std::pair<td::MutableSlice, td::MutableSlice>> args_;
   td::vector<std::pair<td::MutableSlice, td::MutableSlice>> headers_;
   td::vector<td::HttpFile> files_;
   bool is_internal_ = false;
 
+  // indices of args_ sorted by name followed by indices of files_ sorted by name; the sorts are stable, so the first
+  // of arguments with the same name is found as before
+  td::vector<td::uint32> index_;
+
+  const std::pair<td::MutableSlice, td::MutableSlice> *find_arg(td::Slice key) const {
+    auto end = index_.begin() + args_.size();
+    auto it = std::lower_bound(index_.begin(), end, key,
+                               [this](td::uint32 i, td::Slice key) { return args_[i].first < key; });
+    return it == end || args_[*it].first != key ? nullptr : &args_[*it];
+  }
+
+  void build_indices();
+
+  // queries without temporary files and with small buffers are cheaper to release in place
+  // than to send them to the file GC scheduler
+  static constexpr size_t MAX_INPLACE_RELEASE_SIZE = 1 << 16;
+
+  bool need_release_on_gc_scheduler() const;
+
   // response
-  td::BufferSlice answer_;
+  td::vector<td::BufferSlice> answer_;
   int http_status_code_ = 0;
   int retry_after_ = 0;
+  size_t answer_copied_size_ = 0;
 
   // for stats
+  size_t answer_size() const;
+
   td::int32 file_count() const {
     return static_cast<td::int32>(files_.size());
   }
@@ -256,17 +299,26 @@ class PromiseDeleter {
 };
 using PromisedQueryPtr = std::unique_ptr<Query, PromiseDeleter>;
 
+// most answers fit into the buffer and are sent without copying
+constexpr size_t QUERY_ANSWER_SIZE_HINT = 1 << 12;
+constexpr size_t QUERY_ERROR_SIZE_HINT = 1 << 9;
+
 template <class Jsonable>
 void answer_query(const Jsonable &result, PromisedQueryPtr query, td::Slice description = td::Slice()) {
-  query->set_ok(td::json_encode<td::BufferSlice>(JsonQueryOk<Jsonable>(result, description)));
+  size_t copied_size = 0;
+  auto answer = td::json_encode_buffer(JsonQueryOk<Jsonable>(result, description), QUERY_ANSWER_SIZE_HINT, copied_size,
+                                       false, query->json_escape_non_ascii());
+  query->set_ok(std::move(answer), copied_size);
   query.reset();  // send query into promise explicitly
 }
 
 inline void fail_query(
     int http_status_code, td::Slice description, PromisedQueryPtr query,
     const td::FlatHashMap<td::string, td::unique_ptr<td::VirtuallyJsonable>> &parameters = empty_parameters) {
-  query->set_error(http_status_code,
-                   td::json_encode<td::BufferSlice>(JsonQueryError(http_status_code, description, parameters)));
+  size_t copied_size = 0;
+  auto error = td::json_encode_buffer(JsonQueryError(http_status_code, description, parameters),
+                                      QUERY_ERROR_SIZE_HINT, copied_size, false, query->json_escape_non_ascii());
+  query->set_error(http_status_code, std::move(error), copied_size);
   query.reset();  // send query into promise explicitly
 }
 
@@ -87,6 +87,7 @@ void ServerBotStat::normalize(double duration) {
   response_count_ok_ /= duration;
   response_count_error_ /= duration;
   response_bytes_ /= duration;
+  response_copied_bytes_ /= duration;
   update_count_ /= duration;
 }
 
@@ -101,6 +102,7 @@ void ServerBotStat::add(const ServerBotStat &stat) {
   response_count_ok_ += stat.response_count_ok_;
   response_count_error_ += stat.response_count_error_;
   response_bytes_ += stat.response_bytes_;
+  response_copied_bytes_ += stat.response_copied_bytes_;
 
   update_count_ += stat.update_count_;
 }
@@ -119,6 +121,7 @@ td::vector<StatItem> ServerBotStat::as_vector() const {
   add_item("response_count_ok", response_count_ok_);
   add_item("response_count_error", response_count_error_);
   add_item("response_bytes", response_bytes_);
+  add_item("response_copied_bytes", response_copied_bytes_);
   add_item("update_count", update_count_);
   return res;
 }
@@ -185,6 +188,10 @@ bool BotStatActor::is_active(double now) const {
   return last_activity_timestamp_ > now - 86400;
 }
 
+double BotStatActor::get_last_activity_timestamp() const {
+  return last_activity_timestamp_;
+}
+
 constexpr int BotStatActor::DURATIONS[SIZE];
 constexpr const char *BotStatActor::DESCR[SIZE];
 
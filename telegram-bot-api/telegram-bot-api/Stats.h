@@ -85,6 +85,7 @@ class ServerBotInfo {
   td::int32 head_update_id_ = 0;
   td::int32 tail_update_id_ = 0;
   td::int32 webhook_max_connections_ = 0;
+  td::int32 webhook_max_batch_size_ = 0;
   std::size_t pending_update_count_ = 0;
   double start_time_ = 0;
 };
@@ -100,6 +101,7 @@ struct ServerBotStat {
   double response_count_ok_ = 0;
   double response_count_error_ = 0;
   double response_bytes_ = 0;
+  double response_copied_bytes_ = 0;
 
   double update_count_ = 0;
 
@@ -115,6 +117,7 @@ struct ServerBotStat {
   struct Response {
     bool ok_;
     size_t size_;
+    size_t copied_size_;
     td::int64 file_count_;
     td::int64 files_size_;
   };
@@ -126,6 +129,7 @@ struct ServerBotStat {
       response_count_error_++;
     }
     response_bytes_ += static_cast<double>(response.size_);
+    response_copied_bytes_ += static_cast<double>(response.copied_size_);
   }
 
   struct Request {
@@ -197,6 +201,8 @@ class BotStatActor final : public td::Actor {
 
   bool is_active(double now) const;
 
+  double get_last_activity_timestamp() const;
+
  private:
   static constexpr std::size_t SIZE = 4;
   static constexpr const char *DESCR[SIZE] = {"inf", "5sec", "1min", "1hour"};
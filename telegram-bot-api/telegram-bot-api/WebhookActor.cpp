@@ -7,6 +7,7 @@
 #include "telegram-bot-api/WebhookActor.h"
 
 #include "telegram-bot-api/ClientParameters.h"
+#include "telegram-bot-api/Metrics.h"
 
 #include "td/net/GetHostByNameActor.h"
 #include "td/net/HttpHeaderCreator.h"
@@ -17,7 +18,6 @@
 #include "td/utils/buffer.h"
 #include "td/utils/common.h"
 #include "td/utils/format.h"
-#include "td/utils/JsonBuilder.h"
 #include "td/utils/logging.h"
 #include "td/utils/misc.h"
 #include "td/utils/port/IPAddress.h"
@@ -36,8 +36,9 @@ static int VERBOSITY_NAME(webhook) = VERBOSITY_NAME(DEBUG);
 std::atomic<td::uint64> WebhookActor::total_connection_count_{0};
 
 WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_id, td::HttpUrl url,
-                           td::string cert_path, td::int32 max_connections, bool from_db_flag,
-                           td::string cached_ip_address, bool fix_ip_address, td::string secret_token,
+                           td::string cert_path, td::int32 max_connections, td::int32 max_batch_size,
+                           td::int32 gzip_min_size, bool from_db_flag, td::string cached_ip_address,
+                           bool fix_ip_address, td::string secret_token,
                            std::shared_ptr<const ClientParameters> parameters)
     : callback_(std::move(callback))
     , tqueue_id_(tqueue_id)
@@ -47,9 +48,14 @@ WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_
     , fix_ip_address_(fix_ip_address)
     , from_db_flag_(from_db_flag)
     , max_connections_(max_connections)
+    , max_batch_size_(max_batch_size)
+    , gzip_min_size_(gzip_min_size)
+    , max_pipelined_requests_(parameters_->max_webhook_pipelined_requests_)
     , secret_token_(std::move(secret_token))
     , slow_scheduler_id_(td::Scheduler::instance()->sched_count() - 2) {
   CHECK(max_connections_ > 0);
+  CHECK(max_batch_size_ > 0);
+  CHECK(max_pipelined_requests_ > 0);
   CHECK(slow_scheduler_id_ > 0);
 
   if (!cached_ip_address.empty()) {
@@ -68,12 +74,12 @@ WebhookActor::WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_
   LOG(INFO) << "Set webhook for " << tqueue_id << " with certificate = \"" << cert_path_
             << "\", protocol = " << (url_.protocol_ == td::HttpUrl::Protocol::Http ? "http" : "https")
             << ", host = " << url_.host_ << ", port = " << url_.port_ << ", query = " << url_.query_
-            << ", max_connections = " << max_connections_;
+            << ", max_connections = " << max_connections_ << ", max_batch_size = " << max_batch_size_
+            << ", gzip_min_size = " << gzip_min_size_;
 }
 
 WebhookActor::~WebhookActor() {
-  td::Scheduler::instance()->destroy_on_scheduler(SharedData::get_file_gc_scheduler_id(), update_map_, queue_updates_,
-                                                  queues_);
+  td::Scheduler::instance()->destroy_on_scheduler(SharedData::get_file_gc_scheduler_id(), queues_, free_queues_);
 }
 
 void WebhookActor::relax_wakeup_at(double wakeup_at, const char *source) {
@@ -216,7 +222,7 @@ td::Result<td::SslStream> WebhookActor::create_ssl_stream() {
   }
 
   CHECK(ssl_ctx_);
-  auto r_ssl_stream = td::SslStream::create(url_.host_, ssl_ctx_, !cert_path_.empty());
+  auto r_ssl_stream = td::SslStream::create(url_.host_, url_.port_, ssl_ctx_, !cert_path_.empty());
   if (r_ssl_stream.is_error()) {
     return create_webhook_error("Can't create an SSL connection", r_ssl_stream.move_as_error(), true);
   }
@@ -232,7 +238,6 @@ td::Status WebhookActor::create_connection(td::BufferedFd<td::SocketFd> fd) {
       PSLICE() << "Connect:" << id, std::move(fd), std::move(ssl_stream), 0, 20, 60,
       td::ActorShared<td::HttpOutboundConnection::Callback>(actor_id(this), id), slow_scheduler_id_);
   conn->ip_generation_ = ip_generation_;
-  conn->event_id_ = {};
   conn->id_ = id;
   ready_connections_.put(conn->to_list_node());
   total_connection_count_.fetch_add(1, std::memory_order_relaxed);
@@ -268,7 +273,7 @@ void WebhookActor::create_new_connections() {
     return;
   }
 
-  size_t need_connections = queue_updates_.size();
+  size_t need_connections = queues_.size();
   if (need_connections > static_cast<size_t>(max_connections_)) {
     need_connections = max_connections_;
   }
@@ -290,6 +295,11 @@ void WebhookActor::create_new_connections() {
     if (need_connections == 0) {
       need_connections = 1;
     }
+    if (was_checked_) {
+      // open connections in advance to handle bursts of updates without connection establishment delay
+      auto warm_connections = td::min(parameters_->warm_webhook_connections_, max_connections_);
+      need_connections = td::max(need_connections, static_cast<size_t>(warm_connections));
+    }
     active = true;
   }
   VLOG_IF(webhook, connections_.size() < need_connections)
@@ -360,20 +370,21 @@ void WebhookActor::load_updates() {
     VLOG(webhook) << "Load updates: tqueue is empty";
     return;
   }
-  if (queue_updates_.size() >= max_loaded_updates_) {
-    CHECK(queue_updates_.size() == max_loaded_updates_);
+  if (queues_.size() >= max_loaded_updates_) {
+    CHECK(queues_.size() == max_loaded_updates_);
     VLOG(webhook) << "Load updates: maximum allowed number of updates is already loaded";
     return;
   }
-  auto &tqueue = parameters_->shared_data_->tqueue_;
+  auto &client_shard = parameters_->shared_data_->get_client_shard(tqueue_id_);
+  auto &tqueue = client_shard.tqueue_;
   if (tqueue_offset_.empty()) {
     tqueue_offset_ = tqueue->get_head(tqueue_id_);
   }
   VLOG(webhook) << "Trying to load new updates from offset " << tqueue_offset_;
 
   auto offset = tqueue_offset_;
-  auto limit = td::min(SharedData::TQUEUE_EVENT_BUFFER_SIZE, max_loaded_updates_ - queue_updates_.size());
-  td::MutableSpan<td::TQueue::Event> updates(parameters_->shared_data_->event_buffer_, limit);
+  auto limit = td::min(SharedData::TQUEUE_EVENT_BUFFER_SIZE, max_loaded_updates_ - queues_.size());
+  td::MutableSpan<td::TQueue::Event> updates(client_shard.event_buffer_, limit);
 
   auto now = td::Time::now();
   auto unix_time_now = parameters_->shared_data_->get_unix_time(now);
@@ -397,31 +408,30 @@ void WebhookActor::load_updates() {
   for (auto &update : updates) {
     VLOG(webhook) << "Load update " << update.id;
     CHECK(update.id.is_valid());
-    auto &dest_ptr = update_map_[update.id];
-    if (dest_ptr != nullptr) {
+    if (update.id < tqueue_offset_) {
       LOG(ERROR) << "Receive duplicated event " << update.id << " from TQueue";
       continue;
     }
-    dest_ptr = td::make_unique<Update>();
-    auto &dest = *dest_ptr;
+    tqueue_offset_ = update.id.next().move_as_ok();
+
+    auto queue_id = update.extra;
+    if (queue_id == 0) {
+      queue_id = unique_queue_id_++;
+    }
+    auto &queue = add_queue(queue_id);
+    queue.updates_.emplace();
+    auto &dest = queue.updates_.back();
     dest.id_ = update.id;
-    dest.json_ = update.data.str();
+    dest.json_ = std::move(update.data);
     dest.delay_ = 1;
     dest.wakeup_at_ = now;
     CHECK(update.expires_at >= unix_time_now);
     dest.expires_at_ = update.expires_at;
-    dest.queue_id_ = update.extra;
-    tqueue_offset_ = update.id.next().move_as_ok();
+    loaded_update_count_++;
 
-    if (dest.queue_id_ == 0) {
-      dest.queue_id_ = unique_queue_id_++;
+    if (queue.updates_.size() == 1) {
+      schedule_queue(queue);
     }
-
-    auto &queue_updates = queue_updates_[dest.queue_id_];
-    if (queue_updates.event_ids.empty()) {
-      queues_.emplace(dest.wakeup_at_, dest.queue_id_);
-    }
-    queue_updates.event_ids.push(dest.id_);
   }
 
   bool need_warning = false;
@@ -437,8 +447,8 @@ void WebhookActor::load_updates() {
     }
   }
   if (need_warning) {
-    LOG(WARNING) << "Loaded " << updates.size() << " updates out of " << total_size << ". Have " << update_map_.size()
-                 << " updates loaded in " << queue_updates_.size() << " queues after last error \""
+    LOG(WARNING) << "Loaded " << updates.size() << " updates out of " << total_size << ". Have " << loaded_update_count_
+                 << " updates loaded in " << queues_.size() << " queues after last error \""
                  << last_error_message_ << "\" " << (last_error_time_ == 0 ? -1 : td::Time::now() - last_error_time_)
                  << " seconds ago";
   }
@@ -449,55 +459,75 @@ void WebhookActor::load_updates() {
 
   if (!updates.empty()) {
     VLOG(webhook) << "Loaded " << updates.size() << " new updates from offset " << offset << " out of requested "
-                  << limit << ". Have total of " << update_map_.size() << " updates loaded in " << queue_updates_.size()
+                  << limit << ". Have total of " << loaded_update_count_ << " updates loaded in " << queues_.size()
                   << " queues";
   }
 }
 
-void WebhookActor::drop_event(td::TQueue::EventId event_id) {
-  auto it = update_map_.find(event_id);
-  CHECK(it != update_map_.end());
-  auto queue_id = it->second->queue_id_;
-  update_map_.erase(it);
+WebhookActor::Queue &WebhookActor::add_queue(td::int64 queue_id) {
+  auto &queue = queues_[queue_id];
+  if (queue == nullptr) {
+    if (free_queues_.empty()) {
+      queue = td::make_unique<Queue>();
+    } else {
+      queue = std::move(free_queues_.back());
+      free_queues_.pop_back();
+    }
+    queue->id_ = queue_id;
+  }
+  return *queue;
+}
 
-  auto queue_updates_it = queue_updates_.find(queue_id);
+WebhookActor::Queue &WebhookActor::get_queue(td::int64 queue_id) {
+  auto it = queues_.find(queue_id);
+  CHECK(it != queues_.end());
+  return *it->second;
+}
 
-  CHECK(!queue_updates_it->second.event_ids.empty());
-  CHECK(event_id == queue_updates_it->second.event_ids.front());
-  queue_updates_it->second.event_ids.pop();
-  if (queue_updates_it->second.event_ids.empty()) {
-    queue_updates_.erase(queue_updates_it);
+void WebhookActor::schedule_queue(Queue &queue) {
+  CHECK(!queue.updates_.empty());
+  queue_heap_.insert(queue.updates_.front().wakeup_at_, queue.as_heap_node());
+}
+
+void WebhookActor::drop_event(Queue &queue) {
+  CHECK(!queue.as_heap_node()->in_heap());
+  auto event_id = queue.updates_.pop().id_;
+  CHECK(loaded_update_count_ > 0);
+  loaded_update_count_--;
+  if (queue.updates_.empty()) {
+    auto it = queues_.find(queue.id_);
+    CHECK(it != queues_.end());
+    free_queues_.push_back(std::move(it->second));
+    queues_.erase(it);
   } else {
-    auto update_id = queue_updates_it->second.event_ids.front();
-    CHECK(update_id.is_valid());
-    auto &update = update_map_[update_id];
-    queues_.emplace(update->wakeup_at_, update->queue_id_);
+    schedule_queue(queue);
   }
 
-  parameters_->shared_data_->tqueue_->forget(tqueue_id_, event_id);
+  parameters_->shared_data_->get_client_shard(tqueue_id_).tqueue_->forget(tqueue_id_, event_id);
 }
 
-void WebhookActor::on_update_ok(td::TQueue::EventId event_id) {
+void WebhookActor::on_update_ok(td::int64 queue_id) {
   last_update_was_successful_ = true;
   last_success_time_ = td::Time::now();
 
-  auto it = update_map_.find(event_id);
-  CHECK(it != update_map_.end());
+  auto &queue = get_queue(queue_id);
+  auto &update = queue.updates_.front();
 
-  VLOG(webhook) << "Receive ok for update " << event_id << " in " << (last_success_time_ - it->second->last_send_time_)
+  VLOG(webhook) << "Receive ok for update " << update.id_ << " in " << (last_success_time_ - update.last_send_time_)
                 << " seconds";
+  ServerMetrics::instance().add_webhook_update(true, last_success_time_ - update.last_send_time_);
 
-  drop_event(event_id);
+  drop_event(queue);
 }
 
-void WebhookActor::on_update_error(td::TQueue::EventId event_id, td::Slice error, int retry_after) {
+void WebhookActor::on_update_error(td::int64 queue_id, td::Slice error, int retry_after) {
   last_update_was_successful_ = false;
   double now = td::Time::now();
 
-  auto it = update_map_.find(event_id);
-  CHECK(it != update_map_.end());
-  CHECK(it->second != nullptr);
-  auto &update = *it->second;
+  auto &queue = get_queue(queue_id);
+  auto &update = queue.updates_.front();
+  auto event_id = update.id_;
+  ServerMetrics::instance().add_webhook_update(false, now - update.last_send_time_);
 
   const int MAX_RETRY_AFTER = 3600;
   retry_after = td::clamp(retry_after, 0, MAX_RETRY_AFTER);
@@ -510,46 +540,76 @@ void WebhookActor::on_update_error(td::TQueue::EventId event_id, td::Slice error
   }
   if (parameters_->shared_data_->get_unix_time(now) + next_effective_delay > update.expires_at_) {
     LOG(WARNING) << "Drop update " << event_id << ": " << error;
-    drop_event(event_id);
+    drop_event(queue);
     return;
   }
   update.delay_ = next_delay;
   update.wakeup_at_ = now + next_effective_delay;
   update.fail_count_++;
-  queues_.emplace(update.wakeup_at_, update.queue_id_);
+  schedule_queue(queue);
   VLOG(webhook) << "Delay update " << event_id << " for " << (update.wakeup_at_ - now) << " seconds because of "
                 << error << " after " << update.fail_count_ << " fails received in " << (now - update.last_send_time_)
                 << " seconds";
 }
 
+void WebhookActor::disable_pipelining() {
+  if (max_pipelined_requests_ == 1) {
+    return;
+  }
+  LOG(INFO) << "Disable HTTP pipelining for webhook " << url_.host_;
+  max_pipelined_requests_ = 1;
+  connections_.for_each([](td::uint64 id, Connection &connection) {
+    if (!connection.request_update_counts_.empty()) {
+      connection.remove();
+    }
+  });
+}
+
 td::Status WebhookActor::send_update() {
   if (ready_connections_.empty()) {
     return td::Status::Error("No connection");
   }
 
-  if (queues_.empty()) {
+  if (queue_heap_.empty()) {
     return td::Status::Error("No pending updates");
   }
-  auto it = queues_.begin();
   auto now = td::Time::now();
-  if (it->wakeup_at > now) {
-    relax_wakeup_at(it->wakeup_at, "send_update");
+  if (queue_heap_.top_key() > now) {
+    relax_wakeup_at(queue_heap_.top_key(), "send_update");
     return td::Status::Error("No ready updates");
   }
 
-  auto queue_id = it->id;
-  CHECK(queue_id != 0);
-  queues_.erase(it);
-  auto event_id = queue_updates_[queue_id].event_ids.front();
-  CHECK(event_id.is_valid());
+  // the connection is removed from ready_connections_ only after the request is created
+  auto &connection = *Connection::from_list_node(ready_connections_.get_prev());
 
-  auto update_map_it = update_map_.find(event_id);
-  CHECK(update_map_it != update_map_.end());
-  CHECK(update_map_it->second != nullptr);
-  auto &update = *update_map_it->second;
-  update.last_send_time_ = now;
+  // queue_heap_ contains each queue at most once, so updates in a batch are from different queues
+  td::int32 update_count = 0;
+  td::ChainBufferWriter body_writer;
+  if (max_batch_size_ > 1) {
+    body_writer.append(td::Slice("["));
+  }
+  while (!queue_heap_.empty() && queue_heap_.top_key() <= now && update_count < max_batch_size_) {
+    auto &queue = *Queue::from_heap_node(queue_heap_.pop());
+    CHECK(queue.id_ != 0);
+    auto &update = queue.updates_.front();
+    CHECK(update.id_.is_valid());
+    update.last_send_time_ = now;
+
+    if (update_count != 0) {
+      body_writer.append(td::Slice(","));
+    }
+    store_json_update(body_writer, update.id_.value(), update.json_);
+    connection.queue_ids_.push(queue.id_);
+    update_count++;
 
-  auto body = td::json_encode<td::BufferSlice>(JsonUpdate(update.id_.value(), update.json_));
+    VLOG(webhook) << "Send update " << update.id_ << " from queue " << queue.id_ << ": " << update.json_.as_slice();
+  }
+  if (max_batch_size_ > 1) {
+    body_writer.append(td::Slice("]"));
+  }
+  auto body = body_writer.extract_reader();
+  // the body is compressed in the connection while it is sent, so its final size isn't known in advance
+  bool is_gzipped = gzip_min_size_ > 0 && body.size() >= static_cast<size_t>(gzip_min_size_);
 
   td::HttpHeaderCreator hc;
   hc.init_post(url_.query_);
@@ -561,30 +621,47 @@ td::Status WebhookActor::send_update() {
     hc.add_header("X-Telegram-Bot-Api-Secret-Token", secret_token_);
   }
   hc.set_content_type("application/json");
-  hc.set_content_size(body.size());
+  if (is_gzipped) {
+    hc.add_header("Content-Encoding", "gzip");
+    hc.add_header("Transfer-Encoding", "chunked");
+  } else {
+    hc.set_content_size(body.size());
+  }
   hc.set_keep_alive();
   hc.add_header("Accept-Encoding", "gzip, deflate");
   auto r_header = hc.finish();
   if (r_header.is_error()) {
+    for (td::int32 i = 0; i < update_count; i++) {
+      connection.queue_ids_.pop_back();
+    }
     return td::Status::Error(400, "URL is too long");
   }
 
-  auto &connection = *Connection::from_list_node(ready_connections_.get());
-  connection.event_id_ = update.id_;
-
-  VLOG(webhook) << "Send update " << update.id_ << " from queue " << queue_id << " into connection " << connection.id_
-                << ": " << update.json_;
+  connection.to_list_node()->remove();
+  VLOG(webhook) << "Send " << update_count << " updates into connection " << connection.id_ << " with "
+                << connection.request_update_counts_.size() << " pending requests";
+  connection.request_update_counts_.push(update_count);
+  if (connection.request_update_counts_.size() < static_cast<size_t>(max_pipelined_requests_)) {
+    // the connection can be used for the next request before the response is received
+    ready_connections_.put(connection.to_list_node());
+  }
   VLOG(webhook) << "Request headers: " << r_header.ok();
 
   send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_next_noflush, td::BufferSlice(r_header.ok()));
-  send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_next_noflush, std::move(body));
+  if (is_gzipped) {
+    send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_gzip_body,
+                 parameters_->webhook_compression_level_);
+  }
+  while (!body.empty()) {
+    send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_next_noflush, body.read_as_buffer_slice());
+  }
   send_closure(connection.actor_id_, &td::HttpOutboundConnection::write_ok);
   return td::Status::OK();
 }
 
 void WebhookActor::send_updates() {
-  VLOG(webhook) << "Have " << (queues_.size() + update_map_.size() - queue_updates_.size()) << " pending updates in "
-                << queues_.size() << " queues to send";
+  VLOG(webhook) << "Have " << (queue_heap_.size() + loaded_update_count_ - queues_.size()) << " pending updates in "
+                << queue_heap_.size() << " queues to send";
   while (send_update().is_ok()) {
   }
 }
@@ -660,23 +737,36 @@ void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
     close_connection = true;
   }
 
-  auto event_id = connection_ptr->event_id_;
-  if (!event_id.empty()) {
-    if (query_error.empty()) {
-      on_update_ok(event_id);
-    } else {
-      on_update_error(event_id, query_error, retry_after);
+  auto &sent_queue_ids = connection_ptr->queue_ids_;
+  auto &sent_update_counts = connection_ptr->request_update_counts_;
+  if (sent_update_counts.size() > 1 &&
+      (!response || response->type_ != td::HttpQuery::Type::Response || !response->keep_alive_)) {
+    disable_pipelining();
+  }
+  if (!sent_update_counts.empty()) {
+    for (auto update_count = sent_update_counts.pop(); update_count > 0; update_count--) {
+      auto queue_id = sent_queue_ids.pop();
+      if (query_error.empty()) {
+        on_update_ok(queue_id);
+      } else {
+        on_update_error(queue_id, query_error, retry_after);
+      }
     }
   } else {
     CHECK(!query_error.empty());
   }
 
-  connection_ptr->event_id_ = {};
   if (need_close || close_connection) {
     VLOG(webhook) << "Close connection " << connection_id;
+    // responses to the pipelined requests will never be received
+    while (!sent_queue_ids.empty()) {
+      on_update_error(sent_queue_ids.pop(), "Webhook connection closed", 0);
+    }
     connections_.erase(connection_ptr->id_);
     total_connection_count_.fetch_sub(1, std::memory_order_relaxed);
-  } else {
+  } else if (sent_update_counts.size() < static_cast<size_t>(max_pipelined_requests_) &&
+             connection_ptr->to_list_node()->empty()) {
+    // the connection isn't in ready_connections_ yet
     ready_connections_.put(connection_ptr->to_list_node());
   }
 
@@ -688,7 +778,7 @@ void WebhookActor::handle(td::unique_ptr<td::HttpQuery> response) {
 }
 
 void WebhookActor::start_up() {
-  max_loaded_updates_ = max_connections_ * 2;
+  max_loaded_updates_ = static_cast<std::size_t>(max_connections_) * max_batch_size_ * max_pipelined_requests_ * 2;
 
   next_ip_address_resolve_time_ = last_success_time_ = td::Time::now() - 3600;
 
@@ -801,4 +891,11 @@ void WebhookActor::on_webhook_error(td::Slice error) {
   }
 }
 
+void store_json_update(td::ChainBufferWriter &writer, td::int32 id, const td::BufferSlice &update) {
+  CHECK(!update.empty());
+  writer.append(PSLICE() << "{\"update_id\":" << id << ",\n");
+  writer.append(update.clone());
+  writer.append(td::Slice("}"));
+}
+
 }  // namespace telegram_bot_api
@@ -17,14 +17,14 @@
 
 #include "td/actor/actor.h"
 
+#include "td/utils/buffer.h"
 #include "td/utils/BufferedFd.h"
 #include "td/utils/common.h"
 #include "td/utils/Container.h"
 #include "td/utils/FlatHashMap.h"
 #include "td/utils/FloodControlFast.h"
-#include "td/utils/HashTableUtils.h"
+#include "td/utils/Heap.h"
 #include "td/utils/HttpUrl.h"
-#include "td/utils/JsonBuilder.h"
 #include "td/utils/List.h"
 #include "td/utils/port/IPAddress.h"
 #include "td/utils/port/SocketFd.h"
@@ -34,8 +34,6 @@
 
 #include <atomic>
 #include <memory>
-#include <set>
-#include <tuple>
 
 namespace telegram_bot_api {
 
@@ -53,8 +51,9 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   };
 
   WebhookActor(td::ActorShared<Callback> callback, td::int64 tqueue_id, td::HttpUrl url, td::string cert_path,
-               td::int32 max_connections, bool from_db_flag, td::string cached_ip_address, bool fix_ip_address,
-               td::string secret_token, std::shared_ptr<const ClientParameters> parameters);
+               td::int32 max_connections, td::int32 max_batch_size, td::int32 gzip_min_size, bool from_db_flag,
+               td::string cached_ip_address, bool fix_ip_address, td::string secret_token,
+               std::shared_ptr<const ClientParameters> parameters);
   WebhookActor(const WebhookActor &) = delete;
   WebhookActor &operator=(const WebhookActor &) = delete;
   WebhookActor(WebhookActor &&) = delete;
@@ -98,43 +97,34 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   class Update {
    public:
     td::TQueue::EventId id_;
-    td::string json_;
+    td::BufferSlice json_;
     td::int32 expires_at_ = 0;
     double last_send_time_ = 0;
     double wakeup_at_ = 0;
     int delay_ = 0;
     int fail_count_ = 0;
-    td::int64 queue_id_ = 0;
   };
 
-  struct QueueUpdates {
-    td::VectorQueue<td::TQueue::EventId> event_ids;
-  };
+  // updates from a queue are sent one by one; the queue is in queue_heap_ if its first update is waiting to be sent
+  class Queue final : private td::HeapNode {
+   public:
+    td::int64 id_ = 0;
+    td::VectorQueue<Update> updates_;
 
-  struct Queue {
-    Queue() = default;
-    Queue(double wakeup_at, td::int64 id)
-        : wakeup_at(wakeup_at), integer_wakeup_at(static_cast<td::int64>(wakeup_at * 1e9)), id(id) {
+    td::HeapNode *as_heap_node() {
+      return static_cast<td::HeapNode *>(this);
     }
-    double wakeup_at{0};
-    td::int64 integer_wakeup_at{0};
-    td::int64 id{0};
-
-    bool operator<(const Queue &other) const {
-      return std::tie(integer_wakeup_at, id) < std::tie(other.integer_wakeup_at, other.id);
+    static Queue *from_heap_node(td::HeapNode *node) {
+      return static_cast<Queue *>(node);
     }
   };
 
   td::TQueue::EventId tqueue_offset_;
   std::size_t max_loaded_updates_ = 0;
-  struct EventIdHash {
-    td::uint32 operator()(td::TQueue::EventId event_id) const {
-      return td::Hash<td::int32>()(event_id.value());
-    }
-  };
-  td::FlatHashMap<td::TQueue::EventId, td::unique_ptr<Update>, EventIdHash> update_map_;
-  td::FlatHashMap<td::int64, QueueUpdates> queue_updates_;
-  std::set<Queue> queues_;
+  std::size_t loaded_update_count_ = 0;
+  td::FlatHashMap<td::int64, td::unique_ptr<Queue>> queues_;
+  td::vector<td::unique_ptr<Queue>> free_queues_;  // emptied queues, which are reused to avoid memory allocations
+  td::KHeap<double> queue_heap_;                   // by wakeup time of the first update in the queue
   td::int64 unique_queue_id_ = static_cast<td::int64>(1) << 60;
 
   double first_error_410_time_ = 0;
@@ -156,7 +146,11 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
 
     td::ActorOwn<td::HttpOutboundConnection> actor_id_;
     td::uint64 id_ = 0;
-    td::TQueue::EventId event_id_;
+    // identifiers of queues, which first updates were sent in requests, for which a response is expected,
+    // in the order of sending
+    td::VectorQueue<td::int64> queue_ids_;
+    // number of updates in each of the requests
+    td::VectorQueue<td::int32> request_update_counts_;
     td::int32 ip_generation_ = -1;
     static Connection *from_list_node(ListNode *node) {
       return static_cast<Connection *>(node);
@@ -169,6 +163,9 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   td::vector<td::BufferedFd<td::SocketFd>> ready_sockets_;
 
   td::int32 max_connections_ = 0;
+  td::int32 max_batch_size_ = 1;  // if more than 1, then updates are sent as JSON arrays
+  td::int32 gzip_min_size_ = 0;   // if positive, then request bodies of at least this size are sent gzipped
+  td::int32 max_pipelined_requests_ = 1;
   td::string secret_token_;
   td::Container<Connection> connections_;
   td::ListNode ready_connections_;
@@ -195,11 +192,16 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
 
   void create_new_connections();
 
-  void drop_event(td::TQueue::EventId event_id);
+  Queue &add_queue(td::int64 queue_id);
+  Queue &get_queue(td::int64 queue_id);
+  void schedule_queue(Queue &queue);
+
+  void drop_event(Queue &queue);
 
   void load_updates();
-  void on_update_ok(td::TQueue::EventId event_id);
-  void on_update_error(td::TQueue::EventId event_id, td::Slice error, int retry_after);
+  void on_update_ok(td::int64 queue_id);
+  void on_update_error(td::int64 queue_id, td::Slice error, int retry_after);
+  void disable_pipelining();
   td::Status send_update() TD_WARN_UNUSED_RESULT;
   void send_updates();
 
@@ -222,21 +224,7 @@ class WebhookActor final : public td::HttpOutboundConnection::Callback {
   void on_webhook_verified();
 };
 
-class JsonUpdate final : public td::Jsonable {
- public:
-  JsonUpdate(td::int32 id, td::Slice update) : id_(id), update_(update) {
-  }
-  void store(td::JsonValueScope *scope) const {
-    auto object = scope->enter_object();
-    object("update_id", id_);
-    object << td::JsonRaw(",\n");
-    CHECK(!update_.empty());
-    object << td::JsonRaw(update_);
-  }
-
- private:
-  td::int32 id_;
-  td::Slice update_;
-};
+// appends {"update_id":id,\n<update>} to the writer; long updates are linked to the writer without copying
+void store_json_update(td::ChainBufferWriter &writer, td::int32 id, const td::BufferSlice &update);
 
 }  // namespace telegram_bot_api
@@ -4,11 +4,13 @@
 // Distributed under the Boost Software License, Version 1.0. (See accompanying
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
+#include "telegram-bot-api/Client.h"
 #include "telegram-bot-api/ClientManager.h"
 #include "telegram-bot-api/ClientParameters.h"
 #include "telegram-bot-api/HttpConnection.h"
 #include "telegram-bot-api/HttpServer.h"
 #include "telegram-bot-api/HttpStatConnection.h"
+#include "telegram-bot-api/Metrics.h"
 #include "telegram-bot-api/Stats.h"
 #include "telegram-bot-api/Watchdog.h"
 
@@ -16,6 +18,7 @@
 
 #include "td/net/GetHostByNameActor.h"
 #include "td/net/HttpInboundConnection.h"
+#include "td/net/HttpReader.h"
 
 #include "td/actor/actor.h"
 #include "td/actor/ConcurrentScheduler.h"
@@ -25,6 +28,7 @@
 #include "td/utils/common.h"
 #include "td/utils/crypto.h"
 #include "td/utils/ExitGuard.h"
+#include "td/utils/JsonBuilder.h"
 //#include "td/utils/GitInfo.h"
 #include "td/utils/logging.h"
 #include "td/utils/MemoryLog.h"
@@ -34,6 +38,7 @@
 #include "td/utils/port/detail/ThreadIdGuard.h"
 #include "td/utils/port/IPAddress.h"
 #include "td/utils/port/path.h"
+#include "td/utils/port/Poll.h"
 #include "td/utils/port/rlimit.h"
 #include "td/utils/port/signals.h"
 #include "td/utils/port/stacktrace.h"
@@ -184,11 +189,15 @@ int main(int argc, char *argv[]) {
   td::int64 log_max_file_size = 2000000000;
   td::string working_directory = PSTRING() << "." << TD_DIR_SLASH;
   td::string temporary_directory;
+  td::string memory_temporary_directory;
+  td::int64 memory_temporary_directory_size = 256;
+  td::int64 memory_temporary_file_size = 16;
   td::string username;
   td::string groupname;
   td::uint64 max_connections = 0;
   td::uint64 cpu_affinity = 0;
   td::uint64 main_thread_affinity = 0;
+  bool use_io_uring = false;
   ClientManager::TokenRange token_range{0, 1};
 
   parameters->api_id_ = [](auto x) -> td::int32 {
@@ -226,6 +235,20 @@ int main(int argc, char *argv[]) {
   options.add_option('d', "dir", "server working directory", td::OptionParser::parse_string(working_directory));
   options.add_option('t', "temp-dir", "directory for storing HTTP server temporary files",
                      td::OptionParser::parse_string(temporary_directory));
+  options.add_option('\0', "memory-temp-dir",
+                     "directory in a RAM-backed file system, for example, /dev/shm, for storing uploaded files; files "
+                     "are stored in the temporary directory only if the memory limit is exceeded",
+                     td::OptionParser::parse_string(memory_temporary_directory));
+  options.add_checked_option('\0', "memory-temp-dir-size",
+                             PSLICE() << "maximum total size of uploaded files stored in memory in megabytes "
+                                         "(default is "
+                                      << memory_temporary_directory_size << ")",
+                             td::OptionParser::parse_integer(memory_temporary_directory_size));
+  options.add_checked_option('\0', "memory-temp-file-size",
+                             PSLICE() << "maximum size of an uploaded file stored in memory in megabytes; bigger files "
+                                         "are stored in the temporary directory (default is "
+                                      << memory_temporary_file_size << ")",
+                             td::OptionParser::parse_integer(memory_temporary_file_size));
   options.add_checked_option('\0', "filter",
                              "\"<remainder>/<modulo>\". Allow only bots with 'bot_user_id % modulo == remainder'",
                              [&](td::Slice rem_mod) {
@@ -240,9 +263,47 @@ int main(int argc, char *argv[]) {
                                token_range = {rem_i, mod_i};
                                return td::Status::OK();
                              });
+  options.add_checked_option('\0', "client-threads",
+                             PSLICE() << "number of threads for handling bots; each thread gets its own TDLib thread "
+                                         "(default is "
+                                      << shared_data->client_shard_count_ << ")",
+                             td::OptionParser::parse_integer(shared_data->client_shard_count_));
+  options.add_checked_option('\0', "http-threads",
+                             "number of threads with separate HTTP listeners on the same port, each of which accepts "
+                             "connections and parses requests on its own (default is 0, i.e. HTTP requests are "
+                             "accepted in the thread of the first ClientManager)",
+                             td::OptionParser::parse_integer(shared_data->http_scheduler_count_));
   options.add_checked_option('\0', "max-webhook-connections",
                              "default value of the maximum webhook connections per bot",
                              td::OptionParser::parse_integer(parameters->default_max_webhook_connections_));
+  options.add_checked_option('\0', "max-webhook-pipelined-requests",
+                             "maximum number of webhook requests sent over a connection before receiving responses "
+                             "to them (default is 1, i.e. HTTP pipelining is disabled)",
+                             td::OptionParser::parse_integer(parameters->max_webhook_pipelined_requests_));
+  options.add_checked_option('\0', "warm-webhook-connections",
+                             "number of connections to keep open to each working webhook even if there are no pending "
+                             "updates (default is 0)",
+                             td::OptionParser::parse_integer(parameters->warm_webhook_connections_));
+  options.add_checked_option('\0', "webhook-compression-level",
+                             "gzip compression level from 1 to 9 for webhook requests of bots, which enabled their "
+                             "compression with the parameter gzip_min_size (default is 6)",
+                             td::OptionParser::parse_integer(parameters->webhook_compression_level_));
+  options.add_checked_option('\0', "http-compression-level",
+                             "gzip compression level from 0 to 9 for responses to clients, which support it; requires "
+                             "--http-threads (default is 0, i.e. responses aren't compressed)",
+                             td::OptionParser::parse_integer(parameters->http_compression_level_));
+  options.add_checked_option('\0', "http-compression-min-size",
+                             "minimum size of a response in bytes to be compressed (default is 1024)",
+                             td::OptionParser::parse_integer(parameters->http_compression_min_size_));
+  options.add_checked_option('\0', "hibernation-timeout",
+                             "time in seconds after which a bot without webhook, pending updates and requests is "
+                             "closed until its next request (default is 0, i.e. bots are never hibernated)",
+                             td::OptionParser::parse_integer(parameters->hibernation_timeout_));
+  options.add_option('\0', "io-uring", "use io_uring instead of epoll for network I/O, if supported by the kernel",
+                     [&] { use_io_uring = true; });
+  options.add_option('\0', "raw-utf8-json",
+                     "write non-ASCII characters in JSON responses and updates as UTF-8 instead of \\u escapes",
+                     [&] { shared_data->json_escape_non_ascii_ = false; });
   options.add_checked_option('\0', "http-ip-address",
                              "local IP address, HTTP connections to which will be accepted. By default, connections to "
                              "any local IPv4 address are accepted",
@@ -304,6 +365,15 @@ int main(int argc, char *argv[]) {
     }
     return td::Status::OK();
   });
+  options.add_check([&] {
+    if (shared_data->client_shard_count_ <= 0 || shared_data->client_shard_count_ > 64) {
+      return td::Status::Error("Wrong number of client threads specified");
+    }
+    if (shared_data->http_scheduler_count_ < 0 || shared_data->http_scheduler_count_ > 64) {
+      return td::Status::Error("Wrong number of HTTP threads specified");
+    }
+    return td::Status::OK();
+  });
   options.add_check([&] {
     if (default_verbosity_level < 0) {
       return td::Status::Error("Wrong verbosity level specified");
@@ -407,6 +477,22 @@ int main(int argc, char *argv[]) {
       TRY_STATUS_PREFIX(td::set_temporary_dir(temporary_directory), "Can't set temporary directory: ");
     }
 
+    if (!memory_temporary_directory.empty()) {
+      if (td::PathView(memory_temporary_directory).is_relative()) {
+        memory_temporary_directory = working_directory + memory_temporary_directory;
+      }
+      if (memory_temporary_directory_size <= 0 || memory_temporary_directory_size > 1000000) {
+        return td::Status::Error("Wrong size of the in-memory temporary directory specified");
+      }
+      if (memory_temporary_file_size <= 0 || memory_temporary_file_size > memory_temporary_directory_size) {
+        return td::Status::Error("Wrong maximum size of an in-memory temporary file specified");
+      }
+      TRY_STATUS_PREFIX(td::HttpReader::set_memory_temporary_dir(memory_temporary_directory,
+                                                                 memory_temporary_directory_size << 20,
+                                                                 memory_temporary_file_size << 20),
+                        "Can't set in-memory temporary directory: ");
+    }
+
     {  // check temporary directory
       auto temp_dir = td::get_temporary_dir();
       if (temp_dir.empty()) {
@@ -444,6 +530,12 @@ int main(int argc, char *argv[]) {
   if (parameters->default_max_webhook_connections_ <= 0) {
     parameters->default_max_webhook_connections_ = parameters->local_mode_ ? 100 : 40;
   }
+  parameters->max_webhook_pipelined_requests_ = td::clamp(parameters->max_webhook_pipelined_requests_, 1, 100);
+  parameters->warm_webhook_connections_ = td::max(parameters->warm_webhook_connections_, 0);
+  parameters->webhook_compression_level_ = td::clamp(parameters->webhook_compression_level_, 1, 9);
+  parameters->http_compression_level_ = td::clamp(parameters->http_compression_level_, 0, 9);
+  parameters->http_compression_min_size_ = td::max(parameters->http_compression_min_size_, 0);
+  parameters->hibernation_timeout_ = td::max(parameters->hibernation_timeout_, 0);
 
   ::td::VERBOSITY_NAME(dns_resolver) = VERBOSITY_NAME(WARNING);
 
@@ -459,37 +551,68 @@ int main(int argc, char *argv[]) {
   //              << (td::GitInfo::is_dirty() ? "(dirty)" : "") << " started";
   LOG(WARNING) << "Bot API " << parameters->version_ << " server started";
 
-  // +3 threads for Td
-  // one thread for ClientManager and all Clients
+  // +4 threads for each client shard: the shard Td and its database, file GC and slow network threads
+  // one thread for each ClientManager partition and all its Clients
+  // one thread for each separate HTTP listener
   // one thread for watchdogs
-  // one thread for slow HTTP connections
-  // one thread for DNS resolving
-  const int thread_count = 7;
+  // one thread for ClientManager watchdogs
+  // one thread for slow HTTP connections and DNS resolving
+  // the first Td thread is the main thread
+  const int thread_count = shared_data->get_thread_count();
+  if (use_io_uring && !td::set_poll_use_io_uring(true)) {
+    LOG(WARNING) << "io_uring isn't supported by the kernel, epoll is used instead";
+  }
+  if (parameters->http_compression_level_ > 0 && shared_data->http_scheduler_count_ == 0) {
+    // compression must not slow down the thread of ClientManager and Clients, which handles HTTP connections otherwise
+    LOG(WARNING) << "Response compression requires --http-threads and is disabled";
+    parameters->http_compression_level_ = 0;
+  }
   td::ConcurrentScheduler sched(thread_count, cpu_affinity);
 
+  // routes are used by HTTP connections and ClientManagers, which can be created on any scheduler with a thread
+  shared_data->client_routes_ = td::make_unique<ClientRoutes>(thread_count + 1);
+
+  // metrics are added on all schedulers
+  ServerMetrics::instance().init(thread_count + 1);
+
+  // method identifiers are assigned to queries in HTTP threads, so the methods must be registered before that
+  Client::init_methods();
+
   td::GetHostByNameActor::Options get_host_by_name_options;
   get_host_by_name_options.scheduler_id = thread_count;
   parameters->get_host_by_name_actor_id_ =
       sched.create_actor_unsafe<td::GetHostByNameActor>(0, "GetHostByName", std::move(get_host_by_name_options))
           .release();
 
+  std::shared_ptr<const ClientParameters> client_parameters = std::move(parameters);
+  auto client_scheduler_id = shared_data->get_client_scheduler_id(0);
   auto client_manager =
-      sched.create_actor_unsafe<ClientManager>(thread_count - 3, "ClientManager", std::move(parameters), token_range)
+      sched.create_actor_unsafe<ClientManager>(client_scheduler_id, "ClientManager", client_parameters, token_range)
           .release();
 
-  sched
-      .create_actor_unsafe<HttpServer>(
-          thread_count - 3, "HttpServer", http_ip_address, http_port,
-          [client_manager, shared_data] {
-            return td::ActorOwn<td::HttpInboundConnection::Callback>(
-                td::create_actor<HttpConnection>("HttpConnection", client_manager, shared_data));
-          })
-      .release();
+  auto create_http_server = [&](td::int32 scheduler_id) {
+    sched
+        .create_actor_unsafe<HttpServer>(
+            scheduler_id, "HttpServer", http_ip_address, http_port,
+            [client_manager, client_parameters, shared_data] {
+              return td::ActorOwn<td::HttpInboundConnection::Callback>(td::create_actor<HttpConnection>(
+                  "HttpConnection", client_manager, client_parameters, shared_data));
+            })
+        .release();
+  };
+  if (shared_data->http_scheduler_count_ == 0) {
+    create_http_server(client_scheduler_id);
+  } else {
+    // all listeners are bound to the same port with SO_REUSEPORT, so the OS distributes connections between them
+    for (td::int32 i = 0; i < shared_data->http_scheduler_count_; i++) {
+      create_http_server(shared_data->get_http_scheduler_id(i));
+    }
+  }
 
   if (http_stat_port != 0) {
     sched
         .create_actor_unsafe<HttpServer>(
-            thread_count - 3, "HttpStatsServer", http_stat_ip_address, http_stat_port,
+            client_scheduler_id, "HttpStatsServer", http_stat_ip_address, http_stat_port,
             [client_manager] {
               return td::ActorOwn<td::HttpInboundConnection::Callback>(
                   td::create_actor<HttpStatConnection>("HttpStatConnection", client_manager));
@@ -562,6 +685,7 @@ int main(int argc, char *argv[]) {
       }
       next_cron_time += 1.0;
       ServerCpuStat::update(now);
+      ServerMetrics::instance().set_scheduler_queue_sizes(sched.get_scheduler_queue_sizes());
     }
 
     if (now >= start_time + 600) {